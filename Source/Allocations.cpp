@@ -0,0 +1,98 @@
+// Copyright 2022 Justus Zorn
+
+#include <cstdlib>
+#include <new>
+
+#include "Allocations.h"
+
+using namespace Hazard;
+
+// Both are constant-initialized, so operator new can use them on any thread
+// at any time, even before the thread ran any other code
+static thread_local AllocationStats threadAllocations;
+static thread_local Subsystem currentSubsystem = Subsystem::Other;
+
+static const char* subsystemNames[Subsystems] = {
+	"other", "network", "script", "scene", "client", "render", "audio"
+};
+
+static const char* allocatorNames[Allocators] = {
+	"heap", "lua", "enet", "sdl"
+};
+
+const AllocationCounter& AllocationStats::Get(Allocator allocator, Subsystem subsystem) const {
+	return counters[static_cast<std::size_t>(allocator)][static_cast<std::size_t>(subsystem)];
+}
+
+AllocationStats AllocationStats::operator-(const AllocationStats& previous) const {
+	AllocationStats result;
+	for (std::size_t i = 0; i < Allocators; ++i) {
+		for (std::size_t j = 0; j < Subsystems; ++j) {
+			result.counters[i][j].allocations = counters[i][j].allocations - previous.counters[i][j].allocations;
+			result.counters[i][j].frees = counters[i][j].frees - previous.counters[i][j].frees;
+			result.counters[i][j].bytes = counters[i][j].bytes - previous.counters[i][j].bytes;
+		}
+	}
+	return result;
+}
+
+void Hazard::CountAllocation(Allocator allocator, std::size_t bytes) {
+	AllocationCounter& counter = threadAllocations.counters[static_cast<std::size_t>(allocator)][static_cast<std::size_t>(currentSubsystem)];
+	++counter.allocations;
+	counter.bytes += bytes;
+}
+
+void Hazard::CountFree(Allocator allocator) {
+	++threadAllocations.counters[static_cast<std::size_t>(allocator)][static_cast<std::size_t>(currentSubsystem)].frees;
+}
+
+const AllocationStats& Hazard::GetThreadAllocations() {
+	return threadAllocations;
+}
+
+bool Hazard::IsTrackingHeap() {
+#ifdef HAZARD_TRACK_ALLOCATIONS
+	return true;
+#else
+	return false;
+#endif
+}
+
+const char* Hazard::GetSubsystemName(Subsystem subsystem) {
+	return subsystemNames[static_cast<std::size_t>(subsystem)];
+}
+
+const char* Hazard::GetAllocatorName(Allocator allocator) {
+	return allocatorNames[static_cast<std::size_t>(allocator)];
+}
+
+SubsystemScope::SubsystemScope(Subsystem subsystem) : previous{ currentSubsystem } {
+	currentSubsystem = subsystem;
+}
+
+SubsystemScope::~SubsystemScope() {
+	currentSubsystem = previous;
+}
+
+#ifdef HAZARD_TRACK_ALLOCATIONS
+// The array and nothrow forms of the standard library call these
+void* operator new(std::size_t size) {
+	void* memory = std::malloc(size > 0 ? size : 1);
+	if (!memory) {
+		throw std::bad_alloc();
+	}
+	CountAllocation(Allocator::Heap, size);
+	return memory;
+}
+
+void operator delete(void* memory) noexcept {
+	if (memory) {
+		CountFree(Allocator::Heap);
+		std::free(memory);
+	}
+}
+
+void operator delete(void* memory, std::size_t) noexcept {
+	operator delete(memory);
+}
+#endif
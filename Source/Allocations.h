@@ -0,0 +1,79 @@
+// Copyright 2022 Justus Zorn
+
+#ifndef Hazard_Allocations_h
+#define Hazard_Allocations_h
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Hazard {
+	// Every allocation is attributed to the subsystem of the innermost
+	// SubsystemScope of its thread
+	enum class Subsystem : std::uint8_t {
+		Other,
+		Network,
+		Script,
+		Scene,
+		Client,
+		Render,
+		Audio
+	};
+
+	enum class Allocator : std::uint8_t {
+		// Global operator new, only counted if Hazard was built with
+		// HAZARD_TRACK_ALLOCATIONS
+		Heap,
+		Lua,
+		ENet,
+		// SDL_malloc, which SDL and SDL_ttf use for surfaces and textures
+		SDL
+	};
+
+	constexpr std::size_t Subsystems = 7;
+	constexpr std::size_t Allocators = 4;
+
+	struct AllocationCounter {
+		std::uint64_t allocations = 0;
+		std::uint64_t frees = 0;
+		std::uint64_t bytes = 0;
+	};
+
+	// Allocations of one thread since its start. The counters are only
+	// written by their own thread, so they can be counted without atomics,
+	// and every thread reports its own allocations.
+	struct AllocationStats {
+		AllocationCounter counters[Allocators][Subsystems];
+
+		const AllocationCounter& Get(Allocator allocator, Subsystem subsystem) const;
+
+		// Returns the allocations that happened since 'previous'
+		AllocationStats operator-(const AllocationStats& previous) const;
+	};
+
+	void CountAllocation(Allocator allocator, std::size_t bytes);
+	void CountFree(Allocator allocator);
+
+	const AllocationStats& GetThreadAllocations();
+
+	// Returns true if the global operator new is counted
+	bool IsTrackingHeap();
+
+	const char* GetSubsystemName(Subsystem subsystem);
+	const char* GetAllocatorName(Allocator allocator);
+
+	// Attributes the allocations of the current thread to 'subsystem' for the
+	// lifetime of the scope
+	class SubsystemScope {
+	public:
+		SubsystemScope(Subsystem subsystem);
+		SubsystemScope(const SubsystemScope&) = delete;
+		~SubsystemScope();
+
+		SubsystemScope& operator=(const SubsystemScope&) = delete;
+
+	private:
+		Subsystem previous;
+	};
+}
+
+#endif
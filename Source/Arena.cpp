@@ -0,0 +1,77 @@
+// Copyright 2022 Justus Zorn
+
+#include <cstdlib>
+
+#include "Arena.h"
+
+using namespace Hazard;
+
+Arena::Arena(std::size_t blockSize) : blockSize{ blockSize } {}
+
+Arena::~Arena() {
+	FreeBlocks();
+}
+
+void* Arena::Allocate(std::size_t size, std::size_t alignment) {
+	++stats.allocations;
+	stats.bytes += size;
+
+	std::size_t start = (offset + alignment - 1) & ~(alignment - 1);
+	if (!block || start + size > block->size) {
+		AddBlock(size > blockSize ? size : blockSize);
+		start = 0;
+	}
+	offset = start + size;
+
+	used += size;
+	if (used > stats.peakBytes) {
+		stats.peakBytes = used;
+	}
+
+	return reinterpret_cast<std::uint8_t*>(block + 1) + start;
+}
+
+void Arena::Reset() {
+	if (block && block->next) {
+		// Several blocks were needed since the last reset, so they are replaced
+		// with a single block that is large enough for all of them
+		std::size_t size = 0;
+		for (Block* current = block; current; current = current->next) {
+			size += current->size;
+		}
+		FreeBlocks();
+		AddBlock(size);
+	}
+	offset = 0;
+	used = 0;
+}
+
+const ArenaStats& Arena::GetStats() const {
+	return stats;
+}
+
+void Arena::ClearStats() {
+	stats = ArenaStats();
+	stats.peakBytes = used;
+}
+
+void Arena::AddBlock(std::size_t size) {
+	Block* newBlock = static_cast<Block*>(std::malloc(sizeof(Block) + size));
+	if (!newBlock) {
+		throw std::bad_alloc();
+	}
+	newBlock->next = block;
+	newBlock->size = size;
+	block = newBlock;
+	offset = 0;
+
+	++stats.heapAllocations;
+}
+
+void Arena::FreeBlocks() {
+	while (block) {
+		Block* next = block->next;
+		std::free(block);
+		block = next;
+	}
+}
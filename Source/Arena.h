@@ -0,0 +1,99 @@
+// Copyright 2022 Justus Zorn
+
+#ifndef Hazard_Arena_h
+#define Hazard_Arena_h
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+namespace Hazard {
+	struct ArenaStats {
+		std::uint64_t allocations = 0;
+		std::uint64_t bytes = 0;
+		std::uint64_t peakBytes = 0;
+		std::uint64_t heapAllocations = 0;
+	};
+
+	// Bump allocator for objects that only live until the next call to Reset.
+	// Memory is taken from large blocks, and after a Reset all blocks are merged
+	// into one, so that an arena that is reset regularly stops allocating from
+	// the heap once it has grown to its working size.
+	class Arena {
+	public:
+		Arena(std::size_t blockSize = 64 * 1024);
+		Arena(const Arena&) = delete;
+		~Arena();
+
+		Arena& operator=(const Arena&) = delete;
+
+		void* Allocate(std::size_t size, std::size_t alignment = alignof(std::max_align_t));
+		void Reset();
+
+		const ArenaStats& GetStats() const;
+		void ClearStats();
+
+	private:
+		struct alignas(std::max_align_t) Block {
+			Block* next;
+			std::size_t size;
+		};
+
+		Block* block = nullptr;
+		std::size_t offset = 0;
+		std::size_t blockSize;
+		std::size_t used = 0;
+
+		ArenaStats stats;
+
+		void AddBlock(std::size_t size);
+		void FreeBlocks();
+	};
+
+	// Standard allocator on top of an Arena. Without an arena, it uses the heap.
+	template <typename T>
+	class ArenaAllocator {
+	public:
+		using value_type = T;
+
+		ArenaAllocator(Arena* arena = nullptr) noexcept : arena{ arena } {}
+
+		template <typename U>
+		ArenaAllocator(const ArenaAllocator<U>& other) noexcept : arena{ other.arena } {}
+
+		T* allocate(std::size_t n) {
+			if (arena) {
+				return static_cast<T*>(arena->Allocate(n * sizeof(T), alignof(T)));
+			}
+			return static_cast<T*>(::operator new(n * sizeof(T)));
+		}
+
+		void deallocate(T* p, std::size_t) noexcept {
+			if (!arena) {
+				::operator delete(p);
+			}
+		}
+
+		template <typename U>
+		bool operator==(const ArenaAllocator<U>& other) const noexcept {
+			return arena == other.arena;
+		}
+
+		template <typename U>
+		bool operator!=(const ArenaAllocator<U>& other) const noexcept {
+			return arena != other.arena;
+		}
+
+	private:
+		template <typename U>
+		friend class ArenaAllocator;
+
+		Arena* arena;
+	};
+
+	template <typename T>
+	using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+}
+
+#endif
@@ -2,10 +2,11 @@
 
 #include <cstring>
 #include <fstream>
-#include <iostream>
 #include <mutex>
 
+#include "Allocations.h"
 #include "Audio.h"
+#include "Log.h"
 
 using namespace Hazard;
 
@@ -13,10 +14,13 @@ static std::mutex audioLock;
 
 static int paCallback(const void* inputBuffer, void* outputBuffer, unsigned long framesPerBuffer,
 	const PaStreamCallbackTimeInfo* timeInfo, PaStreamCallbackFlags statusFlags, void* userData) {
-	Audio::Channel* channels = reinterpret_cast<Audio::Channel*>(userData);
-	std::int16_t* out = (std::int16_t*)outputBuffer;
-
 	audioLock.lock();
+	Audio::Mix(reinterpret_cast<Audio::Channel*>(userData), reinterpret_cast<std::int16_t*>(outputBuffer), framesPerBuffer);
+	audioLock.unlock();
+	return paContinue;
+}
+
+void Audio::Mix(Channel* channels, std::int16_t* out, unsigned long framesPerBuffer) {
 	for (unsigned long i = 0; i < framesPerBuffer; ++i) {
 		std::int32_t left = 0, right = 0;
 
@@ -58,26 +62,24 @@ static int paCallback(const void* inputBuffer, void* outputBuffer, unsigned long
 		out[i * 2] = left;
 		out[i * 2 + 1] = right;
 	}
-	audioLock.unlock();
-	return paContinue;
 }
 
 Audio::Audio() {
 	PaError err;
 	err = Pa_Initialize();
 	if (err != paNoError) {
-		std::cerr << "ERROR: Could not initialize PortAudio: " << Pa_GetErrorText(err) << '\n';
+		HAZARD_ERROR("Could not initialize PortAudio: " << Pa_GetErrorText(err));
 		throw std::exception();
 	}
 	err = Pa_OpenDefaultStream(&stream, 0, 2, paInt16, 44100, paFramesPerBufferUnspecified,
 		paCallback, channels);
 	if (err != paNoError) {
-		std::cerr << "ERROR: Could not open PortAudio stream: " << Pa_GetErrorText(err) << '\n';
+		HAZARD_ERROR("Could not open PortAudio stream: " << Pa_GetErrorText(err));
 		throw std::exception();
 	}
 	err = Pa_StartStream(stream);
 	if (err != paNoError) {
-		std::cerr << "ERROR: Could not start PortAudio stream: " << Pa_GetErrorText(err) << '\n';
+		HAZARD_ERROR("Could not start PortAudio stream: " << Pa_GetErrorText(err));
 		throw std::exception();
 	}
 }
@@ -86,15 +88,15 @@ Audio::~Audio() {
 	PaError err;
 	err = Pa_AbortStream(stream);
 	if (err != paNoError) {
-		std::cerr << "ERROR: Could not stop PortAudio stream: " << Pa_GetErrorText(err) << '\n';
+		HAZARD_ERROR("Could not stop PortAudio stream: " << Pa_GetErrorText(err));
 	}
 	err = Pa_CloseStream(stream);
 	if (err != paNoError) {
-		std::cerr << "ERROR: Could not close PortAudio stream: " << Pa_GetErrorText(err) << '\n';
+		HAZARD_ERROR("Could not close PortAudio stream: " << Pa_GetErrorText(err));
 	}
 	err = Pa_Terminate();
 	if (err != paNoError) {
-		std::cerr << "ERROR: Could not terminate PortAudio: " << Pa_GetErrorText(err) << '\n';
+		HAZARD_ERROR("Could not terminate PortAudio: " << Pa_GetErrorText(err));
 	}
 
 	for (Sound& sound : loadedSounds) {
@@ -120,6 +122,7 @@ void Audio::LoadSounds(const std::vector<std::string>& sounds) {
 }
 
 void Audio::Run(const AudioCommand& command) {
+	SubsystemScope subsystem(Subsystem::Audio);
 	audioLock.lock();
 	switch (command.type) {
 	case AudioCommand::Type::Play:
@@ -193,20 +196,20 @@ Audio::Sound Audio::LoadWave(const std::string& path) {
 
 	std::ifstream file(path, std::ios::binary);
 	if (!file.is_open()) {
-		std::cerr << "ERROR: Could not load sound '" << path << "': Could not open file\n";
+		HAZARD_ERROR("Could not load sound '" << path << "': Could not open file");
 		return sound;
 	}
 
 	WaveHeader header;
 	file.read((char*)&header, sizeof(WaveHeader));
 	if (file.fail()) {
-		std::cerr << "ERROR: Could not load sound '" << path << "': Invalid file format\n";
+		HAZARD_ERROR("Could not load sound '" << path << "': Invalid file format");
 		return sound;
 	}
 
 	if (std::memcmp(header.riff, "RIFF", 4) || std::memcmp(header.wave, "WAVE", 4) ||
 		std::memcmp(header.fmt_chunk_marker, "fmt ", 4) || std::memcmp(header.data_chunk_marker, "data", 4)) {
-		std::cerr << "ERROR: Could not load sound '" << path << "': Invalid file format\n";
+		HAZARD_ERROR("Could not load sound '" << path << "': Invalid file format");
 		return sound;
 	}
 
@@ -215,14 +218,14 @@ Audio::Sound Audio::LoadWave(const std::string& path) {
 	std::uint32_t sample_rate = read32(&header.sample_rate);
 
 	if (bits_per_sample != 16 || sample_rate != 44100 || channels > 2) {
-		std::cerr << "ERROR: Could not load sound '" << path << "': Unsupported format\n";
+		HAZARD_ERROR("Could not load sound '" << path << "': Unsupported format");
 		return sound;
 	}
 
 	std::uint16_t block_align = read16(&header.block_align);
 
 	if (block_align != channels * sizeof(std::int16_t)) {
-		std::cerr << "ERROR: Could not load sound '" << path << "': Invalid file format\n";
+		HAZARD_ERROR("Could not load sound '" << path << "': Invalid file format");
 		return sound;
 	}
 
@@ -235,7 +238,7 @@ Audio::Sound Audio::LoadWave(const std::string& path) {
 
 	file.read((char*)sound.samples, samples * sizeof(std::int16_t));
 	if (file.fail()) {
-		std::cerr << "ERROR: Could not load sound '" << path << "': Invalid file format\n";
+		HAZARD_ERROR("Could not load sound '" << path << "': Invalid file format");
 		delete[] sound.samples;
 		sound.samples = nullptr;
 		return sound;
@@ -11,8 +11,6 @@
 
 #include "Common.h"
 
-#define HAZARD_AUDIO_CHANNELS 32
-
 namespace Hazard {
 	class Audio {
 	public:
@@ -37,13 +35,16 @@ namespace Hazard {
 
 		void Run(const AudioCommand& command);
 
+		// Mixes all playing channels into 'framesPerBuffer' interleaved stereo
+		// frames. The caller must hold the lock of the channels.
+		static void Mix(Channel* channels, std::int16_t* out, unsigned long framesPerBuffer);
+		static Sound LoadWave(const std::string& path);
+
 	private:
 		std::vector<Sound> loadedSounds;
 		Channel channels[HAZARD_AUDIO_CHANNELS];
 
 		PaStream* stream;
-
-		static Sound LoadWave(const std::string& path);
 	};
 }
 
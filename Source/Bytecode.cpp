@@ -0,0 +1,258 @@
+// Copyright 2022 Justus Zorn
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include "Bytecode.h"
+#include "Log.h"
+
+using namespace Hazard;
+
+namespace fs = std::filesystem;
+
+// Cache files start with this header, followed by the path of the source file
+// and the bytecode
+struct CacheHeader {
+	char magic[4];
+	std::uint32_t pathLength;
+	std::uint64_t modificationTime;
+	std::uint64_t hash;
+};
+
+static const char CacheMagic[4] = { 'H', 'Z', 'B', '1' };
+
+static std::uint64_t Hash(const char* data, std::size_t length) {
+	// FNV-1a
+	std::uint64_t hash = 0xCBF29CE484222325ull;
+	for (std::size_t i = 0; i < length; ++i) {
+		hash ^= static_cast<std::uint8_t>(data[i]);
+		hash *= 0x100000001B3ull;
+	}
+	return hash;
+}
+
+static bool ReadFile(const fs::path& path, std::string& content) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		return false;
+	}
+	std::ostringstream stream;
+	stream << file.rdbuf();
+	content = stream.str();
+	return true;
+}
+
+static fs::path GetCachePath(const std::string& name) {
+	std::ostringstream fileName;
+	fileName << std::hex << Hash(name.data(), name.length()) << ".luac";
+	return fs::path(HAZARD_BYTECODE_CACHE) / fileName.str();
+}
+
+static void WriteCache(const std::string& name, std::uint64_t modificationTime, std::uint64_t hash, const char* bytecode, std::size_t length) {
+	std::error_code error;
+	fs::create_directories(HAZARD_BYTECODE_CACHE, error);
+
+	CacheHeader header;
+	std::memcpy(header.magic, CacheMagic, sizeof(header.magic));
+	header.pathLength = static_cast<std::uint32_t>(name.length());
+	header.modificationTime = modificationTime;
+	header.hash = hash;
+
+	// Rooms may compile the same file at the same time, so the file is written
+	// under a temporary name and replaces the old one at once
+	fs::path cachePath = GetCachePath(name);
+	std::ostringstream tempName;
+	tempName << cachePath.string() << '.' << std::this_thread::get_id() << ".tmp";
+	{
+		std::ofstream file(tempName.str(), std::ios::binary);
+		if (!file) {
+			HAZARD_ERROR("Could not write bytecode cache '" << tempName.str() << "'");
+			return;
+		}
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(name.data(), name.length());
+		file.write(bytecode, length);
+	}
+	fs::rename(tempName.str(), cachePath, error);
+	if (error) {
+		HAZARD_ERROR("Could not write bytecode cache '" << cachePath.string() << "': " << error.message());
+		fs::remove(tempName.str(), error);
+	}
+}
+
+static int WriteBytecode(lua_State*, const void* data, std::size_t length, void* ud) {
+	static_cast<std::string*>(ud)->append(static_cast<const char*>(data), length);
+	return 0;
+}
+
+int Hazard::LoadCachedFile(lua_State* L, const std::string& path) {
+	std::string name = fs::path(path).lexically_normal().generic_string();
+	std::string chunkName = "@" + path;
+
+	std::error_code error;
+	bool hasSource = fs::exists(path, error);
+	std::uint64_t modificationTime = 0;
+	if (hasSource) {
+		modificationTime = static_cast<std::uint64_t>(fs::last_write_time(path, error).time_since_epoch().count());
+	}
+
+	std::string cache;
+	const CacheHeader* header = nullptr;
+	const char* bytecode = nullptr;
+	std::size_t bytecodeLength = 0;
+	if (ReadFile(GetCachePath(name), cache) && cache.length() >= sizeof(CacheHeader)) {
+		header = reinterpret_cast<const CacheHeader*>(cache.data());
+		std::size_t offset = sizeof(CacheHeader) + header->pathLength;
+		if (std::memcmp(header->magic, CacheMagic, sizeof(header->magic)) == 0 && offset <= cache.length() && cache.compare(sizeof(CacheHeader), header->pathLength, name) == 0) {
+			bytecode = cache.data() + offset;
+			bytecodeLength = cache.length() - offset;
+		}
+	}
+
+	if (bytecode && (!hasSource || header->modificationTime == modificationTime)) {
+		if (luaL_loadbufferx(L, bytecode, bytecodeLength, chunkName.c_str(), "b") == LUA_OK) {
+			return LUA_OK;
+		}
+		// The bytecode was written by a different version of Lua
+		lua_pop(L, 1);
+	}
+
+	std::string source;
+	if (!hasSource || !ReadFile(path, source)) {
+		lua_pushfstring(L, "cannot open %s", path.c_str());
+		return LUA_ERRFILE;
+	}
+	std::uint64_t hash = Hash(source.data(), source.length());
+
+	if (bytecode && header->hash == hash) {
+		// Only the modification time changed
+		if (luaL_loadbufferx(L, bytecode, bytecodeLength, chunkName.c_str(), "b") == LUA_OK) {
+			WriteCache(name, modificationTime, hash, bytecode, bytecodeLength);
+			return LUA_OK;
+		}
+		lua_pop(L, 1);
+	}
+
+	// Like luaL_loadfile, skip a byte order mark and comment out a first line
+	// starting with '#', which keeps the line numbers intact
+	std::size_t start = 0;
+	if (source.compare(0, 3, "\xEF\xBB\xBF") == 0) {
+		start = 3;
+	}
+	if (source.compare(start, 1, "#") == 0) {
+		source.replace(start, 1, "--");
+	}
+
+	int status = luaL_loadbufferx(L, source.data() + start, source.length() - start, chunkName.c_str(), nullptr);
+	if (status != LUA_OK) {
+		return status;
+	}
+
+	std::string dump;
+	if (lua_dump(L, WriteBytecode, &dump, 0) == 0) {
+		WriteCache(name, modificationTime, hash, dump.data(), dump.length());
+	}
+	return LUA_OK;
+}
+
+static int SearchCached(lua_State* L) {
+	const char* name = luaL_checkstring(L, 1);
+	lua_getglobal(L, "package");
+	lua_getfield(L, -1, "path");
+	const char* path = lua_tostring(L, -1);
+	if (!path) {
+		return luaL_error(L, "'package.path' must be a string");
+	}
+
+	// Same search as package.searchpath, but files that only exist in the
+	// cache are found as well
+	std::string module = luaL_gsub(L, name, ".", LUA_DIRSEP);
+	std::string notFound;
+	std::string templates = path;
+	std::size_t start = 0;
+	while (start <= templates.length()) {
+		std::size_t end = templates.find(LUA_PATH_SEP, start);
+		if (end == std::string::npos) {
+			end = templates.length();
+		}
+		std::string fileName = templates.substr(start, end - start);
+		start = end + 1;
+		if (fileName.empty()) {
+			continue;
+		}
+
+		std::size_t mark;
+		while ((mark = fileName.find(LUA_PATH_MARK)) != std::string::npos) {
+			fileName.replace(mark, 1, module);
+		}
+
+		std::error_code error;
+		std::string cacheName = fs::path(fileName).lexically_normal().generic_string();
+		if (fs::exists(fileName, error) || fs::exists(GetCachePath(cacheName), error)) {
+			if (LoadCachedFile(L, fileName) != LUA_OK) {
+				return luaL_error(L, "error loading module '%s' from file '%s':\n\t%s", name, fileName.c_str(), lua_tostring(L, -1));
+			}
+			lua_pushstring(L, fileName.c_str());
+			return 2;
+		}
+		if (!notFound.empty()) {
+			notFound += "\n\t";
+		}
+		notFound += "no file '" + fileName + "'";
+	}
+
+	lua_pushstring(L, notFound.c_str());
+	return 1;
+}
+
+void Hazard::AddCachedSearcher(lua_State* L) {
+	lua_getglobal(L, "package");
+	if (!lua_istable(L, -1)) {
+		lua_pop(L, 1);
+		return;
+	}
+	lua_getfield(L, -1, "searchers");
+	if (!lua_istable(L, -1)) {
+		lua_pop(L, 2);
+		return;
+	}
+
+	// The searcher replaces the searcher for Lua files, which is the second one
+	lua_pushcfunction(L, SearchCached);
+	lua_rawseti(L, -2, 2);
+	lua_pop(L, 2);
+}
+
+int Hazard::Precompile() {
+	int failed = 0;
+	int compiled = 0;
+
+	std::error_code error;
+	for (fs::recursive_directory_iterator it(".", error), end; it != end; it.increment(error)) {
+		if (it->path().filename() == HAZARD_BYTECODE_CACHE) {
+			it.disable_recursion_pending();
+			continue;
+		}
+		if (!it->is_regular_file(error) || it->path().extension() != ".lua") {
+			continue;
+		}
+
+		std::string path = it->path().lexically_normal().generic_string();
+		lua_State* L = luaL_newstate();
+		if (LoadCachedFile(L, path) != LUA_OK) {
+			HAZARD_ERROR("Could not compile '" << path << "': " << lua_tostring(L, -1));
+			++failed;
+		}
+		else {
+			++compiled;
+		}
+		lua_close(L);
+	}
+
+	HAZARD_INFO("Compiled " << compiled << " Lua files into '" << HAZARD_BYTECODE_CACHE << "'");
+	return failed;
+}
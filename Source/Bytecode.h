@@ -0,0 +1,27 @@
+// Copyright 2022 Justus Zorn
+
+#ifndef Hazard_Bytecode_h
+#define Hazard_Bytecode_h
+
+#include <string>
+
+#include <lua.hpp>
+
+// Compiled Lua files are stored in this directory inside the project directory
+#define HAZARD_BYTECODE_CACHE ".hazard-cache"
+
+namespace Hazard {
+	// Works like luaL_loadfile, but keeps the bytecode of the file in the cache
+	// and loads it from there as long as the file did not change. If the file
+	// does not exist, the cached bytecode is used on its own.
+	int LoadCachedFile(lua_State* L, const std::string& path);
+
+	// Adds a searcher to package.searchers that loads modules with LoadCachedFile
+	void AddCachedSearcher(lua_State* L);
+
+	// Compiles every Lua file in the current directory into the cache and
+	// returns the number of files that could not be compiled
+	int Precompile();
+}
+
+#endif
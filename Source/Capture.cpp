@@ -0,0 +1,157 @@
+// Copyright 2022 Justus Zorn
+
+#include <algorithm>
+
+#include "Capture.h"
+#include "Clock.h"
+#include "Log.h"
+
+using namespace Hazard;
+
+static const char magic[4] = { 'H', 'Z', 'W', 'C' };
+static constexpr std::uint64_t Version = 1;
+
+static Capture capture;
+
+bool Capture::Open(const std::string& path) {
+	std::lock_guard<std::mutex> lock(mutex);
+	file.open(path, std::ios::binary);
+	if (!file) {
+		HAZARD_ERROR("Could not create capture " << path);
+		return false;
+	}
+	record.assign(magic, sizeof(magic));
+	WriteVarint(Version);
+	file.write(record.data(), record.size());
+	record.clear();
+	lastTime = 0;
+	lastFlush = GetTicks();
+	open = true;
+	return true;
+}
+
+void Capture::Close() {
+	std::lock_guard<std::mutex> lock(mutex);
+	open = false;
+	if (file.is_open()) {
+		file.close();
+	}
+}
+
+bool Capture::IsOpen() const {
+	return open;
+}
+
+void Capture::Write(CaptureDirection direction, std::uint32_t stream, std::uint8_t channel, const ENetPacket* packet) {
+	if (!open) {
+		return;
+	}
+	std::uint64_t time = GetMicroseconds();
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!open) {
+		return;
+	}
+	// Packets of different threads can arrive slightly out of order
+	time = std::max(time, lastTime);
+	WriteVarint(time - lastTime);
+	lastTime = time;
+	record.push_back(static_cast<char>(static_cast<std::uint8_t>(direction) << 7 | channel));
+	WriteVarint(stream);
+	WriteVarint(packet->dataLength);
+	file.write(record.data(), record.size());
+	file.write(reinterpret_cast<const char*>(packet->data), packet->dataLength);
+	record.clear();
+
+	// Clients and servers are usually stopped in a way that loses everything
+	// that was not flushed
+	if (time / 1000 - lastFlush >= 1000) {
+		file.flush();
+		lastFlush = time / 1000;
+	}
+}
+
+void Capture::WriteVarint(std::uint64_t value) {
+	while (value >= 0x80) {
+		record.push_back(static_cast<char>((value & 0x7F) | 0x80));
+		value >>= 7;
+	}
+	record.push_back(static_cast<char>(value));
+}
+
+Capture& Hazard::GetCapture() {
+	return capture;
+}
+
+bool CaptureReader::Open(const std::string& path) {
+	file.open(path, std::ios::binary);
+	if (!file) {
+		HAZARD_ERROR("Could not open capture " << path);
+		return false;
+	}
+	// Lengths in the capture are checked against its size before anything is
+	// allocated for them
+	file.seekg(0, std::ios::end);
+	size = static_cast<std::uint64_t>(file.tellg());
+	file.seekg(0, std::ios::beg);
+	char header[sizeof(magic)];
+	if (!file.read(header, sizeof(header)) || !std::equal(magic, magic + sizeof(magic), header)) {
+		HAZARD_ERROR(path << " is not a capture");
+		return false;
+	}
+	std::uint64_t version;
+	if (!ReadVarint(version) || version != Version) {
+		HAZARD_ERROR("Capture " << path << " has an unsupported version");
+		return false;
+	}
+	return true;
+}
+
+bool CaptureReader::Read(CapturedPacket& packet) {
+	std::uint64_t delta, stream, length;
+	if (!ReadVarint(delta)) {
+		return false;
+	}
+	char flags;
+	if (!file.get(flags) || !ReadVarint(stream) || !ReadVarint(length)) {
+		HAZARD_ERROR("Capture is truncated");
+		return false;
+	}
+	if (stream > UINT32_MAX) {
+		HAZARD_ERROR("Capture is corrupt: invalid stream " << stream);
+		return false;
+	}
+	std::uint64_t remaining = size - static_cast<std::uint64_t>(file.tellg());
+	if (length > remaining) {
+		// The last packet is cut off if the program was killed while writing it
+		HAZARD_ERROR("Capture is corrupt or truncated: packet of " << length << " bytes, but only " << remaining << " bytes are left");
+		return false;
+	}
+	time += delta;
+	packet.time = time;
+	packet.direction = static_cast<CaptureDirection>(static_cast<std::uint8_t>(flags) >> 7);
+	packet.channel = flags & 0x7F;
+	packet.stream = static_cast<std::uint32_t>(stream);
+	packet.data.resize(length);
+	if (length > 0 && !file.read(reinterpret_cast<char*>(packet.data.data()), length)) {
+		HAZARD_ERROR("Could not read capture");
+		return false;
+	}
+	return true;
+}
+
+bool CaptureReader::ReadVarint(std::uint64_t& value) {
+	value = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		char byte;
+		if (!file.get(byte)) {
+			return false;
+		}
+		value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) {
+			return true;
+		}
+	}
+	// More than 64 bits
+	return false;
+}
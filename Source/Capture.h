@@ -0,0 +1,87 @@
+// Copyright 2022 Justus Zorn
+
+#ifndef Hazard_Capture_h
+#define Hazard_Capture_h
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <enet.h>
+
+namespace Hazard {
+	// Captures contain the payload of every packet on the channels of Hazard
+	// that was sent or received by a client or a server, for offline analysis
+	// with HazardWireDump. ENet headers, acknowledgements and packets of
+	// integrated mode are not included.
+	//
+	// A capture starts with a header, followed by one record per packet.
+	// Integers are variable-length encoded, times are in microseconds since
+	// the start of the program. Packets are grouped into streams by the connect
+	// ID of their peer.
+
+	enum class CaptureDirection : std::uint8_t {
+		Sent = 0,
+		Received = 1
+	};
+
+	struct CapturedPacket {
+		std::uint64_t time;
+		CaptureDirection direction;
+		std::uint8_t channel;
+		std::uint32_t stream;
+		std::vector<std::uint8_t> data;
+	};
+
+	class Capture {
+	public:
+		Capture() = default;
+		Capture(const Capture&) = delete;
+
+		Capture& operator=(const Capture&) = delete;
+
+		bool Open(const std::string& path);
+		void Close();
+		bool IsOpen() const;
+
+		// Can be called from any thread
+		void Write(CaptureDirection direction, std::uint32_t stream, std::uint8_t channel, const ENetPacket* packet);
+
+	private:
+		std::mutex mutex;
+		std::ofstream file;
+		std::atomic<bool> open = false;
+		std::string record;
+		std::uint64_t lastTime = 0;
+		std::uint64_t lastFlush = 0;
+
+		void WriteVarint(std::uint64_t value);
+	};
+
+	Capture& GetCapture();
+
+	class CaptureReader {
+	public:
+		CaptureReader() = default;
+		CaptureReader(const CaptureReader&) = delete;
+
+		CaptureReader& operator=(const CaptureReader&) = delete;
+
+		bool Open(const std::string& path);
+
+		// Returns false at the end of the capture, or if it is corrupt
+		bool Read(CapturedPacket& packet);
+
+	private:
+		std::ifstream file;
+		std::uint64_t size = 0;
+		std::uint64_t time = 0;
+
+		bool ReadVarint(std::uint64_t& value);
+	};
+}
+
+#endif
@@ -1,13 +1,16 @@
 // Copyright 2022 Justus Zorn
 
-#include <iostream>
-
+#include "Allocations.h"
+#include "Capture.h"
 #include "Client.h"
+#include "Clock.h"
+#include "Log.h"
 #include "Net.h"
+#include "Trace.h"
 
 using namespace Hazard;
 
-Client::Client(const std::string& playerName, const std::string& address, std::uint16_t defaultPort) {
+Client::Client(const std::string& playerName, const std::string& address, std::uint16_t defaultPort, std::uint32_t room) {
 	std::string hostname;
 	std::uint16_t port;
 	if (address.find(':') < address.size()) {
@@ -21,20 +24,20 @@ Client::Client(const std::string& playerName, const std::string& address, std::u
 
 	host = enet_host_create(nullptr, 1, 4, 0, 0);
 	if (!host) {
-		std::cerr << "ERROR: Could not create ENet host\n";
+		HAZARD_ERROR("Could not create ENet host");
 		return;
 	}
 
 	ENetAddress serverAddress = { 0 };
 	serverAddress.port = port;
 	if (enet_address_set_host(&serverAddress, hostname.c_str()) < 0) {
-		std::cerr << "ERROR: Could not resolve " << hostname << '\n';
+		HAZARD_ERROR("Could not resolve " << hostname);
 		return;
 	}
 
 	server = enet_host_connect(host, &serverAddress, 4, 0);
 	if (!server) {
-		std::cerr << "ERROR: Could not connect to " << address << '\n';
+		HAZARD_ERROR("Could not connect to " << address);
 		return;
 	}
 
@@ -42,61 +45,84 @@ Client::Client(const std::string& playerName, const std::string& address, std::u
 	if (enet_host_service(host, &event, 3000) > 0 && event.type == ENET_EVENT_TYPE_CONNECT) {
 		WritePacket packet;
 		packet.WriteString(playerName);
+		packet.Write32(room);
 
-		enet_peer_send(server, 0, packet.GetPacket(true));
+		ENetPacket* loginPacket = packet.GetPacket(true);
+		GetCapture().Write(CaptureDirection::Sent, server->connectID, 0, loginPacket);
+		enet_peer_send(server, 0, loginPacket);
+		connected = true;
 	}
 	else {
-		std::cerr << "ERROR: Could not connect to " << address << '\n';
+		HAZARD_ERROR("Could not connect to " << address);
 	}
 }
 
+Client::Client(LocalLink& link) : link{ &link }, connected{ true } {}
+
 Client::~Client() {
-	enet_peer_disconnect_now(server, 0);
-	enet_host_destroy(host);
+	if (link) {
+		link->connected = false;
+		return;
+	}
+	if (server) {
+		enet_peer_disconnect_now(server, 0);
+	}
+	if (host) {
+		enet_host_destroy(host);
+	}
 }
 
 bool Client::Update(const Input& input) {
-	ENetEvent event;
+	TraceScope trace("Client::Update");
+	SubsystemScope subsystem(Subsystem::Client);
 	audioCommands.clear();
+	if (link) {
+		if (link->kicked) {
+			return false;
+		}
+
+		if (link->sprites.Update()) {
+			++stats.snapshots;
+			stats.lastSnapshot = GetTicks();
+		}
+		if (link->audioCommands.Update()) {
+			audioCommands.swap(link->audioCommands.Front());
+		}
+
+		// Inputs must not get lost, so they are only published once the server
+		// took the previous ones
+		link->input.Back().Append(input);
+		if (link->input.TryPublish()) {
+			link->input.Back().Clear();
+		}
+		return true;
+	}
+	if (!connected) {
+		return false;
+	}
+
+	ENetEvent event;
 	while (enet_host_service(host, &event, 0) > 0) {
 		switch (event.type) {
 		case ENET_EVENT_TYPE_DISCONNECT:
 		case ENET_EVENT_TYPE_DISCONNECT_TIMEOUT:
 			return false;
 		case ENET_EVENT_TYPE_RECEIVE:
+			stats.receivedBytes += event.packet->dataLength;
+			GetCapture().Write(CaptureDirection::Received, server->connectID, event.channelID, event.packet);
 			if (event.channelID == 1) {
+				++stats.snapshots;
+				stats.lastSnapshot = GetTicks();
 				ReadPacket packet(event.packet);
-				std::uint32_t spriteCount = packet.Read32();
-				sprites.resize(spriteCount);
-				for (std::uint32_t i = 0; i < spriteCount; ++i) {
-					Sprite& sprite = sprites[i];
-
-					sprite.x = packet.Read32();
-					sprite.y = packet.Read32();
-					sprite.scale = packet.Read32();
-
-					if (packet.Read8()) {
-						// Text
-						sprite.isText = true;
-						sprite.r = packet.Read8();
-						sprite.g = packet.Read8();
-						sprite.b = packet.Read8();
-						sprite.text = packet.ReadString();
-					}
-					else {
-						// Sprite
-						sprite.isText = false;
-						sprite.texture = packet.Read32();
-						sprite.animation = packet.Read32();
-					}
-				}
+				ReadSnapshot(packet, sprites);
 			}
 			else if (event.channelID == 3) {
 				ReadPacket packet(event.packet);
 				std::uint32_t audioCommandCount = packet.Read32();
-				audioCommands.resize(audioCommandCount);
+				std::size_t start = audioCommands.size();
+				audioCommands.resize(start + audioCommandCount);
 				for (std::uint32_t i = 0; i < audioCommandCount; ++i) {
-					AudioCommand& audioCommand = audioCommands[i];
+					AudioCommand& audioCommand = audioCommands[start + i];
 
 					audioCommand.type = static_cast<AudioCommand::Type>(packet.Read8());
 					audioCommand.volume = packet.Read8();
@@ -125,12 +151,32 @@ bool Client::Update(const Input& input) {
 	inputPacket.Write8(input.mouseMotion);
 	inputPacket.WriteString(input.textInput);
 
-	enet_peer_send(server, 2, inputPacket.GetPacket(true));
+	ENetPacket* packet = inputPacket.GetPacket(true);
+	stats.sentBytes += packet->dataLength;
+	GetCapture().Write(CaptureDirection::Sent, server->connectID, 2, packet);
+	enet_peer_send(server, 2, packet);
 
 	return true;
 }
 
-const std::vector<Sprite>& Client::GetSprites() const {
+bool Client::IsConnected() const {
+	return connected;
+}
+
+ClientStats Client::GetStats() const {
+	ClientStats result = stats;
+	if (server) {
+		PeerStats peerStats = GetPeerStats(server);
+		result.roundTripTime = peerStats.roundTripTime;
+		result.packetLoss = peerStats.packetLoss;
+	}
+	return result;
+}
+
+const SpriteBuffer& Client::GetSprites() const {
+	if (link) {
+		return link->sprites.Front();
+	}
 	return sprites;
 }
 
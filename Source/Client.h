@@ -10,26 +10,47 @@
 #include <enet.h>
 
 #include "Common.h"
+#include "LocalLink.h"
 
 namespace Hazard {
+	struct ClientStats {
+		std::uint64_t snapshots = 0;
+		std::uint64_t receivedBytes = 0;
+		std::uint64_t sentBytes = 0;
+		// In milliseconds since the start of the program, 0 if there was no
+		// snapshot yet
+		std::uint64_t lastSnapshot = 0;
+		// As estimated by ENet, 0 in integrated mode
+		std::uint32_t roundTripTime = 0;
+		std::uint32_t packetLoss = 0;
+	};
+
 	class Client {
 	public:
-		Client(const std::string& playerName, const std::string& address, std::uint16_t defaultPort);
+		Client(const std::string& playerName, const std::string& address, std::uint16_t defaultPort, std::uint32_t room = 0);
+		Client(LocalLink& link);
 		Client(const Client&) = delete;
 		~Client();
 
 		Client& operator=(const Client&) = delete;
 
 		bool Update(const Input& input);
+		bool IsConnected() const;
+
+		// Counts everything since the client was created
+		ClientStats GetStats() const;
 
-		const std::vector<Sprite>& GetSprites() const;
+		const SpriteBuffer& GetSprites() const;
 		const std::vector<AudioCommand>& GetAudioCommands() const;
 
 	private:
 		ENetHost* host = nullptr;
 		ENetPeer* server = nullptr;
+		LocalLink* link = nullptr;
+		bool connected = false;
+		ClientStats stats;
 
-		std::vector<Sprite> sprites;
+		SpriteBuffer sprites;
 		std::vector<AudioCommand> audioCommands;
 	};
 }
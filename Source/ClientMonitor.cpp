@@ -0,0 +1,158 @@
+// Copyright 2022 Justus Zorn
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "ClientMonitor.h"
+#include "Log.h"
+
+using namespace Hazard;
+
+ClientMonitor::ClientMonitor() {
+	lines.push_back("Collecting statistics...");
+}
+
+bool ClientMonitor::OpenLog(const std::string& path) {
+	log.open(path);
+	if (!log) {
+		HAZARD_ERROR("Could not create " << path);
+		return false;
+	}
+	log << "time_s,frames,frame_ms_p50,frame_ms_p99,frame_ms_max,present_ms,text_ms,sprites,sprites_max,text_sprites,"
+		"draw_calls,texture_switches,snapshots_per_s,snapshot_age_ms,snapshot_age_ms_max,received_kib_per_s,rtt_ms,loss_percent";
+	for (std::size_t i = 0; i < Subsystems; ++i) {
+		const char* name = GetSubsystemName(static_cast<Subsystem>(i));
+		log << ',' << name << "_allocations," << name << "_allocated_bytes";
+	}
+	log << '\n';
+	return true;
+}
+
+bool ClientMonitor::AddFrame(const FrameStats& frame, const ClientStats& client, std::uint64_t now) {
+	if (start == 0) {
+		start = now;
+		secondStart = now;
+		lastClient = client;
+		lastAllocations = GetThreadAllocations();
+	}
+
+	// The first frame has no previous frame
+	if (frame.frameTime > 0) {
+		frameTimes.push_back(frame.frameTime);
+	}
+	totals.sprites += frame.sprites;
+	totals.textSprites += frame.textSprites;
+	totals.drawCalls += frame.drawCalls;
+	totals.textureSwitches += frame.textureSwitches;
+	totals.textTime += frame.textTime;
+	totals.presentTime += frame.presentTime;
+	maxSprites = std::max(maxSprites, frame.sprites + frame.textSprites);
+	if (client.lastSnapshot > 0) {
+		std::uint64_t age = now - client.lastSnapshot;
+		snapshotAges += age;
+		maxSnapshotAge = std::max(maxSnapshotAge, age);
+		++snapshotAgeFrames;
+	}
+
+	if (now - secondStart < 1000) {
+		return false;
+	}
+	Summarize(client, now);
+
+	secondStart = now;
+	frameTimes.clear();
+	totals = FrameStats();
+	maxSprites = 0;
+	snapshotAges = 0;
+	maxSnapshotAge = 0;
+	snapshotAgeFrames = 0;
+	lastClient = client;
+	lastAllocations = GetThreadAllocations();
+	return true;
+}
+
+const std::vector<std::string>& ClientMonitor::GetLines() const {
+	return lines;
+}
+
+void ClientMonitor::Summarize(const ClientStats& client, std::uint64_t now) {
+	double seconds = (now - secondStart) / 1000.0;
+	std::sort(frameTimes.begin(), frameTimes.end());
+	auto percentile = [this](double fraction) {
+		if (frameTimes.empty()) {
+			return 0.0;
+		}
+		std::size_t index = std::min(frameTimes.size() - 1, static_cast<std::size_t>(fraction * frameTimes.size()));
+		return frameTimes[index] / 1000.0;
+	};
+
+	double frames = std::max<double>(1.0, static_cast<double>(frameTimes.size()));
+	double p50 = percentile(0.5), p99 = percentile(0.99), max = frameTimes.empty() ? 0.0 : frameTimes.back() / 1000.0;
+	double presentTime = totals.presentTime / frames / 1000.0;
+	double textTime = totals.textTime / frames / 1000.0;
+	double sprites = totals.sprites / frames;
+	double textSprites = totals.textSprites / frames;
+	double drawCalls = totals.drawCalls / frames;
+	double textureSwitches = totals.textureSwitches / frames;
+	double snapshotRate = (client.snapshots - lastClient.snapshots) / seconds;
+	double snapshotAge = snapshotAgeFrames > 0 ? static_cast<double>(snapshotAges) / snapshotAgeFrames : 0.0;
+	double received = (client.receivedBytes - lastClient.receivedBytes) / seconds / 1024.0;
+	double loss = 100.0 * client.packetLoss / ENET_PEER_PACKET_LOSS_SCALE;
+
+	// The overlay and the log only show the allocations of every subsystem, not
+	// of every allocator
+	AllocationStats allocationStats = GetThreadAllocations() - lastAllocations;
+	double allocations[Subsystems] = {}, allocatedBytes[Subsystems] = {};
+	for (std::size_t i = 0; i < Subsystems; ++i) {
+		for (std::size_t j = 0; j < Allocators; ++j) {
+			const AllocationCounter& counter = allocationStats.Get(static_cast<Allocator>(j), static_cast<Subsystem>(i));
+			allocations[i] += counter.allocations / frames;
+			allocatedBytes[i] += counter.bytes / frames;
+		}
+	}
+
+	std::ostringstream line;
+	line << std::fixed << std::setprecision(1);
+	lines.clear();
+	line << frameTimes.size() / seconds << " FPS, frame " << p50 << " ms p50, " << p99 << " ms p99, " << max << " ms max";
+	lines.push_back(line.str());
+	line.str("");
+	line << "Present " << presentTime << " ms, text " << textTime << " ms per frame";
+	lines.push_back(line.str());
+	line.str("");
+	line << sprites << " sprites (" << maxSprites << " max), " << textSprites << " texts, "
+		<< drawCalls << " draw calls, " << textureSwitches << " texture switches";
+	lines.push_back(line.str());
+	line.str("");
+	line << snapshotRate << " snapshots/s, age " << snapshotAge << " ms average " << maxSnapshotAge << " ms max";
+	lines.push_back(line.str());
+	line.str("");
+	line << received << " KiB/s received, RTT " << client.roundTripTime << " ms, loss " << loss << '%';
+	lines.push_back(line.str());
+	line.str("");
+	line << "Allocations per frame:";
+	bool allocated = false;
+	for (std::size_t i = 0; i < Subsystems; ++i) {
+		if (allocations[i] > 0.0) {
+			line << (allocated ? ", " : " ") << GetSubsystemName(static_cast<Subsystem>(i)) << ' ' << allocations[i]
+				<< " (" << allocatedBytes[i] / 1024.0 << " KiB)";
+			allocated = true;
+		}
+	}
+	line << (allocated ? "" : " none");
+	lines.push_back(line.str());
+
+	if (log.is_open()) {
+		log << std::fixed << std::setprecision(3)
+			<< (now - start) / 1000.0 << ',' << frameTimes.size() << ',' << p50 << ',' << p99 << ',' << max << ','
+			<< presentTime << ',' << textTime << ',' << sprites << ',' << maxSprites << ',' << textSprites << ','
+			<< drawCalls << ',' << textureSwitches << ',' << snapshotRate << ',' << snapshotAge << ',' << maxSnapshotAge << ','
+			<< received << ',' << client.roundTripTime << ',' << loss;
+		for (std::size_t i = 0; i < Subsystems; ++i) {
+			log << ',' << allocations[i] << ',' << allocatedBytes[i];
+		}
+		log << std::endl;
+	}
+}
@@ -0,0 +1,54 @@
+// Copyright 2022 Justus Zorn
+
+#ifndef Hazard_ClientMonitor_h
+#define Hazard_ClientMonitor_h
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "Allocations.h"
+#include "Client.h"
+#include "Window.h"
+
+namespace Hazard {
+	// Summarizes the frames of the client, its connection and the allocations
+	// of its thread once per second, as lines for the overlay of the Window
+	// and as rows of a CSV file. Must be used on the thread of the client.
+	class ClientMonitor {
+	public:
+		ClientMonitor();
+		ClientMonitor(const ClientMonitor&) = delete;
+
+		ClientMonitor& operator=(const ClientMonitor&) = delete;
+
+		bool OpenLog(const std::string& path);
+
+		// 'now' is the time in milliseconds. Returns true if a second has passed
+		// and the lines were updated.
+		bool AddFrame(const FrameStats& frame, const ClientStats& client, std::uint64_t now);
+
+		const std::vector<std::string>& GetLines() const;
+
+	private:
+		std::ofstream log;
+		std::uint64_t start = 0;
+		std::uint64_t secondStart = 0;
+
+		std::vector<std::uint64_t> frameTimes;
+		FrameStats totals;
+		std::uint32_t maxSprites = 0;
+		std::uint64_t snapshotAges = 0;
+		std::uint64_t maxSnapshotAge = 0;
+		std::uint32_t snapshotAgeFrames = 0;
+		ClientStats lastClient;
+		AllocationStats lastAllocations;
+
+		std::vector<std::string> lines;
+
+		void Summarize(const ClientStats& client, std::uint64_t now);
+	};
+}
+
+#endif
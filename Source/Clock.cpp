@@ -0,0 +1,32 @@
+// Copyright 2022 Justus Zorn
+
+#include <atomic>
+#include <chrono>
+
+#include "Clock.h"
+
+using namespace Hazard;
+
+static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+static std::atomic<bool> frozen = false;
+static std::atomic<std::uint64_t> frozenTime = 0;
+
+std::uint64_t Hazard::GetTicks() {
+	if (frozen.load(std::memory_order_relaxed)) {
+		return frozenTime.load(std::memory_order_relaxed) / 1000;
+	}
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+std::uint64_t Hazard::GetMicroseconds() {
+	if (frozen.load(std::memory_order_relaxed)) {
+		return frozenTime.load(std::memory_order_relaxed);
+	}
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+void Hazard::FreezeClock(std::uint64_t microseconds) {
+	frozenTime.store(microseconds, std::memory_order_relaxed);
+	frozen.store(true, std::memory_order_relaxed);
+}
@@ -0,0 +1,20 @@
+// Copyright 2022 Justus Zorn
+
+#ifndef Hazard_Clock_h
+#define Hazard_Clock_h
+
+#include <cstdint>
+
+namespace Hazard {
+	// Returns the number of milliseconds since the start of the program
+	std::uint64_t GetTicks();
+
+	// Returns the number of microseconds since the start of the program
+	std::uint64_t GetMicroseconds();
+
+	// Stops the clock at 'microseconds' since the start of the program, until
+	// it is frozen at another time. Replays run on the recorded time.
+	void FreezeClock(std::uint64_t microseconds);
+}
+
+#endif
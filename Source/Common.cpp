@@ -1,9 +1,82 @@
 // Copyright 2022 Justus Zorn
 
+#include <cstring>
+
 #include "Common.h"
 
 using namespace Hazard;
 
+void SpriteBuffer::AddSprite(std::int32_t x, std::int32_t y, std::uint32_t scale, std::uint32_t texture, std::uint32_t animation) {
+	Sprite sprite;
+	sprite.isText = false;
+	sprite.x = x;
+	sprite.y = y;
+	sprite.scale = scale;
+	sprite.texture = texture;
+	sprite.animation = animation;
+	sprite.textOffset = 0;
+	sprite.textLength = 0;
+	sprite.r = sprite.g = sprite.b = 0;
+
+	sprites.push_back(sprite);
+}
+
+void SpriteBuffer::AddTextSprite(std::int32_t x, std::int32_t y, std::uint32_t lineLength, std::uint8_t r, std::uint8_t g, std::uint8_t b, const char* text, std::uint32_t length) {
+	Sprite sprite;
+	sprite.isText = true;
+	sprite.x = x;
+	sprite.y = y;
+	sprite.scale = lineLength;
+	sprite.texture = 0;
+	sprite.animation = 0;
+	sprite.textOffset = static_cast<std::uint32_t>(this->text.size());
+	sprite.textLength = length;
+	sprite.r = r;
+	sprite.g = g;
+	sprite.b = b;
+
+	this->text.resize(sprite.textOffset + length + 1);
+	if (length > 0) {
+		std::memcpy(&this->text[sprite.textOffset], text, length);
+	}
+	this->text[sprite.textOffset + length] = '\0';
+
+	sprites.push_back(sprite);
+}
+
+const std::vector<Sprite>& SpriteBuffer::GetSprites() const {
+	return sprites;
+}
+
+const char* SpriteBuffer::GetText(const Sprite& sprite) const {
+	// Without any text in the buffer, there is no terminator to point to
+	if (!sprite.isText || sprite.textLength == 0) {
+		return "";
+	}
+	return &text[sprite.textOffset];
+}
+
+void SpriteBuffer::Clear() {
+	sprites.clear();
+	text.clear();
+}
+
+void SpriteBuffer::Swap(SpriteBuffer& other) {
+	sprites.swap(other.sprites);
+	text.swap(other.text);
+}
+
+void Input::Append(const Input& input) {
+	keyboardInputs.insert(keyboardInputs.end(), input.keyboardInputs.begin(), input.keyboardInputs.end());
+	buttonInputs.insert(buttonInputs.end(), input.buttonInputs.begin(), input.buttonInputs.end());
+	if (input.mouseMotion) {
+		mouseMotionX = input.mouseMotionX;
+		mouseMotionY = input.mouseMotionY;
+		mouseMotion = true;
+	}
+	textInput += input.textInput;
+}
+
 void Input::Clear() {
 	keyboardInputs.clear();
 	buttonInputs.clear();
@@ -7,16 +7,38 @@
 #include <string>
 #include <vector>
 
+#define HAZARD_AUDIO_CHANNELS 32
+
 namespace Hazard {
 	struct Sprite {
-		std::string text;
 		std::int32_t x, y;
 		std::uint32_t scale;
 		std::uint32_t texture, animation;
+		// Position of the text in the SpriteBuffer that contains the sprite
+		std::uint32_t textOffset, textLength;
 		bool isText;
 		std::uint8_t r, g, b;
 	};
 
+	// Stores the sprites of a frame in one array and their texts in a second
+	// one, so that clearing and refilling it does not allocate memory
+	class SpriteBuffer {
+	public:
+		void AddSprite(std::int32_t x, std::int32_t y, std::uint32_t scale, std::uint32_t texture, std::uint32_t animation);
+		void AddTextSprite(std::int32_t x, std::int32_t y, std::uint32_t lineLength, std::uint8_t r, std::uint8_t g, std::uint8_t b, const char* text, std::uint32_t length);
+
+		const std::vector<Sprite>& GetSprites() const;
+		// Texts are null-terminated. Returns an empty string for sprites without text.
+		const char* GetText(const Sprite& sprite) const;
+
+		void Clear();
+		void Swap(SpriteBuffer& other);
+
+	private:
+		std::vector<Sprite> sprites;
+		std::vector<char> text;
+	};
+
 	struct AudioCommand {
 		enum class Type {
 			Play,
@@ -46,6 +68,7 @@ namespace Hazard {
 		bool mouseMotion = false;
 		std::string textInput;
 
+		void Append(const Input& input);
 		void Clear();
 	};
 }
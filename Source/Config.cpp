@@ -1,19 +1,22 @@
 // Copyright 2022 Justus Zorn
 
-#include <iostream>
+#include <thread>
 
+#include "Bytecode.h"
 #include "Config.h"
+#include "Log.h"
 
 using namespace Hazard;
 
 Config::Config(std::string config) : path{ config } {
-	L = luaL_newstate();
+	L = allocator.NewState();
 	if (!L) {
-		std::cerr << "ERROR: Could not initialize Lua\n";
+		HAZARD_ERROR("Could not initialize Lua");
 		return;
 	}
 
 	luaL_openlibs(L);
+	AddCachedSearcher(L);
 
 	Reload();
 }
@@ -24,24 +27,51 @@ Config::~Config() {
 
 void Config::Reload() {
 	textures.clear();
+	plugins.clear();
 	windowTitle = "";
 	windowWidth = 800;
 	windowHeight = 800;
 	fontSize = 24;
 	port = 34344;
 	maxPlayers = 32;
+	lowLatency = false;
+	tickRate = 60;
+	snapshotRate = 60;
+	minSnapshotRate = 10;
+	adaptiveSnapshots = true;
+	idleTimeout = 60;
+	rooms = 1;
+	statsInterval = 0;
+	scriptMemoryLimit = 0;
+	generationalGC = false;
+	gcPause = 0;
+	gcStepMultiplier = 0;
+	gcStepSize = 0;
+	gcMinorMultiplier = 0;
+	gcMajorMultiplier = 0;
+	gcIdleBudget = 1000;
+	jobWorkers = 1;
+	profilerInstructions = 1000;
+	profilerInterval = 1000;
+	tickBudget = 0;
+	tickLimit = 0;
+	metricsPort = 0;
+	record = false;
+	capture = false;
+	clientStatsLog = false;
+	logLevel = LogLevel::Info;
 
 	lua_newtable(L);
 	lua_setglobal(L, "Config");
 
-	if (luaL_dofile(L, path.c_str()) != LUA_OK) {
-		std::cerr << "ERROR: Error while loading Lua config: " << lua_tostring(L, -1) << '\n';
+	if (LoadCachedFile(L, path) != LUA_OK || lua_pcall(L, 0, LUA_MULTRET, 0) != LUA_OK) {
+		HAZARD_ERROR("Error while loading Lua config: " << lua_tostring(L, -1));
 		return;
 	}
 
 	lua_getglobal(L, "Config");
 	if (lua_isnil(L, -1)) {
-		std::cerr << "ERROR: 'Config' is nil\n";
+		HAZARD_ERROR("'Config' is nil");
 		lua_settop(L, 0);
 		return;
 	}
@@ -58,7 +88,7 @@ void Config::Reload() {
 			}
 		}
 		else {
-			std::cerr << "ERROR: Config.textures is not an array\n";
+			HAZARD_ERROR("Config.textures is not an array");
 		}
 	}
 
@@ -75,7 +105,26 @@ void Config::Reload() {
 			}
 		}
 		else {
-			std::cout << "ERROR: Config.sounds is not an array\n";
+			HAZARD_ERROR("Config.sounds is not an array");
+		}
+	}
+
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "plugins");
+	if (!lua_isnil(L, -1)) {
+		if (lua_istable(L, -1)) {
+			// Plugins are loaded and called in the order of the array
+			lua_Integer count = static_cast<lua_Integer>(lua_rawlen(L, -1));
+			for (lua_Integer i = 1; i <= count; ++i) {
+				lua_rawgeti(L, -1, i);
+				if (lua_isstring(L, -1)) {
+					plugins.push_back(lua_tostring(L, -1));
+				}
+				lua_pop(L, 1);
+			}
+		}
+		else {
+			HAZARD_ERROR("Config.plugins is not an array");
 		}
 	}
 
@@ -86,7 +135,7 @@ void Config::Reload() {
 			windowTitle = lua_tostring(L, -1);
 		}
 		else {
-			std::cerr << "ERROR: Config.title is not a string\n";
+			HAZARD_ERROR("Config.title is not a string");
 		}
 	}
 
@@ -99,11 +148,11 @@ void Config::Reload() {
 				windowWidth = static_cast<std::uint32_t>(i);
 			}
 			else {
-				std::cerr << "ERROR: Config.width must be greater than 0\n";
+				HAZARD_ERROR("Config.width must be greater than 0");
 			}
 		}
 		else {
-			std::cerr << "ERROR: Config.width is not an integer\n";
+			HAZARD_ERROR("Config.width is not an integer");
 		}
 	}
 
@@ -116,11 +165,11 @@ void Config::Reload() {
 				windowHeight = static_cast<std::uint32_t>(i);
 			}
 			else {
-				std::cerr << "ERROR: Config.height must be greater than 0\n";
+				HAZARD_ERROR("Config.height must be greater than 0");
 			}
 		}
 		else {
-			std::cerr << "ERROR: Config.height is not an integer\n";
+			HAZARD_ERROR("Config.height is not an integer");
 		}
 	}
 
@@ -133,11 +182,11 @@ void Config::Reload() {
 				fontSize = static_cast<std::uint32_t>(i);
 			}
 			else {
-				std::cerr << "ERROR: Config.font_size must be greater than 0\n";
+				HAZARD_ERROR("Config.font_size must be greater than 0");
 			}
 		}
 		else {
-			std::cerr << "ERROR: Config.font_size is not an integer\n";
+			HAZARD_ERROR("Config.font_size is not an integer");
 		}
 	}
 
@@ -150,11 +199,11 @@ void Config::Reload() {
 				port = static_cast<std::uint16_t>(i);
 			}
 			else {
-				std::cerr << "ERROR: Config.port must be between 1 and 65535\n";
+				HAZARD_ERROR("Config.port must be between 1 and 65535");
 			}
 		}
 		else {
-			std::cerr << "ERROR: Config.port is not an integer\n";
+			HAZARD_ERROR("Config.port is not an integer");
 		}
 	}
 
@@ -168,15 +217,448 @@ void Config::Reload() {
 				maxPlayers = static_cast<std::uint32_t>(i);
 			}
 			else {
-				std::cerr << "ERROR: Config.max_players must be greater than 0\n";
+				HAZARD_ERROR("Config.max_players must be greater than 0");
+			}
+		}
+		else {
+			HAZARD_ERROR("Config.max_players is not an integer");
+		}
+	}
+
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "low_latency");
+	if (!lua_isnil(L, -1)) {
+		if (lua_isboolean(L, -1)) {
+			lowLatency = lua_toboolean(L, -1);
+		}
+		else {
+			HAZARD_ERROR("Config.low_latency is not a boolean");
+		}
+	}
+
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "tick_rate");
+	if (!lua_isnil(L, -1)) {
+		if (lua_isinteger(L, -1)) {
+			lua_Integer i = lua_tointeger(L, -1);
+			if (i > 0 && i <= 1000) {
+				tickRate = static_cast<std::uint32_t>(i);
+			}
+			else {
+				HAZARD_ERROR("Config.tick_rate must be between 1 and 1000");
+			}
+		}
+		else {
+			HAZARD_ERROR("Config.tick_rate is not an integer");
+		}
+	}
+
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "snapshot_rate");
+	if (!lua_isnil(L, -1)) {
+		if (lua_isinteger(L, -1)) {
+			lua_Integer i = lua_tointeger(L, -1);
+			if (i > 0 && i <= tickRate) {
+				snapshotRate = static_cast<std::uint32_t>(i);
+			}
+			else {
+				HAZARD_ERROR("Config.snapshot_rate must be between 1 and Config.tick_rate");
+			}
+		}
+		else {
+			HAZARD_ERROR("Config.snapshot_rate is not an integer");
+		}
+	}
+	// The default can be higher than a lower tick rate
+	if (snapshotRate > tickRate) {
+		snapshotRate = tickRate;
+	}
+
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "min_snapshot_rate");
+	if (!lua_isnil(L, -1)) {
+		if (lua_isinteger(L, -1)) {
+			lua_Integer i = lua_tointeger(L, -1);
+			if (i > 0) {
+				minSnapshotRate = static_cast<std::uint32_t>(i);
+			}
+			else {
+				HAZARD_ERROR("Config.min_snapshot_rate must be greater than 0");
 			}
 		}
 		else {
-			std::cerr << "ERROR: Config.max_players is not an integer\n";
+			HAZARD_ERROR("Config.min_snapshot_rate is not an integer");
+		}
+	}
+
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "adaptive_snapshots");
+	if (!lua_isnil(L, -1)) {
+		if (lua_isboolean(L, -1)) {
+			adaptiveSnapshots = lua_toboolean(L, -1);
+		}
+		else {
+			HAZARD_ERROR("Config.adaptive_snapshots is not a boolean");
+		}
+	}
+
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "idle_timeout");
+	if (!lua_isnil(L, -1)) {
+		if (lua_isinteger(L, -1)) {
+			lua_Integer i = lua_tointeger(L, -1);
+			if (i >= 0) {
+				idleTimeout = static_cast<std::uint32_t>(i);
+			}
+			else {
+				HAZARD_ERROR("Config.idle_timeout must not be negative");
+			}
+		}
+		else {
+			HAZARD_ERROR("Config.idle_timeout is not an integer");
+		}
+	}
+
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "rooms");
+	if (!lua_isnil(L, -1)) {
+		if (lua_isinteger(L, -1)) {
+			lua_Integer i = lua_tointeger(L, -1);
+			if (i > 0) {
+				rooms = static_cast<std::uint32_t>(i);
+			}
+			else {
+				HAZARD_ERROR("Config.rooms must be greater than 0");
+			}
+		}
+		else {
+			HAZARD_ERROR("Config.rooms is not an integer");
+		}
+	}
+
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "stats_interval");
+	if (!lua_isnil(L, -1)) {
+		if (lua_isinteger(L, -1)) {
+			lua_Integer i = lua_tointeger(L, -1);
+			if (i >= 0) {
+				statsInterval = static_cast<std::uint32_t>(i);
+			}
+			else {
+				HAZARD_ERROR("Config.stats_interval must not be negative");
+			}
+		}
+		else {
+			HAZARD_ERROR("Config.stats_interval is not an integer");
+		}
+	}
+
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "script_memory_limit");
+	if (!lua_isnil(L, -1)) {
+		if (lua_isinteger(L, -1)) {
+			lua_Integer i = lua_tointeger(L, -1);
+			if (i >= 0) {
+				scriptMemoryLimit = static_cast<std::uint32_t>(i);
+			}
+			else {
+				HAZARD_ERROR("Config.script_memory_limit must not be negative");
+			}
+		}
+		else {
+			HAZARD_ERROR("Config.script_memory_limit is not an integer");
+		}
+	}
+
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "gc_mode");
+	if (!lua_isnil(L, -1)) {
+		if (lua_type(L, -1) == LUA_TSTRING && std::string(lua_tostring(L, -1)) == "incremental") {
+			generationalGC = false;
+		}
+		else if (lua_type(L, -1) == LUA_TSTRING && std::string(lua_tostring(L, -1)) == "generational") {
+			generationalGC = true;
+		}
+		else {
+			HAZARD_ERROR("Config.gc_mode must be 'incremental' or 'generational'");
+		}
+	}
+
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "gc_pause");
+	if (!lua_isnil(L, -1)) {
+		if (lua_isinteger(L, -1)) {
+			lua_Integer i = lua_tointeger(L, -1);
+			if (i >= 0) {
+				gcPause = static_cast<std::uint32_t>(i);
+			}
+			else {
+				HAZARD_ERROR("Config.gc_pause must not be negative");
+			}
+		}
+		else {
+			HAZARD_ERROR("Config.gc_pause is not an integer");
+		}
+	}
+
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "gc_step_multiplier");
+	if (!lua_isnil(L, -1)) {
+		if (lua_isinteger(L, -1)) {
+			lua_Integer i = lua_tointeger(L, -1);
+			if (i >= 0) {
+				gcStepMultiplier = static_cast<std::uint32_t>(i);
+			}
+			else {
+				HAZARD_ERROR("Config.gc_step_multiplier must not be negative");
+			}
+		}
+		else {
+			HAZARD_ERROR("Config.gc_step_multiplier is not an integer");
+		}
+	}
+
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "gc_step_size");
+	if (!lua_isnil(L, -1)) {
+		if (lua_isinteger(L, -1)) {
+			lua_Integer i = lua_tointeger(L, -1);
+			if (i >= 0 && i <= 30) {
+				gcStepSize = static_cast<std::uint32_t>(i);
+			}
+			else {
+				HAZARD_ERROR("Config.gc_step_size must be between 0 and 30");
+			}
+		}
+		else {
+			HAZARD_ERROR("Config.gc_step_size is not an integer");
+		}
+	}
+
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "gc_minor_multiplier");
+	if (!lua_isnil(L, -1)) {
+		if (lua_isinteger(L, -1)) {
+			lua_Integer i = lua_tointeger(L, -1);
+			if (i >= 0) {
+				gcMinorMultiplier = static_cast<std::uint32_t>(i);
+			}
+			else {
+				HAZARD_ERROR("Config.gc_minor_multiplier must not be negative");
+			}
+		}
+		else {
+			HAZARD_ERROR("Config.gc_minor_multiplier is not an integer");
+		}
+	}
+
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "gc_major_multiplier");
+	if (!lua_isnil(L, -1)) {
+		if (lua_isinteger(L, -1)) {
+			lua_Integer i = lua_tointeger(L, -1);
+			if (i >= 0) {
+				gcMajorMultiplier = static_cast<std::uint32_t>(i);
+			}
+			else {
+				HAZARD_ERROR("Config.gc_major_multiplier must not be negative");
+			}
+		}
+		else {
+			HAZARD_ERROR("Config.gc_major_multiplier is not an integer");
+		}
+	}
+
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "gc_idle_budget");
+	if (!lua_isnil(L, -1)) {
+		if (lua_isinteger(L, -1)) {
+			lua_Integer i = lua_tointeger(L, -1);
+			if (i >= 0) {
+				gcIdleBudget = static_cast<std::uint32_t>(i);
+			}
+			else {
+				HAZARD_ERROR("Config.gc_idle_budget must not be negative");
+			}
+		}
+		else {
+			HAZARD_ERROR("Config.gc_idle_budget is not an integer");
+		}
+	}
+
+	lua_pop(L, 1);
+	// By default, every core that does not run a room runs a job worker
+	std::uint32_t cores = std::thread::hardware_concurrency();
+	jobWorkers = cores > rooms ? cores - rooms : 1;
+	lua_getfield(L, -1, "job_workers");
+	if (!lua_isnil(L, -1)) {
+		if (lua_isinteger(L, -1)) {
+			lua_Integer i = lua_tointeger(L, -1);
+			if (i >= 0) {
+				jobWorkers = static_cast<std::uint32_t>(i);
+			}
+			else {
+				HAZARD_ERROR("Config.job_workers must not be negative");
+			}
+		}
+		else {
+			HAZARD_ERROR("Config.job_workers is not an integer");
+		}
+	}
+
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "profiler_instructions");
+	if (!lua_isnil(L, -1)) {
+		if (lua_isinteger(L, -1)) {
+			lua_Integer i = lua_tointeger(L, -1);
+			if (i > 0 && i <= 0x7FFFFFFF) {
+				profilerInstructions = static_cast<std::uint32_t>(i);
+			}
+			else {
+				HAZARD_ERROR("Config.profiler_instructions must be greater than 0");
+			}
+		}
+		else {
+			HAZARD_ERROR("Config.profiler_instructions is not an integer");
+		}
+	}
+
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "profiler_interval");
+	if (!lua_isnil(L, -1)) {
+		if (lua_isinteger(L, -1)) {
+			lua_Integer i = lua_tointeger(L, -1);
+			if (i >= 0) {
+				profilerInterval = static_cast<std::uint32_t>(i);
+			}
+			else {
+				HAZARD_ERROR("Config.profiler_interval must not be negative");
+			}
+		}
+		else {
+			HAZARD_ERROR("Config.profiler_interval is not an integer");
+		}
+	}
+
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "tick_budget_ms");
+	if (!lua_isnil(L, -1)) {
+		if (lua_isinteger(L, -1)) {
+			lua_Integer i = lua_tointeger(L, -1);
+			if (i >= 0) {
+				tickBudget = static_cast<std::uint32_t>(i);
+			}
+			else {
+				HAZARD_ERROR("Config.tick_budget_ms must not be negative");
+			}
+		}
+		else {
+			HAZARD_ERROR("Config.tick_budget_ms is not an integer");
+		}
+	}
+
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "tick_limit_ms");
+	if (!lua_isnil(L, -1)) {
+		if (lua_isinteger(L, -1)) {
+			lua_Integer i = lua_tointeger(L, -1);
+			if (i >= 0) {
+				tickLimit = static_cast<std::uint32_t>(i);
+			}
+			else {
+				HAZARD_ERROR("Config.tick_limit_ms must not be negative");
+			}
+		}
+		else {
+			HAZARD_ERROR("Config.tick_limit_ms is not an integer");
+		}
+	}
+
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "metrics_port");
+	if (!lua_isnil(L, -1)) {
+		if (lua_isinteger(L, -1)) {
+			lua_Integer i = lua_tointeger(L, -1);
+			if (i >= 0 && i <= UINT16_MAX) {
+				metricsPort = static_cast<std::uint16_t>(i);
+			}
+			else {
+				HAZARD_ERROR("Config.metrics_port must be between 0 and 65535");
+			}
+		}
+		else {
+			HAZARD_ERROR("Config.metrics_port is not an integer");
+		}
+	}
+
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "record");
+	if (!lua_isnil(L, -1)) {
+		if (lua_isboolean(L, -1)) {
+			record = lua_toboolean(L, -1);
+		}
+		else {
+			HAZARD_ERROR("Config.record is not a boolean");
+		}
+	}
+
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "capture");
+	if (!lua_isnil(L, -1)) {
+		if (lua_isboolean(L, -1)) {
+			capture = lua_toboolean(L, -1);
+		}
+		else {
+			HAZARD_ERROR("Config.capture is not a boolean");
+		}
+	}
+
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "client_stats_log");
+	if (!lua_isnil(L, -1)) {
+		if (lua_isboolean(L, -1)) {
+			clientStatsLog = lua_toboolean(L, -1);
+		}
+		else {
+			HAZARD_ERROR("Config.client_stats_log is not a boolean");
+		}
+	}
+
+	lua_pop(L, 1);
+	lua_getfield(L, -1, "log_level");
+	if (!lua_isnil(L, -1)) {
+		if (lua_type(L, -1) != LUA_TSTRING || !ParseLogLevel(lua_tostring(L, -1), logLevel)) {
+			HAZARD_ERROR("Config.log_level must be 'debug', 'info', 'warning' or 'error'");
 		}
 	}
 
 	lua_settop(L, 0);
+
+	// There is only one logger, so the level applies to the whole program
+	GetLogger().SetLevel(logLevel);
+}
+
+std::uint32_t Config::Route(const std::string& playerName, std::uint32_t room) {
+	lua_getglobal(L, "Config");
+	if (lua_istable(L, -1)) {
+		lua_getfield(L, -1, "route");
+		if (lua_isfunction(L, -1)) {
+			lua_pushstring(L, playerName.c_str());
+			lua_pushinteger(L, room);
+			if (lua_pcall(L, 2, 1, 0) != LUA_OK) {
+				HAZARD_ERROR("Error while calling Config.route: " << lua_tostring(L, -1));
+			}
+			else if (!lua_isinteger(L, -1)) {
+				HAZARD_ERROR("Error while calling Config.route: Function must return an integer");
+			}
+			else {
+				room = static_cast<std::uint32_t>(lua_tointeger(L, -1));
+			}
+		}
+	}
+
+	lua_settop(L, 0);
+	return room;
 }
 
 const std::vector<std::string>& Config::GetTextures() const {
@@ -187,6 +669,10 @@ const std::vector<std::string>& Config::GetSounds() const {
 	return sounds;
 }
 
+const std::vector<std::string>& Config::GetPlugins() const {
+	return plugins;
+}
+
 const std::string& Config::WindowTitle() const {
 	return windowTitle;
 }
@@ -210,3 +696,107 @@ std::uint16_t Config::Port() const {
 std::uint32_t Config::MaxPlayers() const {
 	return maxPlayers;
 }
+
+bool Config::LowLatency() const {
+	return lowLatency;
+}
+
+std::uint32_t Config::TickRate() const {
+	return tickRate;
+}
+
+std::uint32_t Config::SnapshotRate() const {
+	return snapshotRate;
+}
+
+std::uint32_t Config::MinSnapshotRate() const {
+	return minSnapshotRate;
+}
+
+bool Config::AdaptiveSnapshots() const {
+	return adaptiveSnapshots;
+}
+
+std::uint32_t Config::IdleTimeout() const {
+	return idleTimeout;
+}
+
+std::uint32_t Config::Rooms() const {
+	return rooms;
+}
+
+std::uint32_t Config::StatsInterval() const {
+	return statsInterval;
+}
+
+std::uint32_t Config::ScriptMemoryLimit() const {
+	return scriptMemoryLimit;
+}
+
+bool Config::GenerationalGC() const {
+	return generationalGC;
+}
+
+std::uint32_t Config::GCPause() const {
+	return gcPause;
+}
+
+std::uint32_t Config::GCStepMultiplier() const {
+	return gcStepMultiplier;
+}
+
+std::uint32_t Config::GCStepSize() const {
+	return gcStepSize;
+}
+
+std::uint32_t Config::GCMinorMultiplier() const {
+	return gcMinorMultiplier;
+}
+
+std::uint32_t Config::GCMajorMultiplier() const {
+	return gcMajorMultiplier;
+}
+
+std::uint32_t Config::GCIdleBudget() const {
+	return gcIdleBudget;
+}
+
+std::uint32_t Config::JobWorkers() const {
+	return jobWorkers;
+}
+
+std::uint32_t Config::ProfilerInstructions() const {
+	return profilerInstructions;
+}
+
+std::uint32_t Config::ProfilerInterval() const {
+	return profilerInterval;
+}
+
+std::uint32_t Config::TickBudget() const {
+	return tickBudget;
+}
+
+std::uint32_t Config::TickLimit() const {
+	return tickLimit;
+}
+
+std::uint16_t Config::MetricsPort() const {
+	return metricsPort;
+}
+
+bool Config::Record() const {
+	return record;
+}
+
+bool Config::Capture() const {
+	return capture;
+}
+
+bool Config::ClientStatsLog() const {
+	return clientStatsLog;
+}
+
+LogLevel Config::GetLogLevel() const {
+	return logLevel;
+}
@@ -9,6 +9,9 @@
 
 #include <lua.hpp>
 
+#include "Log.h"
+#include "LuaAllocator.h"
+
 namespace Hazard {
 	class Config {
 	public:
@@ -20,8 +23,11 @@ namespace Hazard {
 
 		void Reload();
 
+		std::uint32_t Route(const std::string& playerName, std::uint32_t room);
+
 		const std::vector<std::string>& GetTextures() const;
 		const std::vector<std::string>& GetSounds() const;
+		const std::vector<std::string>& GetPlugins() const;
 
 		const std::string& WindowTitle() const;
 		std::uint32_t WindowWidth() const;
@@ -29,19 +35,67 @@ namespace Hazard {
 		std::uint32_t FontSize() const;
 		std::uint16_t Port() const;
 		std::uint32_t MaxPlayers() const;
+		bool LowLatency() const;
+		std::uint32_t TickRate() const;
+		std::uint32_t SnapshotRate() const;
+		std::uint32_t MinSnapshotRate() const;
+		bool AdaptiveSnapshots() const;
+		std::uint32_t IdleTimeout() const;
+		std::uint32_t Rooms() const;
+		std::uint32_t StatsInterval() const;
+		std::uint32_t ScriptMemoryLimit() const;
+		bool GenerationalGC() const;
+		std::uint32_t GCPause() const;
+		std::uint32_t GCStepMultiplier() const;
+		std::uint32_t GCStepSize() const;
+		std::uint32_t GCMinorMultiplier() const;
+		std::uint32_t GCMajorMultiplier() const;
+		std::uint32_t GCIdleBudget() const;
+		std::uint32_t JobWorkers() const;
+		std::uint32_t ProfilerInstructions() const;
+		std::uint32_t ProfilerInterval() const;
+		// In milliseconds
+		std::uint32_t TickBudget() const;
+		std::uint32_t TickLimit() const;
+		// 0 if metrics are disabled
+		std::uint16_t MetricsPort() const;
+		bool Record() const;
+		bool Capture() const;
+		bool ClientStatsLog() const;
+		LogLevel GetLogLevel() const;
 
 	private:
 		std::string path;
+		LuaAllocator allocator;
 		lua_State* L = nullptr;
 
 		std::vector<std::string> textures;
 		std::vector<std::string> sounds;
+		std::vector<std::string> plugins;
 
 		std::string windowTitle;
 		std::uint32_t windowWidth, windowHeight;
 		std::uint32_t fontSize;
 		std::uint16_t port;
 		std::uint32_t maxPlayers;
+		bool lowLatency;
+		std::uint32_t tickRate;
+		std::uint32_t snapshotRate, minSnapshotRate;
+		bool adaptiveSnapshots;
+		std::uint32_t idleTimeout;
+		std::uint32_t rooms;
+		std::uint32_t statsInterval;
+		std::uint32_t scriptMemoryLimit;
+		bool generationalGC;
+		std::uint32_t gcPause, gcStepMultiplier, gcStepSize;
+		std::uint32_t gcMinorMultiplier, gcMajorMultiplier;
+		std::uint32_t gcIdleBudget;
+		std::uint32_t jobWorkers;
+		std::uint32_t profilerInstructions, profilerInterval;
+		std::uint32_t tickBudget, tickLimit;
+		std::uint16_t metricsPort;
+		bool record, capture, clientStatsLog;
+		LogLevel logLevel;
 	};
 }
 
@@ -0,0 +1,100 @@
+// Copyright 2022 Justus Zorn
+
+#ifndef Hazard_HazardPlugin_h
+#define Hazard_HazardPlugin_h
+
+// C interface between Hazard and native plugins. Plugins are shared libraries
+// that export HAZARD_PLUGIN_LOAD. The layout of the structures below only
+// changes together with HAZARD_PLUGIN_VERSION, new fields are only added at
+// the end.
+
+#include <stdint.h>
+
+#define HAZARD_PLUGIN_VERSION 1
+
+#define HAZARD_PLUGIN_LOAD "hazard_plugin_load"
+
+#ifdef _WIN32
+#define HAZARD_PLUGIN_EXPORT __declspec(dllexport)
+#else
+#define HAZARD_PLUGIN_EXPORT __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct lua_State;
+
+// Opaque handle for the room that loaded the plugin
+typedef struct HazardContext HazardContext;
+
+// Same as lua_CFunction. The 'data' pointer passed to register_function is
+// available as lua_touserdata(L, lua_upvalueindex(1)).
+typedef int (*HazardLuaFunction)(struct lua_State* L);
+
+// Functions that take a player, texture or sound return -1 if it does not
+// exist, and 0 otherwise. Strings returned by Hazard are valid until the end
+// of the current callback.
+typedef struct HazardAPI {
+	uint32_t version;
+	HazardContext* context;
+
+	uint64_t (*get_ticks)(void);
+	uint32_t (*get_room)(HazardContext* context);
+
+	// Writes at most 'capacity' player names to 'players' and returns the
+	// number of players that are online
+	uint32_t (*get_players)(HazardContext* context, const char** players, uint32_t capacity);
+	int (*is_online)(HazardContext* context, const char* player);
+	int (*kick)(HazardContext* context, const char* player);
+	int (*is_idle)(HazardContext* context, const char* player);
+
+	int (*is_key_down)(HazardContext* context, const char* player, const char* key);
+	int (*is_button_down)(HazardContext* context, const char* player, const char* button);
+	int32_t (*get_axis)(HazardContext* context, const char* player, const char* axis);
+	const char* (*get_composition)(HazardContext* context, const char* player);
+	int (*set_composition)(HazardContext* context, const char* player, const char* composition);
+
+	// 'animation' is the frame of the texture, 'size' works like in draw_sprite
+	int (*draw_sprite)(HazardContext* context, const char* player, const char* texture, int32_t x, int32_t y, uint32_t size, uint32_t animation);
+	int (*draw_text)(HazardContext* context, const char* player, const char* text, uint32_t length, int32_t x, int32_t y, uint8_t r, uint8_t g, uint8_t b, uint32_t lineLength);
+
+	// A channel of -1 plays the sound on any free channel
+	int (*play_sound)(HazardContext* context, const char* player, const char* sound, uint8_t volume, int32_t channel);
+	int (*stop_sound)(HazardContext* context, const char* player, uint16_t channel);
+	int (*stop_all_sounds)(HazardContext* context, const char* player);
+
+	// Adds a global Lua function to the script, which stays available when
+	// the script is reloaded
+	void (*register_function)(HazardContext* context, const char* name, HazardLuaFunction function, void* data);
+} HazardAPI;
+
+// Filled in by the plugin. Callbacks that are not needed can be left NULL,
+// 'data' is passed to every callback.
+typedef struct HazardPlugin {
+	void* data;
+
+	void (*on_unload)(void* data);
+
+	void (*on_tick)(void* data, double dt);
+
+	// Returns 0 to reject the player
+	int (*on_login)(void* data, const char* player);
+	void (*on_join)(void* data, const char* player);
+	void (*on_disconnect)(void* data, const char* player);
+
+	void (*on_key_event)(void* data, const char* player, const char* key, int pressed);
+	void (*on_button_event)(void* data, const char* player, const char* button, int pressed);
+	void (*on_axis_event)(void* data, const char* player, const char* axis, int32_t state);
+} HazardPlugin;
+
+// Called once for every room. 'api' stays valid until on_unload is called.
+// Returns 0 if the plugin was loaded.
+typedef int (*HazardPluginLoad)(const HazardAPI* api, HazardPlugin* plugin);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
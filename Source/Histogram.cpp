@@ -0,0 +1,63 @@
+// Copyright 2022 Justus Zorn
+
+#include "Histogram.h"
+
+using namespace Hazard;
+
+void Histogram::Add(std::uint64_t value) {
+	int bucket = 0;
+	while (bucket < Buckets - 1 && value >= GetBucketLimit(bucket)) {
+		++bucket;
+	}
+	++buckets[bucket];
+	++count;
+	if (value > max) {
+		max = value;
+	}
+}
+
+void Histogram::Clear() {
+	for (std::uint64_t& bucket : buckets) {
+		bucket = 0;
+	}
+	count = 0;
+	max = 0;
+}
+
+std::uint64_t Histogram::GetCount() const {
+	return count;
+}
+
+std::uint64_t Histogram::GetMax() const {
+	return max;
+}
+
+std::uint64_t Histogram::GetBucket(int bucket) const {
+	return buckets[bucket];
+}
+
+std::uint64_t Histogram::GetPercentile(double fraction) const {
+	if (count == 0) {
+		return 0;
+	}
+
+	double rank = fraction * count;
+	std::uint64_t below = 0;
+	for (int i = 0; i < Buckets; ++i) {
+		if (buckets[i] == 0 || below + buckets[i] < rank) {
+			below += buckets[i];
+			continue;
+		}
+
+		// Values are assumed to be spread evenly across the bucket
+		std::uint64_t low = i == 0 ? 0 : GetBucketLimit(i - 1);
+		std::uint64_t high = i == Buckets - 1 ? max + 1 : GetBucketLimit(i);
+		std::uint64_t value = low + static_cast<std::uint64_t>((high - low) * (rank - below) / buckets[i]);
+		return value < max ? value : max;
+	}
+	return max;
+}
+
+std::uint64_t Histogram::GetBucketLimit(int bucket) {
+	return 1ull << bucket;
+}
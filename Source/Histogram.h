@@ -0,0 +1,37 @@
+// Copyright 2022 Justus Zorn
+
+#ifndef Hazard_Histogram_h
+#define Hazard_Histogram_h
+
+#include <cstdint>
+
+namespace Hazard {
+	// Counts values in buckets that double in size. Bucket 0 holds the value 0,
+	// bucket i the values from 2^(i-1) up to 2^i - 1, and the last bucket all
+	// larger values. For durations in microseconds, the buckets go up to about
+	// 8 seconds.
+	class Histogram {
+	public:
+		static constexpr int Buckets = 25;
+
+		void Add(std::uint64_t value);
+		void Clear();
+
+		std::uint64_t GetCount() const;
+		std::uint64_t GetMax() const;
+		std::uint64_t GetBucket(int bucket) const;
+
+		// Estimates the value that 'fraction' of all values do not exceed
+		std::uint64_t GetPercentile(double fraction) const;
+
+		// Returns the smallest value that is too large for 'bucket'
+		static std::uint64_t GetBucketLimit(int bucket);
+
+	private:
+		std::uint64_t buckets[Buckets] = {};
+		std::uint64_t count = 0;
+		std::uint64_t max = 0;
+	};
+}
+
+#endif
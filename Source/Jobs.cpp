@@ -0,0 +1,168 @@
+// Copyright 2022 Justus Zorn
+
+#include <lua.hpp>
+
+#include "Bytecode.h"
+#include "Jobs.h"
+#include "LuaAllocator.h"
+#include "Serializer.h"
+#include "Trace.h"
+
+using namespace Hazard;
+
+static JobPool jobPool;
+
+JobPool::~JobPool() {
+	Stop();
+}
+
+void JobPool::Start(std::uint32_t workers, std::size_t memoryLimit) {
+	Stop();
+
+	this->memoryLimit = memoryLimit;
+	stopping = false;
+	for (std::uint32_t i = 0; i < workers; ++i) {
+		threads.emplace_back(&JobPool::Work, this);
+	}
+}
+
+void JobPool::Stop() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		// Jobs that did not start yet are never finished
+		queue.clear();
+	}
+	condition.notify_all();
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	threads.clear();
+}
+
+void JobPool::Reload() {
+	++generation;
+}
+
+bool JobPool::Submit(std::shared_ptr<Job> job) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (threads.empty() || stopping) {
+			return false;
+		}
+		queue.push_back(std::move(job));
+	}
+	++submitted;
+	condition.notify_one();
+	return true;
+}
+
+JobStats JobPool::GetStats() {
+	std::lock_guard<std::mutex> lock(mutex);
+	JobStats stats;
+	stats.submitted = submitted;
+	stats.completed = completed;
+	stats.failed = failed;
+	stats.queued = queue.size();
+	stats.workers = static_cast<std::uint32_t>(threads.size());
+	return stats;
+}
+
+static int RunJob(lua_State* L) {
+	Job* job = reinterpret_cast<Job*>(lua_touserdata(L, 1));
+	lua_settop(L, 0);
+
+	lua_getglobal(L, "require");
+	lua_pushlstring(L, job->module.data(), job->module.size());
+	lua_call(L, 1, 1);
+	if (!lua_istable(L, 1)) {
+		return luaL_error(L, "module '%s' does not return a table", job->module.c_str());
+	}
+	lua_getfield(L, 1, job->function.c_str());
+	if (!lua_isfunction(L, 2)) {
+		return luaL_error(L, "module '%s' has no function '%s'", job->module.c_str(), job->function.c_str());
+	}
+
+	int arguments = DeserializeValues(L, job->data.data(), job->data.size());
+	if (arguments < 0) {
+		return luaL_error(L, "invalid arguments");
+	}
+	lua_call(L, arguments, LUA_MULTRET);
+
+	std::vector<std::uint8_t> results;
+	std::string error;
+	if (!SerializeValues(L, 2, lua_gettop(L) - 1, results, error)) {
+		return luaL_error(L, "invalid result: %s", error.c_str());
+	}
+	job->data.swap(results);
+	return 0;
+}
+
+void JobPool::Work() {
+	LuaAllocator allocator(memoryLimit);
+	lua_State* L = nullptr;
+	std::uint64_t loaded = 0;
+	SetTraceThreadName("Job worker");
+
+	while (true) {
+		std::shared_ptr<Job> job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, [this]() { return stopping || !queue.empty(); });
+			if (stopping) {
+				break;
+			}
+			job = std::move(queue.front());
+			queue.pop_front();
+		}
+
+		TraceScope trace("JobPool::Work");
+		if (L && loaded != generation) {
+			lua_close(L);
+			L = nullptr;
+		}
+		if (!L) {
+			loaded = generation;
+			L = allocator.NewState();
+			if (L) {
+				luaL_openlibs(L);
+				AddCachedSearcher(L);
+			}
+		}
+
+		if (!L) {
+			static const char message[] = "Lua initialization failed";
+			job->data.assign(message, message + sizeof(message) - 1);
+			job->failed = true;
+		}
+		else {
+			lua_pushcfunction(L, RunJob);
+			lua_pushlightuserdata(L, job.get());
+			if (lua_pcall(L, 1, 0, 0) != LUA_OK) {
+				std::size_t length = 0;
+				const char* message = lua_tolstring(L, -1, &length);
+				if (!message) {
+					message = "unknown error";
+					length = 13;
+				}
+				job->data.assign(message, message + length);
+				job->failed = true;
+			}
+			lua_settop(L, 0);
+		}
+
+		if (job->failed) {
+			++failed;
+		}
+		++completed;
+		job->done.store(true, std::memory_order_release);
+	}
+
+	if (L) {
+		lua_close(L);
+	}
+}
+
+JobPool& Hazard::GetJobPool() {
+	return jobPool;
+}
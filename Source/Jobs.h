@@ -0,0 +1,74 @@
+// Copyright 2022 Justus Zorn
+
+#ifndef Hazard_Jobs_h
+#define Hazard_Jobs_h
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Hazard {
+	struct Job {
+		std::string module;
+		std::string function;
+		// Serialized arguments, replaced by the serialized results or the error
+		// message once the job is done
+		std::vector<std::uint8_t> data;
+		bool failed = false;
+		std::atomic<bool> done = false;
+	};
+
+	struct JobStats {
+		std::uint64_t submitted;
+		std::uint64_t completed;
+		std::uint64_t failed;
+		std::uint64_t queued;
+		std::uint32_t workers;
+	};
+
+	// Runs jobs on worker threads. Every worker has its own Lua state, which
+	// loads modules with require and shares nothing with the game scripts.
+	class JobPool {
+	public:
+		JobPool() = default;
+		JobPool(const JobPool&) = delete;
+		~JobPool();
+
+		JobPool& operator=(const JobPool&) = delete;
+
+		void Start(std::uint32_t workers, std::size_t memoryLimit);
+		void Stop();
+
+		// Workers load all modules again before their next job
+		void Reload();
+
+		// Returns false if there are no workers
+		bool Submit(std::shared_ptr<Job> job);
+
+		JobStats GetStats();
+
+	private:
+		std::mutex mutex;
+		std::condition_variable condition;
+		std::deque<std::shared_ptr<Job>> queue;
+		std::vector<std::thread> threads;
+		bool stopping = false;
+		std::size_t memoryLimit = 0;
+
+		std::atomic<std::uint64_t> generation = 0;
+		std::atomic<std::uint64_t> submitted = 0, completed = 0, failed = 0;
+
+		void Work();
+	};
+
+	JobPool& GetJobPool();
+}
+
+#endif
@@ -0,0 +1,313 @@
+// Copyright 2022 Justus Zorn
+
+#include "Keys.h"
+#include "Log.h"
+
+using namespace Hazard;
+
+// Key names for scancodes, identical to the ones returned by SDL_GetScancodeName
+static const char* scancodeNames[512] = {
+	nullptr, nullptr, nullptr, nullptr,
+	"A",
+	"B",
+	"C",
+	"D",
+	"E",
+	"F",
+	"G",
+	"H",
+	"I",
+	"J",
+	"K",
+	"L",
+	"M",
+	"N",
+	"O",
+	"P",
+	"Q",
+	"R",
+	"S",
+	"T",
+	"U",
+	"V",
+	"W",
+	"X",
+	"Y",
+	"Z",
+	"1",
+	"2",
+	"3",
+	"4",
+	"5",
+	"6",
+	"7",
+	"8",
+	"9",
+	"0",
+	"Return",
+	"Escape",
+	"Backspace",
+	"Tab",
+	"Space",
+	"-",
+	"=",
+	"[",
+	"]",
+	"\\",
+	"#",
+	";",
+	"'",
+	"`",
+	",",
+	".",
+	"/",
+	"CapsLock",
+	"F1",
+	"F2",
+	"F3",
+	"F4",
+	"F5",
+	"F6",
+	"F7",
+	"F8",
+	"F9",
+	"F10",
+	"F11",
+	"F12",
+	"PrintScreen",
+	"ScrollLock",
+	"Pause",
+	"Insert",
+	"Home",
+	"PageUp",
+	"Delete",
+	"End",
+	"PageDown",
+	"Right",
+	"Left",
+	"Down",
+	"Up",
+	"Numlock",
+	"Keypad /",
+	"Keypad *",
+	"Keypad -",
+	"Keypad +",
+	"Keypad Enter",
+	"Keypad 1",
+	"Keypad 2",
+	"Keypad 3",
+	"Keypad 4",
+	"Keypad 5",
+	"Keypad 6",
+	"Keypad 7",
+	"Keypad 8",
+	"Keypad 9",
+	"Keypad 0",
+	"Keypad .",
+	nullptr,
+	"Application",
+	"Power",
+	"Keypad =",
+	"F13",
+	"F14",
+	"F15",
+	"F16",
+	"F17",
+	"F18",
+	"F19",
+	"F20",
+	"F21",
+	"F22",
+	"F23",
+	"F24",
+	"Execute",
+	"Help",
+	"Menu",
+	"Select",
+	"Stop",
+	"Again",
+	"Undo",
+	"Cut",
+	"Copy",
+	"Paste",
+	"Find",
+	"Mute",
+	"VolumeUp",
+	"VolumeDown",
+	nullptr, nullptr, nullptr,
+	"Keypad ,",
+	"Keypad = (AS400)",
+	nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr,
+	"AltErase",
+	"SysReq",
+	"Cancel",
+	"Clear",
+	"Prior",
+	"Return",
+	"Separator",
+	"Out",
+	"Oper",
+	"Clear / Again",
+	"CrSel",
+	"ExSel",
+	nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr,
+	"Keypad 00",
+	"Keypad 000",
+	"ThousandsSeparator",
+	"DecimalSeparator",
+	"CurrencyUnit",
+	"CurrencySubUnit",
+	"Keypad (",
+	"Keypad )",
+	"Keypad {",
+	"Keypad }",
+	"Keypad Tab",
+	"Keypad Backspace",
+	"Keypad A",
+	"Keypad B",
+	"Keypad C",
+	"Keypad D",
+	"Keypad E",
+	"Keypad F",
+	"Keypad XOR",
+	"Keypad ^",
+	"Keypad %",
+	"Keypad <",
+	"Keypad >",
+	"Keypad &",
+	"Keypad &&",
+	"Keypad |",
+	"Keypad ||",
+	"Keypad :",
+	"Keypad #",
+	"Keypad Space",
+	"Keypad @",
+	"Keypad !",
+	"Keypad MemStore",
+	"Keypad MemRecall",
+	"Keypad MemClear",
+	"Keypad MemAdd",
+	"Keypad MemSubtract",
+	"Keypad MemMultiply",
+	"Keypad MemDivide",
+	"Keypad +/-",
+	"Keypad Clear",
+	"Keypad ClearEntry",
+	"Keypad Binary",
+	"Keypad Octal",
+	"Keypad Decimal",
+	"Keypad Hexadecimal",
+	nullptr, nullptr,
+	"Left Ctrl",
+	"Left Shift",
+	"Left Alt",
+	"Left GUI",
+	"Right Ctrl",
+	"Right Shift",
+	"Right Alt",
+	"Right GUI",
+	nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr,
+	"ModeSwitch",
+	"AudioNext",
+	"AudioPrev",
+	"AudioStop",
+	"AudioPlay",
+	"AudioMute",
+	"MediaSelect",
+	"WWW",
+	"Mail",
+	"Calculator",
+	"Computer",
+	"AC Search",
+	"AC Home",
+	"AC Back",
+	"AC Forward",
+	"AC Stop",
+	"AC Refresh",
+	"AC Bookmarks",
+	"BrightnessDown",
+	"BrightnessUp",
+	"DisplaySwitch",
+	"KBDIllumToggle",
+	"KBDIllumDown",
+	"KBDIllumUp",
+	"Eject",
+	"Sleep",
+	"App1",
+	"App2",
+	"AudioRewind",
+	"AudioFastForward",
+};
+
+static const char* GetScancodeName(std::int32_t scancode) {
+	if (scancode < 0 || scancode >= 512 || !scancodeNames[scancode]) {
+		return "";
+	}
+	return scancodeNames[scancode];
+}
+
+std::string Hazard::GetKeyName(std::int32_t key) {
+	if (key & HAZARD_KEY_SCANCODE_MASK) {
+		return GetScancodeName(key & ~HAZARD_KEY_SCANCODE_MASK);
+	}
+
+	switch (key) {
+	case '\r':
+		return "Return";
+	case '\x1B':
+		return "Escape";
+	case HAZARD_KEY_BACKSPACE:
+		return "Backspace";
+	case '\t':
+		return "Tab";
+	case ' ':
+		return "Space";
+	case '\x7F':
+		return "Delete";
+	}
+
+	// Letter keys are labeled in upper case
+	std::uint32_t codepoint = static_cast<std::uint32_t>(key);
+	if (codepoint >= 'a' && codepoint <= 'z') {
+		codepoint -= 32;
+	}
+
+	std::string name;
+	if (codepoint <= 0x7F) {
+		name += static_cast<char>(codepoint);
+	}
+	else if (codepoint <= 0x7FF) {
+		name += static_cast<char>(0xC0 | ((codepoint >> 6) & 0x1F));
+		name += static_cast<char>(0x80 | (codepoint & 0x3F));
+	}
+	else if (codepoint <= 0xFFFF) {
+		name += static_cast<char>(0xE0 | ((codepoint >> 12) & 0x0F));
+		name += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+		name += static_cast<char>(0x80 | (codepoint & 0x3F));
+	}
+	else {
+		name += static_cast<char>(0xF0 | ((codepoint >> 18) & 0x07));
+		name += static_cast<char>(0x80 | ((codepoint >> 12) & 0x3F));
+		name += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+		name += static_cast<char>(0x80 | (codepoint & 0x3F));
+	}
+	return name;
+}
+
+const char* Hazard::GetButtonName(std::uint8_t button) {
+	switch (button) {
+	case HAZARD_BUTTON_LEFT:
+		return "Left";
+	case HAZARD_BUTTON_MIDDLE:
+		return "Middle";
+	case HAZARD_BUTTON_RIGHT:
+		return "Right";
+	case HAZARD_BUTTON_X1:
+		return "X1";
+	case HAZARD_BUTTON_X2:
+		return "X2";
+	default:
+		HAZARD_ERROR("Invalid button " << button);
+		return "";
+	}
+}
@@ -0,0 +1,25 @@
+// Copyright 2022 Justus Zorn
+
+#ifndef Hazard_Keys_h
+#define Hazard_Keys_h
+
+#include <cstdint>
+#include <string>
+
+// Keycodes and mouse buttons are sent by the client with the same values as
+// SDL_Keycode and the SDL_BUTTON_* constants
+#define HAZARD_KEY_SCANCODE_MASK (1 << 30)
+#define HAZARD_KEY_BACKSPACE '\b'
+
+#define HAZARD_BUTTON_LEFT 1
+#define HAZARD_BUTTON_MIDDLE 2
+#define HAZARD_BUTTON_RIGHT 3
+#define HAZARD_BUTTON_X1 4
+#define HAZARD_BUTTON_X2 5
+
+namespace Hazard {
+	std::string GetKeyName(std::int32_t key);
+	const char* GetButtonName(std::uint8_t button);
+}
+
+#endif
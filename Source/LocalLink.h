@@ -0,0 +1,31 @@
+// Copyright 2022 Justus Zorn
+
+#ifndef Hazard_LocalLink_h
+#define Hazard_LocalLink_h
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "Common.h"
+#include "TripleBuffer.h"
+
+namespace Hazard {
+	// Connects the client and the server of the same process in integrated mode,
+	// without serializing packets or going through the network
+	struct LocalLink {
+		std::string playerName;
+
+		// Server to client, only the latest sprites are relevant
+		TripleBuffer<SpriteBuffer> sprites;
+		// Server to client, commands are accumulated until the client took them
+		TripleBuffer<std::vector<AudioCommand>> audioCommands;
+		// Client to server, inputs are accumulated until the server took them
+		TripleBuffer<Input> input;
+
+		std::atomic<bool> connected = true;
+		std::atomic<bool> kicked = false;
+	};
+}
+
+#endif
@@ -0,0 +1,177 @@
+// Copyright 2022 Justus Zorn
+
+#include <chrono>
+#include <iostream>
+
+#include "Log.h"
+
+using namespace Hazard;
+
+// Time the writer thread waits for new messages before it looks again.
+// Producers do not wake it up, because that could block them.
+static constexpr std::chrono::milliseconds WriterInterval(10);
+
+static Logger logger;
+
+bool LogSite::Allow(std::uint32_t& suppressed) {
+	// Replays freeze the clock of the engine, so the rate limit uses its own
+	std::uint64_t now = std::chrono::duration_cast<std::chrono::seconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+	std::uint64_t current = second.load(std::memory_order_relaxed);
+	if (now != current && second.compare_exchange_strong(current, now, std::memory_order_relaxed)) {
+		count.store(0, std::memory_order_relaxed);
+	}
+	if (count.fetch_add(1, std::memory_order_relaxed) >= LogBurst) {
+		suppressedCount.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	suppressed = suppressedCount.exchange(0, std::memory_order_relaxed);
+	return true;
+}
+
+Logger::Logger() {
+	for (std::uint64_t i = 0; i < QueueSize; ++i) {
+		entries[i].sequence.store(i, std::memory_order_relaxed);
+	}
+}
+
+Logger::~Logger() {
+	Stop();
+}
+
+void Logger::Start() {
+	if (running) {
+		return;
+	}
+	running = true;
+	writer = std::thread(&Logger::Run, this);
+}
+
+void Logger::Stop() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		running = false;
+	}
+	condition.notify_one();
+	if (writer.joinable()) {
+		writer.join();
+	}
+	// Messages that were queued while the writer stopped
+	WriteQueued();
+}
+
+void Logger::Flush() {
+	std::uint64_t target = tail.load(std::memory_order_acquire);
+	while (running && written.load(std::memory_order_acquire) < target) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+void Logger::SetLevel(LogLevel level) {
+	this->level = level;
+}
+
+LogLevel Logger::GetLevel() const {
+	return level.load(std::memory_order_relaxed);
+}
+
+void Logger::Log(LogLevel level, std::string message, std::uint32_t suppressed) {
+	if (!running) {
+		std::string output;
+		Format(output, level, message, suppressed);
+		std::cerr << output;
+		return;
+	}
+
+	std::uint64_t position = tail.load(std::memory_order_relaxed);
+	Entry* entry;
+	while (true) {
+		entry = &entries[position % QueueSize];
+		std::uint64_t sequence = entry->sequence.load(std::memory_order_acquire);
+		if (sequence == position) {
+			if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+				break;
+			}
+		}
+		else if (sequence < position) {
+			// The writer has not read this entry yet, so the queue is full
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		else {
+			position = tail.load(std::memory_order_relaxed);
+		}
+	}
+
+	entry->level = level;
+	entry->suppressed = suppressed;
+	entry->message = std::move(message);
+	entry->sequence.store(position + 1, std::memory_order_release);
+}
+
+void Logger::Run() {
+	while (true) {
+		WriteQueued();
+		std::unique_lock<std::mutex> lock(mutex);
+		if (!running) {
+			break;
+		}
+		condition.wait_for(lock, WriterInterval, [this]() { return !running; });
+	}
+}
+
+void Logger::WriteQueued() {
+	std::string output;
+	while (true) {
+		Entry& entry = entries[head % QueueSize];
+		if (entry.sequence.load(std::memory_order_acquire) != head + 1) {
+			break;
+		}
+		Format(output, entry.level, entry.message, entry.suppressed);
+		entry.message.clear();
+		entry.sequence.store(head + QueueSize, std::memory_order_release);
+		++head;
+	}
+
+	std::uint64_t droppedMessages = dropped.exchange(0, std::memory_order_relaxed);
+	if (droppedMessages > 0) {
+		Format(output, LogLevel::Warning, std::to_string(droppedMessages) + " log messages were dropped because the queue was full", 0);
+	}
+	if (!output.empty()) {
+		std::cerr << output << std::flush;
+	}
+	written.store(head, std::memory_order_release);
+}
+
+void Logger::Format(std::string& output, LogLevel level, const std::string& message, std::uint32_t suppressed) {
+	static const char* prefixes[] = { "DEBUG: ", "INFO: ", "WARNING: ", "ERROR: " };
+	output += prefixes[static_cast<std::size_t>(level)];
+	output += message;
+	if (suppressed > 0) {
+		output += " (" + std::to_string(suppressed) + " similar messages were suppressed)";
+	}
+	output += '\n';
+}
+
+Logger& Hazard::GetLogger() {
+	return logger;
+}
+
+bool Hazard::ParseLogLevel(const std::string& name, LogLevel& level) {
+	if (name == "debug") {
+		level = LogLevel::Debug;
+	}
+	else if (name == "info") {
+		level = LogLevel::Info;
+	}
+	else if (name == "warning") {
+		level = LogLevel::Warning;
+	}
+	else if (name == "error") {
+		level = LogLevel::Error;
+	}
+	else {
+		return false;
+	}
+	return true;
+}
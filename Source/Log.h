@@ -0,0 +1,121 @@
+// Copyright 2022 Justus Zorn
+
+#ifndef Hazard_Log_h
+#define Hazard_Log_h
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+
+namespace Hazard {
+	enum class LogLevel : std::uint8_t {
+		Debug,
+		Info,
+		Warning,
+		Error
+	};
+
+	// Rate limit of one place in the code that logs. Every site logs at most
+	// LogBurst messages per second, the rest is counted and reported with the
+	// next message of the site that is logged.
+	class LogSite {
+	public:
+		static constexpr std::uint32_t LogBurst = 10;
+
+		// Returns true if the message may be logged, and sets 'suppressed' to the
+		// number of messages that were suppressed since the last one
+		bool Allow(std::uint32_t& suppressed);
+
+	private:
+		std::atomic<std::uint64_t> second = 0;
+		std::atomic<std::uint32_t> count = 0;
+		std::atomic<std::uint32_t> suppressedCount = 0;
+	};
+
+	// Writes log messages to the standard error stream. While the writer thread
+	// runs, messages are passed to it through a lock-free queue, so that
+	// logging never waits for the console. If the queue is full, messages are
+	// dropped and counted. Without the writer thread, messages are written
+	// immediately.
+	class Logger {
+	public:
+		Logger();
+		Logger(const Logger&) = delete;
+		~Logger();
+
+		Logger& operator=(const Logger&) = delete;
+
+		void Start();
+
+		// Writes all queued messages and stops the writer thread
+		void Stop();
+
+		// Waits until all messages that were logged before were written
+		void Flush();
+
+		void SetLevel(LogLevel level);
+		LogLevel GetLevel() const;
+
+		void Log(LogLevel level, std::string message, std::uint32_t suppressed = 0);
+
+	private:
+		static constexpr std::uint64_t QueueSize = 1024;
+
+		// Bounded queue with a sequence number in every entry. An entry can be
+		// written when its sequence equals the position of the writer, and read
+		// when it is one more than the position of the reader.
+		struct Entry {
+			std::atomic<std::uint64_t> sequence;
+			LogLevel level;
+			std::uint32_t suppressed;
+			std::string message;
+		};
+
+		Entry entries[QueueSize];
+		std::atomic<std::uint64_t> tail = 0;
+		// Only used by the writer thread, or after it stopped
+		std::uint64_t head = 0;
+		std::atomic<std::uint64_t> written = 0;
+		std::atomic<std::uint64_t> dropped = 0;
+
+		std::atomic<LogLevel> level = LogLevel::Info;
+		std::atomic<bool> running = false;
+		std::thread writer;
+		std::mutex mutex;
+		std::condition_variable condition;
+
+		void Run();
+		void WriteQueued();
+		static void Format(std::string& output, LogLevel level, const std::string& message, std::uint32_t suppressed);
+	};
+
+	Logger& GetLogger();
+
+	// Parses 'debug', 'info', 'warning' or 'error'
+	bool ParseLogLevel(const std::string& name, LogLevel& level);
+}
+
+// Logs 'message', which can be composed with <<, unless its level is below the
+// level of the logger or the site exceeded its rate limit. The message is
+// only formatted if it is logged.
+#define HAZARD_LOG(logLevel, message) \
+	do { \
+		static Hazard::LogSite hazardLogSite; \
+		std::uint32_t hazardSuppressed; \
+		if ((logLevel) >= Hazard::GetLogger().GetLevel() && hazardLogSite.Allow(hazardSuppressed)) { \
+			std::ostringstream hazardLogStream; \
+			hazardLogStream << message; \
+			Hazard::GetLogger().Log((logLevel), hazardLogStream.str(), hazardSuppressed); \
+		} \
+	} while (false)
+
+#define HAZARD_ERROR(message) HAZARD_LOG(Hazard::LogLevel::Error, message)
+#define HAZARD_WARNING(message) HAZARD_LOG(Hazard::LogLevel::Warning, message)
+#define HAZARD_INFO(message) HAZARD_LOG(Hazard::LogLevel::Info, message)
+#define HAZARD_DEBUG(message) HAZARD_LOG(Hazard::LogLevel::Debug, message)
+
+#endif
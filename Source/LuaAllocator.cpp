@@ -0,0 +1,156 @@
+// Copyright 2022 Justus Zorn
+
+#include <cstdlib>
+#include <cstring>
+
+#include "Allocations.h"
+#include "Log.h"
+#include "LuaAllocator.h"
+
+using namespace Hazard;
+
+static constexpr std::size_t SlabSize = 16 * 1024;
+
+LuaAllocator::LuaAllocator(std::size_t limit) {
+	stats.limit = limit;
+}
+
+LuaAllocator::~LuaAllocator() {
+	for (void* slab : slabs) {
+		std::free(slab);
+	}
+}
+
+lua_State* LuaAllocator::NewState() {
+	lua_State* L = lua_newstate(Allocate, this);
+	if (L) {
+		lua_atpanic(L, Panic);
+	}
+	return L;
+}
+
+void LuaAllocator::SetLimit(std::size_t limit) {
+	stats.limit = limit;
+}
+
+const LuaMemoryStats& LuaAllocator::GetStats() const {
+	return stats;
+}
+
+void* LuaAllocator::Allocate(void* ud, void* ptr, std::size_t osize, std::size_t nsize) {
+	LuaAllocator* allocator = static_cast<LuaAllocator*>(ud);
+	LuaMemoryStats& stats = allocator->stats;
+
+	// Without a block, osize describes the type of the new object
+	if (!ptr) {
+		osize = 0;
+	}
+
+	if (nsize == 0) {
+		if (ptr) {
+			CountFree(Allocator::Lua);
+		}
+		allocator->ReleaseBlock(ptr, osize);
+		stats.liveBytes -= osize;
+		return nullptr;
+	}
+
+	// Shrinking must never fail, so only growing blocks count against the limit
+	if (nsize > osize && stats.limit > 0 && stats.liveBytes + (nsize - osize) > stats.limit) {
+		++stats.failedAllocations;
+		return nullptr;
+	}
+
+	std::size_t largest = SizeClasses * Granularity;
+	void* block;
+	if (ptr && osize <= largest && nsize <= largest && (osize - 1) / Granularity == (nsize - 1) / Granularity) {
+		block = ptr;
+	}
+	else if (ptr && osize > largest && nsize > largest) {
+		++stats.allocations;
+		++stats.heapAllocations;
+		block = std::realloc(ptr, nsize);
+		if (!block) {
+			return nullptr;
+		}
+	}
+	else {
+		block = allocator->AllocateBlock(nsize);
+		if (!block) {
+			return nullptr;
+		}
+		if (ptr) {
+			std::memcpy(block, ptr, osize < nsize ? osize : nsize);
+			allocator->ReleaseBlock(ptr, osize);
+		}
+	}
+
+	// Blocks that are resized in place are not new allocations. Blocks that
+	// moved are a new allocation and a free of the old block.
+	if (block != ptr) {
+		CountAllocation(Allocator::Lua, nsize);
+		if (ptr) {
+			CountFree(Allocator::Lua);
+		}
+	}
+	stats.liveBytes += nsize;
+	stats.liveBytes -= osize;
+	if (stats.liveBytes > stats.peakBytes) {
+		stats.peakBytes = stats.liveBytes;
+	}
+	return block;
+}
+
+int LuaAllocator::Panic(lua_State* L) {
+	const char* message = lua_tostring(L, -1);
+	HAZARD_ERROR("Unprotected error in Lua: " << (message ? message : "unknown error"));
+	// Lua aborts after the panic function returns
+	GetLogger().Flush();
+	return 0;
+}
+
+void* LuaAllocator::AllocateBlock(std::size_t size) {
+	++stats.allocations;
+
+	std::size_t index = (size - 1) / Granularity;
+	if (index >= SizeClasses) {
+		++stats.heapAllocations;
+		return std::malloc(size);
+	}
+
+	if (!freeLists[index]) {
+		std::size_t blockSize = (index + 1) * Granularity;
+		std::uint8_t* slab = static_cast<std::uint8_t*>(std::malloc(SlabSize));
+		if (!slab) {
+			return nullptr;
+		}
+		slabs.push_back(slab);
+		++stats.heapAllocations;
+
+		for (std::size_t offset = 0; offset + blockSize <= SlabSize; offset += blockSize) {
+			FreeBlock* block = reinterpret_cast<FreeBlock*>(slab + offset);
+			block->next = freeLists[index];
+			freeLists[index] = block;
+		}
+	}
+
+	FreeBlock* block = freeLists[index];
+	freeLists[index] = block->next;
+	return block;
+}
+
+void LuaAllocator::ReleaseBlock(void* ptr, std::size_t size) {
+	if (!ptr) {
+		return;
+	}
+
+	std::size_t index = (size - 1) / Granularity;
+	if (index >= SizeClasses) {
+		std::free(ptr);
+		return;
+	}
+
+	FreeBlock* block = static_cast<FreeBlock*>(ptr);
+	block->next = freeLists[index];
+	freeLists[index] = block;
+}
@@ -0,0 +1,63 @@
+// Copyright 2022 Justus Zorn
+
+#ifndef Hazard_LuaAllocator_h
+#define Hazard_LuaAllocator_h
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <lua.hpp>
+
+namespace Hazard {
+	struct LuaMemoryStats {
+		std::uint64_t liveBytes = 0;
+		std::uint64_t peakBytes = 0;
+		std::uint64_t limit = 0;
+		std::uint64_t allocations = 0;
+		// Allocations that could not be served from a slab
+		std::uint64_t heapAllocations = 0;
+		// Allocations that were refused because of the memory limit
+		std::uint64_t failedAllocations = 0;
+	};
+
+	// Memory allocator for a single Lua state. Small objects are taken from
+	// slabs with a free list per size class, larger ones from the heap. Lua
+	// passes the size of a block when it is resized or freed, so blocks do not
+	// need a header. A limit of 0 means that the state may use any amount of
+	// memory.
+	class LuaAllocator {
+	public:
+		LuaAllocator(std::size_t limit = 0);
+		LuaAllocator(const LuaAllocator&) = delete;
+		~LuaAllocator();
+
+		LuaAllocator& operator=(const LuaAllocator&) = delete;
+
+		lua_State* NewState();
+
+		void SetLimit(std::size_t limit);
+		const LuaMemoryStats& GetStats() const;
+
+	private:
+		static constexpr std::size_t Granularity = 16;
+		static constexpr std::size_t SizeClasses = 16;
+
+		struct FreeBlock {
+			FreeBlock* next;
+		};
+
+		FreeBlock* freeLists[SizeClasses] = {};
+		std::vector<void*> slabs;
+
+		LuaMemoryStats stats;
+
+		static void* Allocate(void* ud, void* ptr, std::size_t osize, std::size_t nsize);
+		static int Panic(lua_State* L);
+
+		void* AllocateBlock(std::size_t size);
+		void ReleaseBlock(void* ptr, std::size_t size);
+	};
+}
+
+#endif
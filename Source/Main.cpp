@@ -1,31 +1,56 @@
 // Copyright 2022 Justus Zorn
 
 #include <atomic>
+#include <cctype>
+#include <csignal>
+#include <cstdlib>
+#include <ctime>
 #include <iostream>
+#include <limits>
 #include <thread>
 
 #include <enet.h>
 
-#include "Audio.h"
-#include "Client.h"
+#include "Bytecode.h"
+#include "Capture.h"
+#include "Clock.h"
 #include "Config.h"
+#include "Jobs.h"
+#include "Log.h"
+#include "Metrics.h"
+#include "Net.h"
+#include "Profiler.h"
+#include "Recording.h"
+#include "Rooms.h"
 #include "Scene.h"
+#include "Trace.h"
+
+#ifndef HAZARD_SERVER
+#include "Audio.h"
+#include "Client.h"
+#include "ClientMonitor.h"
 #include "Window.h"
+#endif
 
 using namespace Hazard;
 
 static std::atomic<bool> running = true;
 static std::atomic<bool> shouldReload = false;
 
-void RunClient(const std::string& player, const std::string& address) {
-	Config config("config.lua");
-	Client client(player, address, config.Port());
-
+#ifndef HAZARD_SERVER
+void RunClient(Client& client, Config& config) {
 	Audio audio;
 	Window window(config.WindowTitle(), config.WindowWidth(), config.WindowHeight(), config.FontSize());
 
 	window.LoadTextures(config.GetTextures());
 	audio.LoadSounds(config.GetSounds());
+	SetTraceThreadName("Client");
+
+	ClientMonitor monitor;
+	if (config.ClientStatsLog()) {
+		monitor.OpenLog("client-stats-" + std::to_string(std::time(nullptr)) + ".csv");
+	}
+	bool showOverlay = false;
 	while (!window.ShouldClose()) {
 		if (window.Update()) {
 			shouldReload = true;
@@ -37,72 +62,198 @@ void RunClient(const std::string& player, const std::string& address) {
 			window.LoadTextures(config.GetTextures());
 			audio.LoadSounds(config.GetSounds());
 		}
+		if (window.ShouldToggleProfiler()) {
+			ToggleProfiler();
+		}
+		if (window.ShouldToggleTrace()) {
+			ToggleTrace();
+		}
+		if (window.ShouldToggleOverlay()) {
+			showOverlay = !showOverlay;
+		}
+		UpdateTrace();
 		if (!client.Update(window.GetInput())) {
 			break;
 		}
-		for (const Sprite& sprite : client.GetSprites()) {
-			window.DrawSprite(sprite);
+		const SpriteBuffer& sprites = client.GetSprites();
+		for (const Sprite& sprite : sprites.GetSprites()) {
+			window.DrawSprite(sprite, sprite.isText ? sprites.GetText(sprite) : nullptr);
 		}
 		for (const AudioCommand& audioCommand : client.GetAudioCommands()) {
 			audio.Run(audioCommand);
 		}
+		if (showOverlay) {
+			window.DrawOverlay(monitor.GetLines());
+		}
 		window.Present();
+		monitor.AddFrame(window.GetFrameStats(), client.GetStats(), GetTicks());
+	}
+}
+#endif
+
+// Returns false if 'value' is not a room number
+bool ParseRoom(const char* value, std::uint32_t& room) {
+	if (!std::isdigit(static_cast<unsigned char>(value[0]))) {
+		return false;
+	}
+	char* end;
+	unsigned long long parsed = std::strtoull(value, &end, 10);
+	if (*end != '\0' || parsed > std::numeric_limits<std::uint32_t>::max()) {
+		return false;
+	}
+	room = static_cast<std::uint32_t>(parsed);
+	return true;
+}
+
+void StartCapture(const char* side) {
+	std::string path = std::string("capture-") + side + '-' + std::to_string(std::time(nullptr)) + ".hzw";
+	if (GetCapture().Open(path)) {
+		std::cout << "Capturing packets to " << path << std::endl;
 	}
 }
 
-void RunServer() {
+void RunServer(LocalLink* link) {
+#ifndef _WIN32
+	// Profiling and tracing of dedicated servers are toggled with SIGUSR1 and
+	// SIGUSR2
+	std::signal(SIGUSR1, [](int) { ToggleProfiler(); });
+	std::signal(SIGUSR2, [](int) { ToggleTrace(); });
+#endif
+
 	Config config("config.lua");
-	Scene scene("main.lua", config);
-	while (running) {
-		if (shouldReload) {
-			scene.Reload();
-			shouldReload = false;
-		}
+	GetJobPool().Start(config.JobWorkers(), config.ScriptMemoryLimit() * 1024ull);
+	// The local player of integrated mode does not send any packets
+	if (config.Capture() && !link) {
+		StartCapture("server");
+	}
+	if (config.MetricsPort() > 0) {
+		GetMetrics().Start(config.MetricsPort(), config.Rooms());
+	}
+	if (config.Rooms() > 1) {
+		// Packets are created and destroyed on the network thread and on the
+		// room threads, so every thread keeps its own blocks
+		GetENetPool().SetThreadCaches(true);
 
-		std::uint64_t start = SDL_GetTicks64();
-		scene.Update();
-		std::uint64_t ticks = SDL_GetTicks64() - start;
-		if (ticks < 16) {
-			SDL_Delay(static_cast<std::uint32_t>(16 - ticks));
+		Rooms rooms(config, link);
+		rooms.Run(running, shouldReload);
+	}
+	else {
+		Scene scene("main.lua", config);
+		if (link) {
+			scene.AddLocalPlayer(*link);
 		}
+		scene.Run(running, shouldReload);
+	}
+	GetMetrics().Stop();
+	GetCapture().Close();
+	GetJobPool().Stop();
+}
+
+int RunReplay(const char* path) {
+	Config config("config.lua");
+	Replayer replayer;
+	if (!replayer.Open(path)) {
+		return 1;
 	}
+	GetJobPool().Start(config.JobWorkers(), config.ScriptMemoryLimit() * 1024ull);
+	// The script is loaded at the time the recording started
+	FreezeClock(replayer.GetStartTime() * 1000);
+	{
+		Scene scene("main.lua", config, replayer);
+		scene.RunReplay();
+	}
+	GetJobPool().Stop();
+	return 0;
 }
 
 int main(int argc, char* argv[]) {
-	if (enet_initialize() < 0) {
-		std::cerr << "ERROR: Could not initialize ENet\n";
+	GetLogger().Start();
+	if (InitializeENet() < 0) {
+		HAZARD_ERROR("Could not initialize ENet");
+		GetLogger().Stop();
 		return 1;
 	}
 
+	int result = 0;
 	try {
+#ifdef HAZARD_SERVER
+		if (argc == 1 || std::string(argv[1]) == "--server") {
+			RunServer(nullptr);
+		}
+		else if (std::string(argv[1]) == "--precompile") {
+			result = Precompile() == 0 ? 0 : 1;
+		}
+		else if (std::string(argv[1]) == "--replay") {
+			if (argc < 3) {
+				HAZARD_ERROR("Missing command line arguments");
+			}
+			else {
+				result = RunReplay(argv[2]);
+			}
+		}
+		else {
+			HAZARD_ERROR("Unknown command line option '" << argv[1]);
+		}
+#else
 		if (argc == 1) {
-			std::thread server(RunServer);
+			// The local player is connected directly to the server thread
+			LocalLink link;
+			link.playerName = "local";
+			std::thread server(RunServer, &link);
 
-			RunClient("local", "localhost");
+			{
+				Config config("config.lua");
+				Client client(link);
+				RunClient(client, config);
+			}
 
 			running = false;
 			server.join();
 		}
 		else {
 			if (std::string(argv[1]) == "--connect") {
+				std::uint32_t room = 0;
 				if (argc < 4) {
-					std::cerr << "ERROR: Missing command line arguments\n";
+					HAZARD_ERROR("Missing command line arguments");
+				}
+				else if (argc >= 5 && !ParseRoom(argv[4], room)) {
+					HAZARD_ERROR("Invalid room '" << argv[4] << "'");
+					result = 1;
 				}
 				else {
-					RunClient(argv[3], argv[2]);
+					Config config("config.lua");
+					if (config.Capture()) {
+						StartCapture("client");
+					}
+					Client client(argv[3], argv[2], config.Port(), room);
+					RunClient(client, config);
+					GetCapture().Close();
 				}
 			}
 			else if (std::string(argv[1]) == "--server") {
-				RunServer();
+				RunServer(nullptr);
+			}
+			else if (std::string(argv[1]) == "--precompile") {
+				result = Precompile() == 0 ? 0 : 1;
+			}
+			else if (std::string(argv[1]) == "--replay") {
+				if (argc < 3) {
+					HAZARD_ERROR("Missing command line arguments");
+				}
+				else {
+					result = RunReplay(argv[2]);
+				}
 			}
 			else {
-				std::cerr << "ERROR: Unknown command line option '" << argv[1] << '\n';
+				HAZARD_ERROR("Unknown command line option '" << argv[1]);
 			}
 		}
+#endif
 	}
 	catch (...) {}
 	
 	enet_deinitialize();
+	GetLogger().Stop();
 
-	return 0;
+	return result;
 }
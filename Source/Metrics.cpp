@@ -0,0 +1,260 @@
+// Copyright 2022 Justus Zorn
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+
+#include "Jobs.h"
+#include "Log.h"
+#include "Metrics.h"
+#include "Net.h"
+
+using namespace Hazard;
+
+namespace {
+	struct MetricFamily {
+		const char* name;
+		const char* type;
+		const char* help;
+	};
+
+	const MetricFamily families[] = {
+		{ "hazard_allocated_bytes_total", "counter", "Bytes allocated by the thread of a room, by subsystem and allocator." },
+		{ "hazard_allocations_total", "counter", "Allocations of the thread of a room, by subsystem and allocator." },
+		{ "hazard_enet_allocations_total", "counter", "Allocations of ENet." },
+		{ "hazard_enet_heap_allocations_total", "counter", "Allocations of ENet that were not served from a free list." },
+		{ "hazard_enet_live_bytes", "gauge", "Memory allocated by ENet." },
+		{ "hazard_jobs_completed_total", "counter", "Jobs that were completed." },
+		{ "hazard_jobs_failed_total", "counter", "Jobs that failed." },
+		{ "hazard_jobs_queued", "gauge", "Jobs that wait for a worker." },
+		{ "hazard_jobs_submitted_total", "counter", "Jobs that were submitted." },
+		{ "hazard_lua_allocations_total", "counter", "Allocations of the Lua state of a room." },
+		{ "hazard_lua_memory_bytes", "gauge", "Memory used by the Lua state of a room." },
+		{ "hazard_lua_seconds_total", "counter", "Time spent running Lua callbacks." },
+		{ "hazard_packet_loss_ratio", "gauge", "Packet loss of a player, as estimated by ENet." },
+		{ "hazard_players", "gauge", "Players in a room." },
+		{ "hazard_rtt_seconds", "gauge", "Round trip time of a player." },
+		{ "hazard_sent_bytes_total", "counter", "Bytes sent to a player, by channel." },
+		{ "hazard_sprites_total", "counter", "Sprites sent to players." },
+		{ "hazard_tick_seconds", "summary", "Duration of the ticks of a room. Quantiles cover the last second." },
+		{ "hazard_ticks_total", "counter", "Ticks of a room." }
+	};
+
+	// Custom gauges of the scripts
+	const MetricFamily scriptFamily = { nullptr, "gauge", "Set by main.lua." };
+	const char scriptPrefix[] = "hazard_script_";
+
+	// Requests are only read up to the first line, longer requests are cut off
+	constexpr std::size_t MaxRequest = 4096;
+}
+
+static MetricsServer metricsServer;
+
+static const MetricFamily* FindFamily(const std::string& name) {
+	for (const MetricFamily& family : families) {
+		if (name == family.name) {
+			return &family;
+		}
+	}
+	// The sum and count of a summary belong to its family
+	for (const char* suffix : { "_sum", "_count" }) {
+		std::size_t length = std::strlen(suffix);
+		if (name.size() > length && name.compare(name.size() - length, length, suffix) == 0) {
+			const MetricFamily* family = FindFamily(name.substr(0, name.size() - length));
+			if (family && std::strcmp(family->type, "summary") == 0) {
+				return family;
+			}
+		}
+	}
+	return nullptr;
+}
+
+static std::string GetFamilyName(const std::string& name, const MetricFamily* family) {
+	return family && family->name ? family->name : name;
+}
+
+std::string Hazard::MetricLabel(const char* name, const std::string& value) {
+	std::string label = name;
+	label += "=\"";
+	for (char c : value) {
+		if (c == '\\' || c == '"') {
+			label += '\\';
+			label += c;
+		}
+		else if (c == '\n') {
+			label += "\\n";
+		}
+		else {
+			label += c;
+		}
+	}
+	label += '"';
+	return label;
+}
+
+MetricsServer::~MetricsServer() {
+	Stop();
+}
+
+bool MetricsServer::Start(std::uint16_t port, std::uint32_t rooms) {
+	this->rooms.clear();
+	for (std::uint32_t i = 0; i < rooms; ++i) {
+		this->rooms.push_back(std::make_unique<TripleBuffer<std::vector<MetricSample>>>());
+	}
+
+	ENetAddress address = { 0 };
+	enet_address_set_host_ip(&address, "127.0.0.1");
+	address.port = port;
+
+	socket = enet_socket_create(ENET_SOCKET_TYPE_STREAM);
+	if (socket == ENET_SOCKET_NULL) {
+		HAZARD_ERROR("Could not create metrics socket");
+		return false;
+	}
+	enet_socket_set_option(socket, ENET_SOCKOPT_IPV6_V6ONLY, 0);
+	enet_socket_set_option(socket, ENET_SOCKOPT_REUSEADDR, 1);
+	if (enet_socket_bind(socket, &address) < 0 || enet_socket_listen(socket, 4) < 0) {
+		HAZARD_ERROR("Could not listen for metrics requests on port " << port);
+		enet_socket_destroy(socket);
+		socket = ENET_SOCKET_NULL;
+		return false;
+	}
+
+	running = true;
+	thread = std::thread(&MetricsServer::Serve, this);
+	return true;
+}
+
+void MetricsServer::Stop() {
+	if (!running) {
+		return;
+	}
+	running = false;
+	thread.join();
+	enet_socket_destroy(socket);
+	socket = ENET_SOCKET_NULL;
+}
+
+bool MetricsServer::IsRunning() const {
+	return running;
+}
+
+std::vector<MetricSample>& MetricsServer::GetBack(std::uint32_t room) {
+	return rooms[room]->Back();
+}
+
+void MetricsServer::Publish(std::uint32_t room) {
+	rooms[room]->Publish();
+}
+
+void MetricsServer::Serve() {
+	while (running) {
+		// Stop() is noticed within the timeout
+		enet_uint32 condition = ENET_SOCKET_WAIT_RECEIVE;
+		if (enet_socket_wait(socket, &condition, 100) < 0 || !(condition & ENET_SOCKET_WAIT_RECEIVE)) {
+			continue;
+		}
+		ENetSocket client = enet_socket_accept(socket, nullptr);
+		if (client == ENET_SOCKET_NULL) {
+			continue;
+		}
+		enet_socket_set_option(client, ENET_SOCKOPT_RCVTIMEO, 1000);
+		enet_socket_set_option(client, ENET_SOCKOPT_SNDTIMEO, 1000);
+		Respond(client);
+		enet_socket_shutdown(client, ENET_SOCKET_SHUTDOWN_READ_WRITE);
+		enet_socket_destroy(client);
+	}
+}
+
+void MetricsServer::Respond(ENetSocket client) {
+	std::string request;
+	char data[512];
+	while (request.find("\r\n") == std::string::npos && request.size() < MaxRequest) {
+		ENetBuffer buffer;
+		buffer.data = data;
+		buffer.dataLength = sizeof(data);
+		int length = enet_socket_receive(client, nullptr, &buffer, 1);
+		if (length <= 0) {
+			return;
+		}
+		request.append(data, length);
+	}
+
+	std::string response;
+	if (request.compare(0, 13, "GET /metrics ") == 0) {
+		std::string body = Format();
+		response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+	}
+	else {
+		response = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+	}
+
+	std::size_t sent = 0;
+	while (sent < response.size()) {
+		ENetBuffer buffer;
+		buffer.data = &response[sent];
+		buffer.dataLength = response.size() - sent;
+		int length = enet_socket_send(client, nullptr, &buffer, 1);
+		if (length <= 0) {
+			return;
+		}
+		sent += length;
+	}
+}
+
+std::string MetricsServer::Format() {
+	std::vector<MetricSample> global;
+	JobStats jobStats = GetJobPool().GetStats();
+	global.push_back({ "hazard_jobs_submitted_total", "", static_cast<double>(jobStats.submitted) });
+	global.push_back({ "hazard_jobs_completed_total", "", static_cast<double>(jobStats.completed) });
+	global.push_back({ "hazard_jobs_failed_total", "", static_cast<double>(jobStats.failed) });
+	global.push_back({ "hazard_jobs_queued", "", static_cast<double>(jobStats.queued) });
+	PoolStats poolStats = GetENetPool().GetStats();
+	global.push_back({ "hazard_enet_allocations_total", "", static_cast<double>(poolStats.allocations) });
+	global.push_back({ "hazard_enet_heap_allocations_total", "", static_cast<double>(poolStats.heapAllocations) });
+	global.push_back({ "hazard_enet_live_bytes", "", static_cast<double>(poolStats.liveBytes) });
+
+	// Samples of the same family must be written together, so the samples of
+	// all rooms are sorted by name
+	std::vector<const MetricSample*> samples;
+	for (const MetricSample& sample : global) {
+		samples.push_back(&sample);
+	}
+	for (auto& room : rooms) {
+		room->Update();
+		for (const MetricSample& sample : room->Front()) {
+			samples.push_back(&sample);
+		}
+	}
+	std::stable_sort(samples.begin(), samples.end(), [](const MetricSample* a, const MetricSample* b) {
+		return a->name < b->name;
+	});
+
+	std::ostringstream body;
+	body.precision(15);
+	std::string lastFamily;
+	for (const MetricSample* sample : samples) {
+		const MetricFamily* family = FindFamily(sample->name);
+		if (!family && sample->name.compare(0, sizeof(scriptPrefix) - 1, scriptPrefix) == 0) {
+			family = &scriptFamily;
+		}
+		std::string familyName = GetFamilyName(sample->name, family);
+		if (familyName != lastFamily) {
+			lastFamily = familyName;
+			if (family) {
+				body << "# HELP " << familyName << ' ' << family->help << '\n';
+				body << "# TYPE " << familyName << ' ' << family->type << '\n';
+			}
+		}
+		body << sample->name;
+		if (!sample->labels.empty()) {
+			body << '{' << sample->labels << '}';
+		}
+		body << ' ' << sample->value << '\n';
+	}
+	return body.str();
+}
+
+MetricsServer& Hazard::GetMetrics() {
+	return metricsServer;
+}
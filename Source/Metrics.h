@@ -0,0 +1,63 @@
+// Copyright 2022 Justus Zorn
+
+#ifndef Hazard_Metrics_h
+#define Hazard_Metrics_h
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <enet.h>
+
+#include "TripleBuffer.h"
+
+namespace Hazard {
+	// One value of a metric. 'labels' is empty or in the form 'a="x",b="y"'.
+	struct MetricSample {
+		std::string name;
+		std::string labels;
+		double value;
+	};
+
+	// Returns 'name="value"', with 'value' escaped for the text format
+	std::string MetricLabel(const char* name, const std::string& value);
+
+	// Serves the metrics of all rooms in the Prometheus text format over HTTP,
+	// on a port that only accepts connections from the same machine. Every
+	// room publishes its samples through its own triple buffer, so the rooms
+	// never wait for a request.
+	class MetricsServer {
+	public:
+		MetricsServer() = default;
+		MetricsServer(const MetricsServer&) = delete;
+		~MetricsServer();
+
+		MetricsServer& operator=(const MetricsServer&) = delete;
+
+		// Must be called before the rooms start
+		bool Start(std::uint16_t port, std::uint32_t rooms);
+		void Stop();
+		bool IsRunning() const;
+
+		// Room thread. The back buffer still contains older samples.
+		std::vector<MetricSample>& GetBack(std::uint32_t room);
+		void Publish(std::uint32_t room);
+
+	private:
+		ENetSocket socket = ENET_SOCKET_NULL;
+		std::thread thread;
+		std::atomic<bool> running = false;
+		std::vector<std::unique_ptr<TripleBuffer<std::vector<MetricSample>>>> rooms;
+
+		void Serve();
+		void Respond(ENetSocket client);
+		std::string Format();
+	};
+
+	MetricsServer& GetMetrics();
+}
+
+#endif
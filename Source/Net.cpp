@@ -1,14 +1,46 @@
 // Copyright 2022 Justus Zorn
 
 #include <cstring>
-#include <iostream>
-
-#include <SDL.h>
 
+#include "Allocations.h"
+#include "Log.h"
 #include "Net.h"
 
 using namespace Hazard;
 
+static Pool enetPool;
+
+static void* ENetAllocate(size_t size) {
+	CountAllocation(Allocator::ENet, size);
+	return enetPool.Allocate(size);
+}
+
+static void ENetFree(void* memory) {
+	if (memory) {
+		CountFree(Allocator::ENet);
+	}
+	enetPool.Free(memory);
+}
+
+PeerStats Hazard::GetPeerStats(ENetPeer* peer) {
+	return { peer->roundTripTime, peer->packetLoss, peer->packetThrottle };
+}
+
+int Hazard::InitializeENet() {
+	ENetCallbacks callbacks = {};
+	callbacks.malloc = ENetAllocate;
+	callbacks.free = ENetFree;
+	return enet_initialize_with_callbacks(ENET_VERSION, &callbacks);
+}
+
+Pool& Hazard::GetENetPool() {
+	return enetPool;
+}
+
+WritePacket::WritePacket(Arena* arena, std::size_t capacity) : data(ArenaAllocator<std::uint8_t>(arena)) {
+	data.reserve(capacity);
+}
+
 void WritePacket::Write8(std::uint8_t value) {
 	data.push_back(value);
 }
@@ -16,21 +48,29 @@ void WritePacket::Write8(std::uint8_t value) {
 void WritePacket::Write16(std::uint16_t value) {
 	std::uint32_t start = static_cast<std::uint32_t>(data.size());
 	data.resize(start + 2);
-	*reinterpret_cast<std::uint16_t*>(&data[start]) = SDL_SwapBE16(value);
+	data[start] = static_cast<std::uint8_t>(value >> 8);
+	data[start + 1] = static_cast<std::uint8_t>(value);
 }
 
 void WritePacket::Write32(std::uint32_t value) {
 	std::uint32_t start = static_cast<std::uint32_t>(data.size());
 	data.resize(start + 4);
-	*reinterpret_cast<std::uint32_t*>(&data[start]) = SDL_SwapBE32(value);
+	data[start] = static_cast<std::uint8_t>(value >> 24);
+	data[start + 1] = static_cast<std::uint8_t>(value >> 16);
+	data[start + 2] = static_cast<std::uint8_t>(value >> 8);
+	data[start + 3] = static_cast<std::uint8_t>(value);
 }
 
 void WritePacket::WriteString(const std::string& value) {
-	Write32(static_cast<std::uint32_t>(value.length()));
-	if (value.length() > 0) {
+	WriteString(value.data(), static_cast<std::uint32_t>(value.length()));
+}
+
+void WritePacket::WriteString(const char* value, std::uint32_t length) {
+	Write32(length);
+	if (length > 0) {
 		std::uint32_t start = static_cast<std::uint32_t>(data.size());
-		data.resize(start + value.length());
-		std::memcpy(&data[start], value.data(), value.length());
+		data.resize(start + length);
+		std::memcpy(&data[start], value, length);
 	}
 }
 
@@ -40,53 +80,111 @@ ENetPacket* WritePacket::GetPacket(bool reliable) {
 
 ReadPacket::ReadPacket(ENetPacket* packet) : data{ packet->data }, dataLength{ static_cast<std::uint32_t>(packet->dataLength) } {}
 
+ReadPacket::ReadPacket(const std::uint8_t* data, std::uint32_t length) : data{ data }, dataLength{ length } {}
+
 std::uint8_t ReadPacket::Read8() {
 	if (index < dataLength) {
 		return data[index++];
 	}
 	else {
-		std::cerr << "ERROR: Detected invalid packet\n";
+		HAZARD_WARNING("Detected invalid packet");
 		return 0;
 	}
 }
 
 std::uint16_t ReadPacket::Read16() {
 	if (sizeof(std::uint16_t) <= dataLength && index <= dataLength - sizeof(std::uint16_t)) {
-		std::uint16_t value = SDL_SwapBE16(*reinterpret_cast<const std::uint16_t*>(data + index));
+		std::uint16_t value = (data[index] << 8) | data[index + 1];
 		index += sizeof(std::uint16_t);
 		return value;
 	}
 	else {
-		std::cerr << "ERROR: Detected invalid packet\n";
+		HAZARD_WARNING("Detected invalid packet");
 		return 0;
 	}
 }
 
 std::uint32_t ReadPacket::Read32() {
 	if (sizeof(std::uint32_t) <= dataLength && index <= dataLength - sizeof(std::uint32_t)) {
-		std::uint32_t value = SDL_SwapBE32(*reinterpret_cast<const std::uint32_t*>(data + index));
+		std::uint32_t value = (static_cast<std::uint32_t>(data[index]) << 24) | (data[index + 1] << 16) | (data[index + 2] << 8) | data[index + 3];
 		index += sizeof(std::uint32_t);
 		return value;
 	}
 	else {
-		std::cerr << "ERROR: Detected invalid packet\n";
+		HAZARD_WARNING("Detected invalid packet");
 		return 0;
 	}
 }
 
 std::string ReadPacket::ReadString() {
-	std::uint32_t stringLength = Read32();
-	if (stringLength > 0) {
-		if (stringLength <= dataLength && index <= dataLength - stringLength) {
-			std::string value;
-			value.resize(stringLength);
-			std::memcpy(&value[0], data + index, stringLength);
-			index += stringLength;
+	std::uint32_t stringLength;
+	const char* value = ReadString(stringLength);
+	return std::string(value, stringLength);
+}
+
+const char* ReadPacket::ReadString(std::uint32_t& length) {
+	length = Read32();
+	if (length > 0) {
+		if (length <= dataLength && index <= dataLength - length) {
+			const char* value = reinterpret_cast<const char*>(data + index);
+			index += length;
 			return value;
 		}
 		else {
-			std::cerr << "ERROR: Detected invalid packet\n";
+			HAZARD_WARNING("Detected invalid packet");
+			length = 0;
 		}
 	}
 	return "";
 }
+
+std::uint32_t ReadPacket::Remaining() const {
+	return dataLength - index;
+}
+
+void Hazard::WriteSnapshot(WritePacket& packet, const SpriteBuffer& sprites) {
+	packet.Write32(static_cast<std::uint32_t>(sprites.GetSprites().size()));
+	for (const Sprite& sprite : sprites.GetSprites()) {
+		packet.Write32(sprite.x);
+		packet.Write32(sprite.y);
+		packet.Write32(sprite.scale);
+		if (sprite.isText) {
+			packet.Write8(1);
+			packet.Write8(sprite.r);
+			packet.Write8(sprite.g);
+			packet.Write8(sprite.b);
+			packet.WriteString(sprites.GetText(sprite), sprite.textLength);
+		}
+		else {
+			packet.Write8(0);
+			packet.Write32(sprite.texture);
+			packet.Write32(sprite.animation);
+		}
+	}
+}
+
+void Hazard::ReadSnapshot(ReadPacket& packet, SpriteBuffer& sprites) {
+	std::uint32_t spriteCount = packet.Read32();
+	sprites.Clear();
+	for (std::uint32_t i = 0; i < spriteCount; ++i) {
+		std::int32_t x = packet.Read32();
+		std::int32_t y = packet.Read32();
+		std::uint32_t scale = packet.Read32();
+
+		if (packet.Read8()) {
+			// Text
+			std::uint8_t r = packet.Read8();
+			std::uint8_t g = packet.Read8();
+			std::uint8_t b = packet.Read8();
+			std::uint32_t length;
+			const char* text = packet.ReadString(length);
+			sprites.AddTextSprite(x, y, scale, r, g, b, text, length);
+		}
+		else {
+			// Sprite
+			std::uint32_t texture = packet.Read32();
+			std::uint32_t animation = packet.Read32();
+			sprites.AddSprite(x, y, scale, texture, animation);
+		}
+	}
+}
@@ -9,34 +9,65 @@
 
 #include <enet.h>
 
+#include "Arena.h"
+#include "Common.h"
+#include "Pool.h"
+
 namespace Hazard {
+	struct PeerStats {
+		std::uint32_t roundTripTime;
+		std::uint32_t packetLoss;
+		std::uint32_t packetThrottle;
+	};
+
+	PeerStats GetPeerStats(ENetPeer* peer);
+
+	// Initializes ENet with a pool for all of its allocations
+	int InitializeENet();
+	Pool& GetENetPool();
+
 	class WritePacket {
 	public:
+		// The packet data is allocated from the arena if one is given
+		WritePacket(Arena* arena = nullptr, std::size_t capacity = 0);
+
 		void Write8(std::uint8_t value);
 		void Write16(std::uint16_t value);
 		void Write32(std::uint32_t value);
 		void WriteString(const std::string& value);
+		void WriteString(const char* value, std::uint32_t length);
 
 		ENetPacket* GetPacket(bool reliable);
 
 	private:
-		std::vector<std::uint8_t> data;
+		ArenaVector<std::uint8_t> data;
 	};
 
 	class ReadPacket {
 	public:
 		ReadPacket(ENetPacket* packet);
+		ReadPacket(const std::uint8_t* data, std::uint32_t length);
 
 		std::uint8_t Read8();
 		std::uint16_t Read16();
 		std::uint32_t Read32();
 		std::string ReadString();
+		// Returns a pointer into the packet that is not null-terminated
+		const char* ReadString(std::uint32_t& length);
+
+		std::uint32_t Remaining() const;
 
 	private:
 		const std::uint8_t* data;
 		std::uint32_t index = 0;
 		std::uint32_t dataLength;
 	};
+
+	// Snapshots (channel 1) contain the number of sprites, followed by all
+	// sprites of the frame
+	void WriteSnapshot(WritePacket& packet, const SpriteBuffer& sprites);
+	// Replaces the sprites in 'sprites'
+	void ReadSnapshot(ReadPacket& packet, SpriteBuffer& sprites);
 }
 
 #endif
@@ -0,0 +1,353 @@
+// Copyright 2022 Justus Zorn
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+#include "Clock.h"
+#include "Log.h"
+#include "Plugins.h"
+#include "Scene.h"
+
+#if defined(_WIN32)
+#define HAZARD_PLUGIN_SUFFIX ".dll"
+#elif defined(__APPLE__)
+#define HAZARD_PLUGIN_SUFFIX ".dylib"
+#else
+#define HAZARD_PLUGIN_SUFFIX ".so"
+#endif
+
+using namespace Hazard;
+
+static void* OpenLibrary(const std::string& path) {
+#ifdef _WIN32
+	return LoadLibraryA(path.c_str());
+#else
+	return dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+#endif
+}
+
+static void* GetSymbol(void* library, const char* name) {
+#ifdef _WIN32
+	return reinterpret_cast<void*>(GetProcAddress(static_cast<HMODULE>(library), name));
+#else
+	return dlsym(library, name);
+#endif
+}
+
+static void CloseLibrary(void* library) {
+#ifdef _WIN32
+	FreeLibrary(static_cast<HMODULE>(library));
+#else
+	dlclose(library);
+#endif
+}
+
+static std::string GetLibraryError() {
+#ifdef _WIN32
+	return "error code " + std::to_string(GetLastError());
+#else
+	const char* error = dlerror();
+	return error ? error : "unknown error";
+#endif
+}
+
+Plugins::Plugins(Scene* scene, const Config& config) : scene{ scene }, api{} {
+	api.version = HAZARD_PLUGIN_VERSION;
+	api.context = reinterpret_cast<HazardContext*>(this);
+
+	api.get_ticks = GetTicks;
+	api.get_room = GetRoom;
+
+	api.get_players = GetPlayers;
+	api.is_online = IsOnline;
+	api.kick = Kick;
+	api.is_idle = IsIdle;
+
+	api.is_key_down = IsKeyDown;
+	api.is_button_down = IsButtonDown;
+	api.get_axis = GetAxis;
+	api.get_composition = GetComposition;
+	api.set_composition = SetComposition;
+
+	api.draw_sprite = DrawSprite;
+	api.draw_text = DrawTextSprite;
+
+	api.play_sound = Play;
+	api.stop_sound = Stop;
+	api.stop_all_sounds = StopAll;
+
+	api.register_function = RegisterFunction;
+
+	for (const std::string& name : config.GetPlugins()) {
+		Load(name);
+	}
+}
+
+Plugins::~Plugins() {
+	for (auto it = plugins.rbegin(); it != plugins.rend(); ++it) {
+		if (it->callbacks.on_unload) {
+			it->callbacks.on_unload(it->callbacks.data);
+		}
+		CloseLibrary(it->library);
+	}
+}
+
+void Plugins::Load(const std::string& name) {
+	// The path must contain a slash, otherwise the system search path is used
+	std::string path = "./" + name + HAZARD_PLUGIN_SUFFIX;
+	void* library = OpenLibrary(path);
+	if (!library) {
+		HAZARD_ERROR("Could not load plugin " << name << ": " << GetLibraryError());
+		return;
+	}
+
+	HazardPluginLoad load = reinterpret_cast<HazardPluginLoad>(GetSymbol(library, HAZARD_PLUGIN_LOAD));
+	if (!load) {
+		HAZARD_ERROR("Plugin " << name << " does not export " << HAZARD_PLUGIN_LOAD);
+		CloseLibrary(library);
+		return;
+	}
+
+	Plugin plugin;
+	plugin.name = name;
+	plugin.library = library;
+	plugin.callbacks = {};
+	if (load(&api, &plugin.callbacks) != 0) {
+		HAZARD_ERROR("Plugin " << name << " could not be loaded");
+		CloseLibrary(library);
+		return;
+	}
+	plugins.push_back(plugin);
+}
+
+void Plugins::RegisterFunctions(lua_State* L) {
+	for (const Function& function : functions) {
+		lua_pushlightuserdata(L, function.data);
+		lua_pushcclosure(L, function.function, 1);
+		lua_setglobal(L, function.name.c_str());
+	}
+}
+
+void Plugins::OnTick(double dt) {
+	for (const Plugin& plugin : plugins) {
+		if (plugin.callbacks.on_tick) {
+			plugin.callbacks.on_tick(plugin.callbacks.data, dt);
+		}
+	}
+}
+
+bool Plugins::OnLogin(const std::string& playerName) {
+	for (const Plugin& plugin : plugins) {
+		if (plugin.callbacks.on_login && !plugin.callbacks.on_login(plugin.callbacks.data, playerName.c_str())) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void Plugins::OnJoin(const std::string& playerName) {
+	for (const Plugin& plugin : plugins) {
+		if (plugin.callbacks.on_join) {
+			plugin.callbacks.on_join(plugin.callbacks.data, playerName.c_str());
+		}
+	}
+}
+
+void Plugins::OnDisconnect(const std::string& playerName) {
+	for (const Plugin& plugin : plugins) {
+		if (plugin.callbacks.on_disconnect) {
+			plugin.callbacks.on_disconnect(plugin.callbacks.data, playerName.c_str());
+		}
+	}
+}
+
+void Plugins::OnKeyEvent(const std::string& playerName, const std::string& key, bool pressed) {
+	for (const Plugin& plugin : plugins) {
+		if (plugin.callbacks.on_key_event) {
+			plugin.callbacks.on_key_event(plugin.callbacks.data, playerName.c_str(), key.c_str(), pressed);
+		}
+	}
+}
+
+void Plugins::OnButtonEvent(const std::string& playerName, const std::string& button, bool pressed) {
+	for (const Plugin& plugin : plugins) {
+		if (plugin.callbacks.on_button_event) {
+			plugin.callbacks.on_button_event(plugin.callbacks.data, playerName.c_str(), button.c_str(), pressed);
+		}
+	}
+}
+
+void Plugins::OnAxisEvent(const std::string& playerName, const std::string& axis, std::int32_t state) {
+	for (const Plugin& plugin : plugins) {
+		if (plugin.callbacks.on_axis_event) {
+			plugin.callbacks.on_axis_event(plugin.callbacks.data, playerName.c_str(), axis.c_str(), state);
+		}
+	}
+}
+
+Scene* Plugins::GetScene(HazardContext* context) {
+	return reinterpret_cast<Plugins*>(context)->scene;
+}
+
+const std::string& Plugins::ToString(const char* value, int slot) {
+	// Like Script::CheckString, arguments are copied into reused buffers
+	static thread_local std::string arguments[3];
+
+	std::string& argument = arguments[slot];
+	argument.assign(value ? value : "");
+	return argument;
+}
+
+std::uint64_t Plugins::GetTicks() {
+	return Hazard::GetTicks();
+}
+
+std::uint32_t Plugins::GetRoom(HazardContext* context) {
+	return GetScene(context)->GetRoom();
+}
+
+std::uint32_t Plugins::GetPlayers(HazardContext* context, const char** players, std::uint32_t capacity) {
+	ArenaVector<std::string_view> list = GetScene(context)->GetPlayers();
+	for (std::uint32_t i = 0; i < capacity && i < list.size(); ++i) {
+		// The views point into the names of the players, which are terminated
+		players[i] = list[i].data();
+	}
+	return static_cast<std::uint32_t>(list.size());
+}
+
+int Plugins::IsOnline(HazardContext* context, const char* player) {
+	return GetScene(context)->IsOnline(ToString(player, 0));
+}
+
+int Plugins::Kick(HazardContext* context, const char* player) {
+	Scene* scene = GetScene(context);
+	const std::string& playerName = ToString(player, 0);
+	if (!scene->IsOnline(playerName)) {
+		return -1;
+	}
+	scene->Kick(playerName);
+	return 0;
+}
+
+int Plugins::IsIdle(HazardContext* context, const char* player) {
+	Scene* scene = GetScene(context);
+	const std::string& playerName = ToString(player, 0);
+	if (!scene->IsOnline(playerName)) {
+		return -1;
+	}
+	return scene->IsIdle(playerName);
+}
+
+int Plugins::IsKeyDown(HazardContext* context, const char* player, const char* key) {
+	Scene* scene = GetScene(context);
+	const std::string& playerName = ToString(player, 0);
+	if (!scene->IsOnline(playerName)) {
+		return -1;
+	}
+	return scene->IsKeyDown(playerName, ToString(key, 1));
+}
+
+int Plugins::IsButtonDown(HazardContext* context, const char* player, const char* button) {
+	Scene* scene = GetScene(context);
+	const std::string& playerName = ToString(player, 0);
+	if (!scene->IsOnline(playerName)) {
+		return -1;
+	}
+	return scene->IsButtonDown(playerName, ToString(button, 1));
+}
+
+std::int32_t Plugins::GetAxis(HazardContext* context, const char* player, const char* axis) {
+	Scene* scene = GetScene(context);
+	const std::string& playerName = ToString(player, 0);
+	if (!scene->IsOnline(playerName)) {
+		return 0;
+	}
+	return scene->GetAxis(playerName, ToString(axis, 1));
+}
+
+const char* Plugins::GetComposition(HazardContext* context, const char* player) {
+	Scene* scene = GetScene(context);
+	const std::string& playerName = ToString(player, 0);
+	if (!scene->IsOnline(playerName)) {
+		return "";
+	}
+	return scene->GetComposition(playerName).c_str();
+}
+
+int Plugins::SetComposition(HazardContext* context, const char* player, const char* composition) {
+	Scene* scene = GetScene(context);
+	const std::string& playerName = ToString(player, 0);
+	if (!scene->IsOnline(playerName)) {
+		return -1;
+	}
+	scene->SetComposition(playerName, ToString(composition, 1));
+	return 0;
+}
+
+int Plugins::DrawSprite(HazardContext* context, const char* player, const char* texture, std::int32_t x, std::int32_t y, std::uint32_t size, std::uint32_t animation) {
+	Scene* scene = GetScene(context);
+	const std::string& playerName = ToString(player, 0);
+	const std::string& textureName = ToString(texture, 1);
+	if (!scene->IsOnline(playerName) || !scene->IsTextureLoaded(textureName)) {
+		return -1;
+	}
+	scene->DrawSprite(playerName, textureName, x, y, size / 2, animation);
+	return 0;
+}
+
+int Plugins::DrawTextSprite(HazardContext* context, const char* player, const char* text, std::uint32_t length, std::int32_t x, std::int32_t y, std::uint8_t r, std::uint8_t g, std::uint8_t b, std::uint32_t lineLength) {
+	Scene* scene = GetScene(context);
+	const std::string& playerName = ToString(player, 0);
+	if (!scene->IsOnline(playerName)) {
+		return -1;
+	}
+	scene->DrawTextSprite(playerName, text, length, x, y, r, g, b, lineLength);
+	return 0;
+}
+
+int Plugins::Play(HazardContext* context, const char* player, const char* sound, std::uint8_t volume, std::int32_t channel) {
+	Scene* scene = GetScene(context);
+	const std::string& playerName = ToString(player, 0);
+	const std::string& soundName = ToString(sound, 1);
+	if (!scene->IsOnline(playerName) || !scene->IsSoundLoaded(soundName) || volume > 128) {
+		return -1;
+	}
+	if (channel < 0) {
+		scene->PlayAny(playerName, soundName, volume);
+	}
+	else if (channel <= 0xFFFF && scene->IsChannelValid(static_cast<std::uint16_t>(channel))) {
+		scene->Play(playerName, soundName, volume, static_cast<std::uint16_t>(channel));
+	}
+	else {
+		return -1;
+	}
+	return 0;
+}
+
+int Plugins::Stop(HazardContext* context, const char* player, std::uint16_t channel) {
+	Scene* scene = GetScene(context);
+	const std::string& playerName = ToString(player, 0);
+	if (!scene->IsOnline(playerName) || !scene->IsChannelValid(channel)) {
+		return -1;
+	}
+	scene->Stop(playerName, channel);
+	return 0;
+}
+
+int Plugins::StopAll(HazardContext* context, const char* player) {
+	Scene* scene = GetScene(context);
+	const std::string& playerName = ToString(player, 0);
+	if (!scene->IsOnline(playerName)) {
+		return -1;
+	}
+	scene->StopAll(playerName);
+	return 0;
+}
+
+void Plugins::RegisterFunction(HazardContext* context, const char* name, HazardLuaFunction function, void* data) {
+	Plugins* plugins = reinterpret_cast<Plugins*>(context);
+	plugins->functions.push_back({ name, function, data });
+}
@@ -0,0 +1,90 @@
+// Copyright 2022 Justus Zorn
+
+#ifndef Hazard_Plugins_h
+#define Hazard_Plugins_h
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <lua.hpp>
+
+#include "Config.h"
+#include "HazardPlugin.h"
+
+namespace Hazard {
+	class Scene;
+
+	// Native plugins of a room. The plugins listed in Config.plugins are
+	// loaded from the project directory when the room is created, and stay
+	// loaded until it is destroyed.
+	class Plugins {
+	public:
+		Plugins(Scene* scene, const Config& config);
+		Plugins(const Plugins&) = delete;
+		~Plugins();
+
+		Plugins& operator=(const Plugins&) = delete;
+
+		// Sets the Lua functions registered by plugins as globals
+		void RegisterFunctions(lua_State* L);
+
+		void OnTick(double dt);
+
+		bool OnLogin(const std::string& playerName);
+		void OnJoin(const std::string& playerName);
+		void OnDisconnect(const std::string& playerName);
+
+		void OnKeyEvent(const std::string& playerName, const std::string& key, bool pressed);
+		void OnButtonEvent(const std::string& playerName, const std::string& button, bool pressed);
+		void OnAxisEvent(const std::string& playerName, const std::string& axis, std::int32_t state);
+
+	private:
+		struct Plugin {
+			std::string name;
+			void* library;
+			HazardPlugin callbacks;
+		};
+
+		struct Function {
+			std::string name;
+			HazardLuaFunction function;
+			void* data;
+		};
+
+		Scene* scene;
+		HazardAPI api;
+		std::vector<Plugin> plugins;
+		std::vector<Function> functions;
+
+		void Load(const std::string& name);
+
+		static Scene* GetScene(HazardContext* context);
+		static const std::string& ToString(const char* value, int slot);
+
+		static std::uint64_t GetTicks();
+		static std::uint32_t GetRoom(HazardContext* context);
+
+		static std::uint32_t GetPlayers(HazardContext* context, const char** players, std::uint32_t capacity);
+		static int IsOnline(HazardContext* context, const char* player);
+		static int Kick(HazardContext* context, const char* player);
+		static int IsIdle(HazardContext* context, const char* player);
+
+		static int IsKeyDown(HazardContext* context, const char* player, const char* key);
+		static int IsButtonDown(HazardContext* context, const char* player, const char* button);
+		static std::int32_t GetAxis(HazardContext* context, const char* player, const char* axis);
+		static const char* GetComposition(HazardContext* context, const char* player);
+		static int SetComposition(HazardContext* context, const char* player, const char* composition);
+
+		static int DrawSprite(HazardContext* context, const char* player, const char* texture, std::int32_t x, std::int32_t y, std::uint32_t size, std::uint32_t animation);
+		static int DrawTextSprite(HazardContext* context, const char* player, const char* text, std::uint32_t length, std::int32_t x, std::int32_t y, std::uint8_t r, std::uint8_t g, std::uint8_t b, std::uint32_t lineLength);
+
+		static int Play(HazardContext* context, const char* player, const char* sound, std::uint8_t volume, std::int32_t channel);
+		static int Stop(HazardContext* context, const char* player, std::uint16_t channel);
+		static int StopAll(HazardContext* context, const char* player);
+
+		static void RegisterFunction(HazardContext* context, const char* name, HazardLuaFunction function, void* data);
+	};
+}
+
+#endif
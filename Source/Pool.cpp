@@ -0,0 +1,230 @@
+// Copyright 2022 Justus Zorn
+
+#include <cstdlib>
+
+#include "Pool.h"
+
+using namespace Hazard;
+
+namespace {
+	// Every block starts with a header that stores its size class and size
+	struct Header {
+		std::uint32_t sizeClass;
+		std::size_t size;
+	};
+
+	constexpr std::size_t HeaderSize = alignof(std::max_align_t);
+	static_assert(sizeof(Header) <= HeaderSize, "Pool header does not fit");
+
+	constexpr std::uint32_t LargeBlock = 0xFFFFFFFF;
+	constexpr std::size_t MinBlockSize = 32;
+	constexpr std::size_t ChunkSize = 64 * 1024;
+
+	// Number of blocks a thread cache keeps per size class and moves at once
+	constexpr std::size_t CacheSize = 32;
+	constexpr std::size_t CacheBatch = 16;
+}
+
+thread_local Pool::ThreadCache Pool::threadCache;
+
+Pool::ThreadCache::~ThreadCache() {
+	if (!pool) {
+		return;
+	}
+	for (std::uint32_t i = 0; i < SizeClasses; ++i) {
+		if (heads[i]) {
+			FreeBlock* tail = heads[i];
+			while (tail->next) {
+				tail = tail->next;
+			}
+			pool->ReturnBlocks(i, heads[i], tail);
+		}
+	}
+}
+
+Pool::Pool() {
+	std::size_t size = MinBlockSize;
+	for (SizeClass& sizeClass : sizeClasses) {
+		sizeClass.blockSize = size;
+		size *= 2;
+	}
+}
+
+Pool::~Pool() {
+	for (void* chunk : chunks) {
+		std::free(chunk);
+	}
+}
+
+void* Pool::Allocate(std::size_t size) {
+	allocations.fetch_add(1, std::memory_order_relaxed);
+
+	std::uint32_t index = 0;
+	while (index < SizeClasses && sizeClasses[index].blockSize < size) {
+		++index;
+	}
+
+	if (index == SizeClasses) {
+		Header* header = static_cast<Header*>(std::malloc(HeaderSize + size));
+		if (!header) {
+			return nullptr;
+		}
+		header->sizeClass = LargeBlock;
+		header->size = size;
+
+		heapAllocations.fetch_add(1, std::memory_order_relaxed);
+		largeAllocations.fetch_add(1, std::memory_order_relaxed);
+		AddLiveBytes(size);
+		return reinterpret_cast<std::uint8_t*>(header) + HeaderSize;
+	}
+
+	FreeBlock* block;
+	std::size_t taken;
+	ThreadCache* cache = GetThreadCache();
+	if (cache) {
+		if (!cache->heads[index]) {
+			cache->heads[index] = TakeBlocks(index, CacheBatch, taken);
+			cache->counts[index] = taken;
+		}
+		block = cache->heads[index];
+		if (block) {
+			cache->heads[index] = block->next;
+			--cache->counts[index];
+		}
+	}
+	else {
+		block = TakeBlocks(index, 1, taken);
+	}
+
+	if (!block) {
+		return nullptr;
+	}
+
+	Header* header = reinterpret_cast<Header*>(block);
+	header->sizeClass = index;
+	header->size = sizeClasses[index].blockSize;
+
+	AddLiveBytes(header->size);
+	return reinterpret_cast<std::uint8_t*>(header) + HeaderSize;
+}
+
+void Pool::Free(void* memory) {
+	if (!memory) {
+		return;
+	}
+
+	Header* header = reinterpret_cast<Header*>(static_cast<std::uint8_t*>(memory) - HeaderSize);
+	liveBytes.fetch_sub(header->size, std::memory_order_relaxed);
+
+	if (header->sizeClass == LargeBlock) {
+		std::free(header);
+		return;
+	}
+
+	std::uint32_t index = header->sizeClass;
+	FreeBlock* block = reinterpret_cast<FreeBlock*>(header);
+
+	ThreadCache* cache = GetThreadCache();
+	if (cache) {
+		block->next = cache->heads[index];
+		cache->heads[index] = block;
+		++cache->counts[index];
+
+		// Blocks are often freed by another thread than the one that allocated
+		// them, so full caches give blocks back to the shared free list
+		if (cache->counts[index] > CacheSize) {
+			FreeBlock* head = cache->heads[index];
+			FreeBlock* tail = head;
+			for (std::size_t i = 1; i < CacheBatch; ++i) {
+				tail = tail->next;
+			}
+			cache->heads[index] = tail->next;
+			cache->counts[index] -= CacheBatch;
+			ReturnBlocks(index, head, tail);
+		}
+	}
+	else {
+		ReturnBlocks(index, block, block);
+	}
+}
+
+void Pool::SetThreadCaches(bool enabled) {
+	threadCaches = enabled;
+}
+
+PoolStats Pool::GetStats() const {
+	PoolStats stats;
+	stats.allocations = allocations.load(std::memory_order_relaxed);
+	stats.heapAllocations = heapAllocations.load(std::memory_order_relaxed);
+	stats.largeAllocations = largeAllocations.load(std::memory_order_relaxed);
+	stats.liveBytes = liveBytes.load(std::memory_order_relaxed);
+	stats.highWaterBytes = highWaterBytes.load(std::memory_order_relaxed);
+	return stats;
+}
+
+Pool::ThreadCache* Pool::GetThreadCache() {
+	if (!threadCaches.load(std::memory_order_relaxed)) {
+		return nullptr;
+	}
+
+	// A thread only caches blocks for the first pool it uses
+	ThreadCache& cache = threadCache;
+	if (!cache.pool) {
+		cache.pool = this;
+	}
+	return cache.pool == this ? &cache : nullptr;
+}
+
+Pool::FreeBlock* Pool::TakeBlocks(std::uint32_t index, std::size_t count, std::size_t& taken) {
+	SizeClass& sizeClass = sizeClasses[index];
+	std::lock_guard<std::mutex> lock(sizeClass.mutex);
+
+	if (!sizeClass.head) {
+		std::size_t blockSize = HeaderSize + sizeClass.blockSize;
+		std::size_t blockCount = ChunkSize / blockSize;
+		if (blockCount < 8) {
+			blockCount = 8;
+		}
+
+		std::uint8_t* chunk = static_cast<std::uint8_t*>(std::malloc(blockCount * blockSize));
+		if (!chunk) {
+			taken = 0;
+			return nullptr;
+		}
+		{
+			std::lock_guard<std::mutex> chunkLock(chunkMutex);
+			chunks.push_back(chunk);
+		}
+
+		for (std::size_t i = 0; i < blockCount; ++i) {
+			FreeBlock* block = reinterpret_cast<FreeBlock*>(chunk + i * blockSize);
+			block->next = sizeClass.head;
+			sizeClass.head = block;
+		}
+		heapAllocations.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	FreeBlock* head = sizeClass.head;
+	FreeBlock* tail = head;
+	taken = 1;
+	while (taken < count && tail->next) {
+		tail = tail->next;
+		++taken;
+	}
+	sizeClass.head = tail->next;
+	tail->next = nullptr;
+	return head;
+}
+
+void Pool::ReturnBlocks(std::uint32_t index, FreeBlock* head, FreeBlock* tail) {
+	SizeClass& sizeClass = sizeClasses[index];
+	std::lock_guard<std::mutex> lock(sizeClass.mutex);
+	tail->next = sizeClass.head;
+	sizeClass.head = head;
+}
+
+void Pool::AddLiveBytes(std::uint64_t bytes) {
+	std::uint64_t live = liveBytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+	std::uint64_t highWater = highWaterBytes.load(std::memory_order_relaxed);
+	while (live > highWater && !highWaterBytes.compare_exchange_weak(highWater, live, std::memory_order_relaxed)) {}
+}
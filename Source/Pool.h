@@ -0,0 +1,83 @@
+// Copyright 2022 Justus Zorn
+
+#ifndef Hazard_Pool_h
+#define Hazard_Pool_h
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace Hazard {
+	struct PoolStats {
+		std::uint64_t allocations;
+		// Allocations that could not be served from a free list
+		std::uint64_t heapAllocations;
+		std::uint64_t largeAllocations;
+		std::uint64_t liveBytes;
+		std::uint64_t highWaterBytes;
+	};
+
+	// Thread-safe allocator with a free list for each size class. Freed blocks
+	// are kept for later allocations, allocations above the largest size class
+	// go directly to the heap. Optionally, every thread keeps a small cache of
+	// blocks per size class, so that most allocations do not need a lock.
+	class Pool {
+	public:
+		Pool();
+		Pool(const Pool&) = delete;
+		~Pool();
+
+		Pool& operator=(const Pool&) = delete;
+
+		void* Allocate(std::size_t size);
+		void Free(void* memory);
+
+		void SetThreadCaches(bool enabled);
+
+		PoolStats GetStats() const;
+
+	private:
+		static constexpr std::size_t SizeClasses = 8;
+
+		struct FreeBlock {
+			FreeBlock* next;
+		};
+
+		struct SizeClass {
+			std::mutex mutex;
+			FreeBlock* head = nullptr;
+			std::size_t blockSize = 0;
+		};
+
+		struct ThreadCache {
+			Pool* pool = nullptr;
+			FreeBlock* heads[SizeClasses] = {};
+			std::size_t counts[SizeClasses] = {};
+
+			~ThreadCache();
+		};
+
+		static thread_local ThreadCache threadCache;
+
+		SizeClass sizeClasses[SizeClasses];
+		std::atomic<bool> threadCaches = false;
+
+		std::mutex chunkMutex;
+		std::vector<void*> chunks;
+
+		std::atomic<std::uint64_t> allocations = 0;
+		std::atomic<std::uint64_t> heapAllocations = 0;
+		std::atomic<std::uint64_t> largeAllocations = 0;
+		std::atomic<std::uint64_t> liveBytes = 0;
+		std::atomic<std::uint64_t> highWaterBytes = 0;
+
+		ThreadCache* GetThreadCache();
+		FreeBlock* TakeBlocks(std::uint32_t index, std::size_t count, std::size_t& taken);
+		void ReturnBlocks(std::uint32_t index, FreeBlock* head, FreeBlock* tail);
+		void AddLiveBytes(std::uint64_t bytes);
+	};
+}
+
+#endif
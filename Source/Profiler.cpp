@@ -0,0 +1,105 @@
+// Copyright 2022 Justus Zorn
+
+#include <atomic>
+#include <fstream>
+
+#include "Clock.h"
+#include "Profiler.h"
+
+using namespace Hazard;
+
+static std::atomic<std::uint32_t> profilerToggles = 0;
+
+void Profiler::Start(std::uint32_t interval) {
+	running = true;
+	this->interval = interval;
+	lastSample = GetMicroseconds();
+	stacks.clear();
+}
+
+bool Profiler::Stop(const std::string& path) {
+	running = false;
+
+	std::ofstream file(path);
+	for (const auto& pair : stacks) {
+		file << pair.first << ' ' << pair.second << '\n';
+	}
+	stacks.clear();
+	return static_cast<bool>(file);
+}
+
+bool Profiler::IsRunning() const {
+	return running;
+}
+
+void Profiler::Sample(lua_State* L, const char* root) {
+	if (interval > 0) {
+		std::uint64_t now = GetMicroseconds();
+		if (now - lastSample < interval) {
+			return;
+		}
+		lastSample = now;
+	}
+
+	// The frames are collected from the innermost function outwards, but are
+	// written starting at the root
+	int depth = 0;
+	lua_Debug ar;
+	while (depth < MaxDepth && lua_getstack(L, depth, &ar)) {
+		lua_getinfo(L, "Sln", &ar);
+		if (frames.size() <= static_cast<std::size_t>(depth)) {
+			frames.emplace_back();
+		}
+		std::string& frame = frames[depth];
+		if (ar.name) {
+			frame.assign(ar.name);
+		}
+		else if (*ar.what == 'm') {
+			frame.assign("main chunk");
+		}
+		else if (*ar.what == 'C') {
+			frame.assign("?");
+		}
+		else {
+			// Functions without a name are named after their definition, like in
+			// tracebacks
+			frame.assign("function <");
+			frame += ar.short_src;
+			frame += ':';
+			frame += std::to_string(ar.linedefined);
+			frame += '>';
+		}
+		if (*ar.what == 'C') {
+			frame += " [C]";
+		}
+		else {
+			frame += " (";
+			frame += ar.short_src;
+			frame += ':';
+			frame += std::to_string(ar.currentline);
+			frame += ')';
+		}
+		// Semicolons separate the frames in the folded format
+		for (char& c : frame) {
+			if (c == ';') {
+				c = ',';
+			}
+		}
+		++depth;
+	}
+
+	stack.assign(root);
+	for (int i = depth - 1; i >= 0; --i) {
+		stack += ';';
+		stack += frames[i];
+	}
+	++stacks[stack];
+}
+
+void Hazard::ToggleProfiler() {
+	profilerToggles.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::uint32_t Hazard::GetProfilerToggles() {
+	return profilerToggles.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,52 @@
+// Copyright 2022 Justus Zorn
+
+#ifndef Hazard_Profiler_h
+#define Hazard_Profiler_h
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <lua.hpp>
+
+namespace Hazard {
+	// Sampling profiler for the Lua code of a script. Samples are taken from a
+	// count hook, either every time it runs, or at most once per interval.
+	// Identical stacks are aggregated and written in the folded format read by
+	// flame graph tools.
+	class Profiler {
+	public:
+		Profiler() = default;
+		Profiler(const Profiler&) = delete;
+
+		Profiler& operator=(const Profiler&) = delete;
+
+		// 'interval' is in microseconds, 0 samples on every hook
+		void Start(std::uint32_t interval);
+		// Writes all samples to 'path' and discards them
+		bool Stop(const std::string& path);
+		bool IsRunning() const;
+
+		// Records the stack of 'L', below a frame named 'root'
+		void Sample(lua_State* L, const char* root);
+
+	private:
+		static constexpr int MaxDepth = 64;
+
+		bool running = false;
+		std::uint32_t interval = 0;
+		std::uint64_t lastSample = 0;
+
+		std::unordered_map<std::string, std::uint64_t> stacks;
+		std::vector<std::string> frames;
+		std::string stack;
+	};
+
+	// Asks all rooms to start or stop profiling. This only increments an atomic
+	// counter, so it can be called from signal handlers.
+	void ToggleProfiler();
+	std::uint32_t GetProfilerToggles();
+}
+
+#endif
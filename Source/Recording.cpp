@@ -0,0 +1,281 @@
+// Copyright 2022 Justus Zorn
+
+#include <algorithm>
+#include <iterator>
+
+#include "Log.h"
+#include "Recording.h"
+
+using namespace Hazard;
+
+static const char magic[4] = { 'H', 'Z', 'R', 'C' };
+static constexpr std::uint64_t Version = 1;
+
+bool Recorder::Open(const std::string& path, std::uint32_t room, std::uint64_t seed, std::uint64_t time) {
+	file.open(path, std::ios::binary);
+	if (!file) {
+		HAZARD_ERROR("Could not create recording " << path);
+		return false;
+	}
+	record.assign(magic, sizeof(magic));
+	WriteVarint(Version);
+	WriteVarint(room);
+	WriteVarint(seed);
+	WriteVarint(time);
+	WriteRecord();
+	lastTime = time;
+	lastFlush = time;
+	return true;
+}
+
+bool Recorder::IsOpen() const {
+	return file.is_open();
+}
+
+void Recorder::Tick(std::uint64_t time) {
+	if (!IsOpen()) {
+		return;
+	}
+	record.push_back(static_cast<char>(RecordType::Tick));
+	WriteVarint(time - lastTime);
+	WriteRecord();
+	lastTime = time;
+	// Dedicated servers are usually stopped by a signal, which loses everything
+	// that was not flushed
+	if (time - lastFlush >= 1000) {
+		file.flush();
+		lastFlush = time;
+	}
+}
+
+void Recorder::Login(const std::string& playerName) {
+	if (!IsOpen()) {
+		return;
+	}
+	// A player that logs in again gets a new number
+	players[playerName] = nextPlayer++;
+	record.push_back(static_cast<char>(RecordType::Login));
+	WriteString(playerName);
+	WriteRecord();
+}
+
+void Recorder::Input(const std::string& playerName, const Hazard::Input& input) {
+	if (!IsOpen()) {
+		return;
+	}
+	if (input.keyboardInputs.empty() && input.buttonInputs.empty() && !input.mouseMotion && input.textInput.empty()) {
+		return;
+	}
+	record.push_back(static_cast<char>(RecordType::Input));
+	if (!WritePlayer(playerName)) {
+		return;
+	}
+	WriteVarint(input.keyboardInputs.size());
+	for (const KeyboardInput& keyboardInput : input.keyboardInputs) {
+		WriteSigned(keyboardInput.key);
+		record.push_back(keyboardInput.pressed);
+	}
+	WriteVarint(input.buttonInputs.size());
+	for (const ButtonInput& buttonInput : input.buttonInputs) {
+		record.push_back(static_cast<char>(buttonInput.button));
+		record.push_back(buttonInput.pressed);
+	}
+	record.push_back(input.mouseMotion);
+	if (input.mouseMotion) {
+		WriteSigned(input.mouseMotionX);
+		WriteSigned(input.mouseMotionY);
+	}
+	WriteString(input.textInput);
+	WriteRecord();
+}
+
+void Recorder::Disconnect(const std::string& playerName) {
+	if (!IsOpen()) {
+		return;
+	}
+	record.push_back(static_cast<char>(RecordType::Disconnect));
+	if (!WritePlayer(playerName)) {
+		return;
+	}
+	WriteRecord();
+	players.erase(playerName);
+}
+
+void Recorder::WriteRecord() {
+	file.write(record.data(), record.size());
+	record.clear();
+}
+
+void Recorder::WriteVarint(std::uint64_t value) {
+	while (value >= 0x80) {
+		record.push_back(static_cast<char>((value & 0x7F) | 0x80));
+		value >>= 7;
+	}
+	record.push_back(static_cast<char>(value));
+}
+
+void Recorder::WriteSigned(std::int64_t value) {
+	// Zigzag encoding keeps small negative values short
+	WriteVarint((static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63));
+}
+
+void Recorder::WriteString(const std::string& value) {
+	WriteVarint(value.size());
+	record.append(value);
+}
+
+bool Recorder::WritePlayer(const std::string& playerName) {
+	auto it = players.find(playerName);
+	if (it == players.end()) {
+		record.clear();
+		return false;
+	}
+	WriteVarint(it->second);
+	return true;
+}
+
+bool Replayer::Open(const std::string& path) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		HAZARD_ERROR("Could not open recording " << path);
+		return false;
+	}
+	data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+	if (data.size() < sizeof(magic) || !std::equal(magic, magic + sizeof(magic), data.begin())) {
+		HAZARD_ERROR(path << " is not a recording");
+		return false;
+	}
+	position = sizeof(magic);
+	if (ReadVarint() != Version) {
+		HAZARD_ERROR("Recording " << path << " has an unsupported version");
+		return false;
+	}
+	room = static_cast<std::uint32_t>(ReadVarint());
+	seed = ReadVarint();
+	startTime = ReadVarint();
+	time = startTime;
+	if (failed) {
+		HAZARD_ERROR("Recording " << path << " is truncated");
+		return false;
+	}
+	return true;
+}
+
+std::uint32_t Replayer::GetRoom() const {
+	return room;
+}
+
+std::uint64_t Replayer::GetSeed() const {
+	return seed;
+}
+
+std::uint64_t Replayer::GetStartTime() const {
+	return startTime;
+}
+
+bool Replayer::ReadTick(std::uint64_t& time) {
+	if (failed || position >= data.size() || data[position] != static_cast<char>(RecordType::Tick)) {
+		return false;
+	}
+	++position;
+	this->time += ReadVarint();
+	time = this->time;
+	return !failed;
+}
+
+bool Replayer::ReadEvent(ReplayEvent& event) {
+	if (failed || position >= data.size() || data[position] == static_cast<char>(RecordType::Tick)) {
+		return false;
+	}
+	event.type = static_cast<RecordType>(ReadByte());
+	switch (event.type) {
+	case RecordType::Login:
+		event.playerName = ReadString();
+		players.push_back(event.playerName);
+		break;
+	case RecordType::Input: {
+		event.playerName = ReadPlayer();
+		Input& input = event.input;
+		input.Clear();
+		std::uint64_t keyboardInputs = ReadVarint();
+		for (std::uint64_t i = 0; i < keyboardInputs && !failed; ++i) {
+			KeyboardInput keyboardInput;
+			keyboardInput.key = static_cast<std::int32_t>(ReadSigned());
+			keyboardInput.pressed = ReadByte() != 0;
+			input.keyboardInputs.push_back(keyboardInput);
+		}
+		std::uint64_t buttonInputs = ReadVarint();
+		for (std::uint64_t i = 0; i < buttonInputs && !failed; ++i) {
+			ButtonInput buttonInput;
+			buttonInput.button = ReadByte();
+			buttonInput.pressed = ReadByte() != 0;
+			input.buttonInputs.push_back(buttonInput);
+		}
+		input.mouseMotion = ReadByte() != 0;
+		if (input.mouseMotion) {
+			input.mouseMotionX = static_cast<std::int32_t>(ReadSigned());
+			input.mouseMotionY = static_cast<std::int32_t>(ReadSigned());
+		}
+		input.textInput = ReadString();
+		break;
+	}
+	case RecordType::Disconnect:
+		event.playerName = ReadPlayer();
+		break;
+	default:
+		failed = true;
+		break;
+	}
+	if (failed) {
+		HAZARD_ERROR("Recording is corrupted");
+		return false;
+	}
+	return true;
+}
+
+std::uint8_t Replayer::ReadByte() {
+	if (position >= data.size()) {
+		failed = true;
+		return 0;
+	}
+	return static_cast<std::uint8_t>(data[position++]);
+}
+
+std::uint64_t Replayer::ReadVarint() {
+	std::uint64_t value = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		std::uint8_t byte = ReadByte();
+		value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) {
+			break;
+		}
+	}
+	return value;
+}
+
+std::int64_t Replayer::ReadSigned() {
+	std::uint64_t value = ReadVarint();
+	return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+}
+
+std::string Replayer::ReadString() {
+	std::uint64_t length = ReadVarint();
+	if (length > data.size() - position) {
+		failed = true;
+		return std::string();
+	}
+	std::string value(data.data() + position, length);
+	position += length;
+	return value;
+}
+
+const std::string& Replayer::ReadPlayer() {
+	static const std::string unknown;
+	std::uint64_t id = ReadVarint();
+	if (id >= players.size()) {
+		failed = true;
+		return unknown;
+	}
+	return players[id];
+}
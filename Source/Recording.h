@@ -0,0 +1,111 @@
+// Copyright 2022 Justus Zorn
+
+#ifndef Hazard_Recording_h
+#define Hazard_Recording_h
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Common.h"
+
+namespace Hazard {
+	// Recordings contain everything that reaches the script of a room from the
+	// outside: logins, inputs and disconnects of players, and the time of every
+	// tick. Replaying them runs the same callbacks with the same arguments at
+	// the same times, as long as the script does not depend on anything else.
+	//
+	// A recording starts with a header, followed by a tick record for every
+	// tick and the events that were handled in that tick. Integers are
+	// variable-length encoded, players are numbered in the order of their
+	// logins.
+
+	enum class RecordType : std::uint8_t {
+		Tick = 1,
+		Login = 2,
+		Input = 3,
+		Disconnect = 4
+	};
+
+	struct ReplayEvent {
+		RecordType type;
+		std::string playerName;
+		Input input;
+	};
+
+	class Recorder {
+	public:
+		Recorder() = default;
+		Recorder(const Recorder&) = delete;
+
+		Recorder& operator=(const Recorder&) = delete;
+
+		// 'time' is the current time in milliseconds
+		bool Open(const std::string& path, std::uint32_t room, std::uint64_t seed, std::uint64_t time);
+		bool IsOpen() const;
+
+		void Tick(std::uint64_t time);
+		void Login(const std::string& playerName);
+		// Inputs without any events are not recorded
+		void Input(const std::string& playerName, const Hazard::Input& input);
+		void Disconnect(const std::string& playerName);
+
+	private:
+		std::ofstream file;
+		std::string record;
+		std::uint64_t lastTime = 0;
+		std::uint64_t lastFlush = 0;
+		std::uint32_t nextPlayer = 0;
+		std::unordered_map<std::string, std::uint32_t> players;
+
+		void WriteRecord();
+		void WriteVarint(std::uint64_t value);
+		void WriteSigned(std::int64_t value);
+		void WriteString(const std::string& value);
+		// Returns false if the player did not log in
+		bool WritePlayer(const std::string& playerName);
+	};
+
+	class Replayer {
+	public:
+		Replayer() = default;
+		Replayer(const Replayer&) = delete;
+
+		Replayer& operator=(const Replayer&) = delete;
+
+		// Reads the whole recording into memory
+		bool Open(const std::string& path);
+
+		std::uint32_t GetRoom() const;
+		std::uint64_t GetSeed() const;
+		// In milliseconds
+		std::uint64_t GetStartTime() const;
+
+		// Returns false at the end of the recording, or if the next record is
+		// not a tick
+		bool ReadTick(std::uint64_t& time);
+		// Returns false at the next tick or at the end of the recording
+		bool ReadEvent(ReplayEvent& event);
+
+	private:
+		std::vector<char> data;
+		std::size_t position = 0;
+		bool failed = false;
+
+		std::uint32_t room = 0;
+		std::uint64_t seed = 0;
+		std::uint64_t startTime = 0;
+		std::uint64_t time = 0;
+		std::vector<std::string> players;
+
+		std::uint8_t ReadByte();
+		std::uint64_t ReadVarint();
+		std::int64_t ReadSigned();
+		std::string ReadString();
+		const std::string& ReadPlayer();
+	};
+}
+
+#endif
@@ -0,0 +1,240 @@
+// Copyright 2022 Justus Zorn
+
+#include <chrono>
+
+#include "Clock.h"
+#include "Log.h"
+#include "Rooms.h"
+#include "Scene.h"
+
+using namespace Hazard;
+
+RoomQueue::~RoomQueue() {
+	for (ENetEvent& event : events) {
+		if (event.type == ENET_EVENT_TYPE_RECEIVE) {
+			enet_packet_destroy(event.packet);
+		}
+	}
+	for (Outgoing& packet : outgoing) {
+		if (packet.type == Outgoing::Type::Send) {
+			enet_packet_destroy(packet.packet);
+		}
+	}
+}
+
+void RoomQueue::PushEvent(const ENetEvent& event) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		events.push_back(event);
+	}
+	condition.notify_one();
+}
+
+void RoomQueue::TakeOutgoing(std::vector<Outgoing>& outgoing) {
+	std::lock_guard<std::mutex> lock(mutex);
+	outgoing.swap(this->outgoing);
+}
+
+void RoomQueue::SetStats(std::unordered_map<ENetPeer*, PeerStats>& peerStats) {
+	std::lock_guard<std::mutex> lock(mutex);
+	stats.swap(peerStats);
+}
+
+void RoomQueue::Wait(std::vector<ENetEvent>& events, std::uint32_t timeout) {
+	std::unique_lock<std::mutex> lock(mutex);
+	if (timeout > 0) {
+		condition.wait_for(lock, std::chrono::milliseconds(timeout), [this]() { return !this->events.empty(); });
+	}
+	events.insert(events.end(), this->events.begin(), this->events.end());
+	this->events.clear();
+}
+
+void RoomQueue::Send(ENetPeer* peer, std::uint32_t connectID, std::uint8_t channel, ENetPacket* packet) {
+	std::lock_guard<std::mutex> lock(mutex);
+	outgoing.push_back({ Outgoing::Type::Send, peer, connectID, channel, packet });
+}
+
+void RoomQueue::Disconnect(ENetPeer* peer, std::uint32_t connectID, bool now) {
+	std::lock_guard<std::mutex> lock(mutex);
+	outgoing.push_back({ now ? Outgoing::Type::DisconnectNow : Outgoing::Type::Disconnect, peer, connectID, 0, nullptr });
+}
+
+PeerStats RoomQueue::GetStats(ENetPeer* peer) {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = stats.find(peer);
+	if (it != stats.end()) {
+		return it->second;
+	}
+	return { 0, 0, ENET_PEER_PACKET_THROTTLE_SCALE };
+}
+
+Rooms::Rooms(Config& config, LocalLink* link) : config{ config } {
+	ENetAddress address = { 0 };
+	address.host = ENET_HOST_ANY;
+	address.port = config.Port();
+
+	host = enet_host_create(&address, config.MaxPlayers(), 4, 0, 0);
+	if (!host) {
+		HAZARD_ERROR("Could not create ENet host");
+		return;
+	}
+
+	std::uint32_t localRoom = link ? config.Route(link->playerName, 0) : 0;
+	for (std::uint32_t i = 0; i < config.Rooms(); ++i) {
+		rooms.push_back(std::make_unique<Room>());
+		Room* room = rooms.back().get();
+		LocalLink* roomLink = i == localRoom ? link : nullptr;
+		room->thread = std::thread([this, room, roomLink, i]() {
+			Config roomConfig("config.lua");
+			Scene scene("main.lua", roomConfig, room->queue, i);
+			if (roomLink) {
+				scene.AddLocalPlayer(*roomLink);
+			}
+			scene.Run(roomsRunning, room->shouldReload);
+		});
+	}
+	if (link && localRoom >= config.Rooms()) {
+		HAZARD_ERROR("Player " << link->playerName << " was routed to invalid room " << localRoom);
+		link->kicked = true;
+	}
+}
+
+Rooms::~Rooms() {
+	roomsRunning = false;
+	for (auto& room : rooms) {
+		room->thread.join();
+	}
+
+	if (host) {
+		// Rooms disconnect their players when they are destroyed
+		SendOutgoing();
+		enet_host_destroy(host);
+	}
+}
+
+void Rooms::Run(const std::atomic<bool>& running, std::atomic<bool>& shouldReload) {
+	if (!host) {
+		return;
+	}
+
+	std::uint64_t lastStats = GetTicks();
+	while (running) {
+		if (shouldReload) {
+			config.Reload();
+			for (auto& room : rooms) {
+				room->shouldReload = true;
+			}
+			shouldReload = false;
+		}
+
+		// Packets from the rooms are only sent between calls to enet_host_service,
+		// so the timeout must be short
+		ENetEvent event;
+		int result = enet_host_service(host, &event, 1);
+		if (result < 0) {
+			HAZARD_ERROR("Could not receive network events");
+			// Retrying at once would spin
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		else if (result > 0) {
+			do {
+				HandleEvent(event);
+			} while (enet_host_service(host, &event, 0) > 0);
+		}
+
+		SendOutgoing();
+
+		if (GetTicks() - lastStats >= 100) {
+			UpdateStats();
+			lastStats = GetTicks();
+		}
+	}
+}
+
+void Rooms::HandleEvent(ENetEvent& event) {
+	auto it = peerRooms.find(event.peer);
+	switch (event.type) {
+	case ENET_EVENT_TYPE_CONNECT:
+		// Peers are assigned to a room when they send their login packet
+		break;
+	case ENET_EVENT_TYPE_DISCONNECT:
+	case ENET_EVENT_TYPE_DISCONNECT_TIMEOUT:
+		if (it != peerRooms.end()) {
+			rooms[it->second]->queue.PushEvent(event);
+			peerRooms.erase(it);
+		}
+		break;
+	case ENET_EVENT_TYPE_RECEIVE:
+		// Rooms use the connect ID to detect peers that were reused for a new connection
+		event.data = event.peer->connectID;
+		if (it != peerRooms.end()) {
+			rooms[it->second]->queue.PushEvent(event);
+			return;
+		}
+
+		if (event.channelID == 0) {
+			ReadPacket packet(event.packet);
+			std::string playerName = packet.ReadString();
+			std::uint32_t room = 0;
+			if (packet.Remaining() >= sizeof(std::uint32_t)) {
+				room = packet.Read32();
+			}
+
+			room = config.Route(playerName, room);
+			if (room < rooms.size()) {
+				peerRooms[event.peer] = room;
+
+				ENetEvent connectEvent = { ENET_EVENT_TYPE_CONNECT };
+				connectEvent.peer = event.peer;
+				connectEvent.data = event.data;
+				rooms[room]->queue.PushEvent(connectEvent);
+				rooms[room]->queue.PushEvent(event);
+				return;
+			}
+
+			HAZARD_ERROR("Player " << playerName << " was routed to invalid room " << room);
+			enet_peer_disconnect(event.peer, 0);
+		}
+		enet_packet_destroy(event.packet);
+		break;
+	}
+}
+
+void Rooms::SendOutgoing() {
+	for (auto& room : rooms) {
+		room->queue.TakeOutgoing(outgoing);
+		for (RoomQueue::Outgoing& packet : outgoing) {
+			bool connected = packet.peer->state == ENET_PEER_STATE_CONNECTED && packet.peer->connectID == packet.connectID;
+			switch (packet.type) {
+			case RoomQueue::Outgoing::Type::Send:
+				if (!connected || enet_peer_send(packet.peer, packet.channel, packet.packet) < 0) {
+					enet_packet_destroy(packet.packet);
+				}
+				break;
+			case RoomQueue::Outgoing::Type::Disconnect:
+				if (connected) {
+					enet_peer_disconnect(packet.peer, 0);
+				}
+				break;
+			case RoomQueue::Outgoing::Type::DisconnectNow:
+				if (connected) {
+					enet_peer_disconnect_now(packet.peer, 0);
+					peerRooms.erase(packet.peer);
+				}
+				break;
+			}
+		}
+		outgoing.clear();
+	}
+	enet_host_flush(host);
+}
+
+void Rooms::UpdateStats() {
+	std::vector<std::unordered_map<ENetPeer*, PeerStats>> stats(rooms.size());
+	for (const auto& pair : peerRooms) {
+		stats[pair.second][pair.first] = GetPeerStats(pair.first);
+	}
+	for (std::uint32_t i = 0; i < rooms.size(); ++i) {
+		rooms[i]->queue.SetStats(stats[i]);
+	}
+}
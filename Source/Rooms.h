@@ -0,0 +1,97 @@
+// Copyright 2022 Justus Zorn
+
+#ifndef Hazard_Rooms_h
+#define Hazard_Rooms_h
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <enet.h>
+
+#include "Config.h"
+#include "LocalLink.h"
+#include "Net.h"
+
+namespace Hazard {
+	// Passes events and packets between the network thread, which owns the ENet
+	// host, and the thread of a single room. ENet itself is not thread-safe, so
+	// rooms never call into ENet directly.
+	class RoomQueue {
+	public:
+		struct Outgoing {
+			enum class Type {
+				Send,
+				Disconnect,
+				DisconnectNow
+			} type;
+			ENetPeer* peer;
+			std::uint32_t connectID;
+			std::uint8_t channel;
+			ENetPacket* packet;
+		};
+
+		RoomQueue() = default;
+		RoomQueue(const RoomQueue&) = delete;
+		~RoomQueue();
+
+		RoomQueue& operator=(const RoomQueue&) = delete;
+
+		// Network thread
+		void PushEvent(const ENetEvent& event);
+		void TakeOutgoing(std::vector<Outgoing>& outgoing);
+		void SetStats(std::unordered_map<ENetPeer*, PeerStats>& peerStats);
+
+		// Room thread
+		void Wait(std::vector<ENetEvent>& events, std::uint32_t timeout);
+		void Send(ENetPeer* peer, std::uint32_t connectID, std::uint8_t channel, ENetPacket* packet);
+		void Disconnect(ENetPeer* peer, std::uint32_t connectID, bool now);
+		PeerStats GetStats(ENetPeer* peer);
+
+	private:
+		std::mutex mutex;
+		std::condition_variable condition;
+
+		std::vector<ENetEvent> events;
+		std::vector<Outgoing> outgoing;
+		std::unordered_map<ENetPeer*, PeerStats> stats;
+	};
+
+	class Rooms {
+	public:
+		Rooms(Config& config, LocalLink* link = nullptr);
+		Rooms(const Rooms&) = delete;
+		~Rooms();
+
+		Rooms& operator=(const Rooms&) = delete;
+
+		void Run(const std::atomic<bool>& running, std::atomic<bool>& shouldReload);
+
+	private:
+		struct Room {
+			RoomQueue queue;
+			std::thread thread;
+			std::atomic<bool> shouldReload = false;
+		};
+
+		Config& config;
+		ENetHost* host = nullptr;
+
+		std::vector<std::unique_ptr<Room>> rooms;
+		std::unordered_map<ENetPeer*, std::uint32_t> peerRooms;
+		std::atomic<bool> roomsRunning = true;
+
+		std::vector<RoomQueue::Outgoing> outgoing;
+
+		void HandleEvent(ENetEvent& event);
+		void SendOutgoing();
+		void UpdateStats();
+	};
+}
+
+#endif
@@ -1,16 +1,31 @@
 // Copyright 2022 Justus Zorn
 
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <iomanip>
 #include <iostream>
-
-#include <SDL.h>
-
-#include "Audio.h"
+#include <sstream>
+#include <thread>
+
+#include "Arena.h"
+#include "Capture.h"
+#include "Clock.h"
+#include "Jobs.h"
+#include "Log.h"
+#include "Metrics.h"
+#include "Keys.h"
 #include "Net.h"
+#include "Profiler.h"
+#include "Rooms.h"
 #include "Scene.h"
+#include "Trace.h"
 
 using namespace Hazard;
 
-Scene::Scene(std::string script, Config& config, std::uint16_t port) : config{ config }, script(script, this) {
+static const char* phaseNames[] = { "input", "timers", "tick", "send" };
+
+Scene::Scene(std::string script, Config& config, std::uint16_t port) : config{ config }, plugins(this, config), script(script, this, config.ScriptMemoryLimit() * 1024ull) {
 	ENetAddress address = { 0 };
 	address.host = ENET_HOST_ANY;
 	if (port == 0) {
@@ -22,191 +37,634 @@ Scene::Scene(std::string script, Config& config, std::uint16_t port) : config{ c
 
 	host = enet_host_create(&address, config.MaxPlayers(), 4, 0, 0);
 	if (!host) {
-		std::cerr << "ERROR: Could not create ENet host\n";
+		HAZARD_ERROR("Could not create ENet host");
 		return;
 	}
 
-	lastTicks = SDL_GetTicks64();
+	lastTicks = GetTicks();
+	LoadAssets();
+	this->script.ConfigureGC(config);
+	this->script.ConfigureWatchdog(config);
+	StartRecording();
+}
 
-	std::uint32_t i = 0;
-	for (const std::string& texture : config.GetTextures()) {
-		loadedTextures[texture] = i++;
-	}
+Scene::Scene(std::string script, Config& config, RoomQueue& queue, std::uint32_t room) : queue{ &queue }, room{ room }, config{ config }, plugins(this, config), script(script, this, config.ScriptMemoryLimit() * 1024ull) {
+	lastTicks = GetTicks();
+	LoadAssets();
+	this->script.ConfigureGC(config);
+	this->script.ConfigureWatchdog(config);
+	StartRecording();
+}
 
-	i = 0;
-	for (const std::string& sound : config.GetSounds()) {
-		loadedSounds[sound] = i++;
-	}
+Scene::Scene(std::string script, Config& config, Replayer& replayer) : room{ replayer.GetRoom() }, replayer{ &replayer }, config{ config }, plugins(this, config), script(script, this, config.ScriptMemoryLimit() * 1024ull) {
+	lastTicks = GetTicks();
+	LoadAssets();
+	this->script.ConfigureGC(config);
+	this->script.ConfigureWatchdog(config);
+	this->script.SetRandomSeed(replayer.GetSeed());
 }
 
 Scene::~Scene() {
+	for (ENetEvent& event : events) {
+		if (event.type == ENET_EVENT_TYPE_RECEIVE) {
+			enet_packet_destroy(event.packet);
+		}
+	}
 	for (auto& player : players) {
-		enet_peer_disconnect_now(player.second.peer, 0);
+		if (!player.second.link) {
+			Disconnect(player.second.peer, player.second.connectID, true);
+		}
+	}
+	if (host) {
+		enet_host_destroy(host);
 	}
-	enet_host_destroy(host);
 }
 
-static const char* GetButtonName(std::uint8_t button) {
-	switch (button) {
-	case SDL_BUTTON_LEFT:
-		return "Left";
-	case SDL_BUTTON_MIDDLE:
-		return "Middle";
-	case SDL_BUTTON_RIGHT:
-		return "Right";
-	case SDL_BUTTON_X1:
-		return "X1";
-	case SDL_BUTTON_X2:
-		return "X2";
-	default:
-		std::cerr << "ERROR: Invalid button " << button << '\n';
-		return "";
+void Scene::Run(const std::atomic<bool>& running, std::atomic<bool>& shouldReload) {
+	// Ticks are scheduled in microseconds, and the remainder of the division by
+	// the tick rate is carried over, so that tick rates that do not divide a
+	// second do not drift
+	std::uint64_t nextTick = GetMicroseconds();
+	std::uint32_t tickRemainder = 0;
+	std::uint32_t profilerToggles = GetProfilerToggles();
+	SetTraceThreadName("Room " + std::to_string(room));
+	while (running) {
+		if (shouldReload) {
+			Reload();
+			shouldReload = false;
+		}
+		// Toggles are handled one per tick like in UpdateTrace, so that two
+		// toggles between ticks start and stop the profiler instead of being
+		// counted as one
+		if (profilerToggles != GetProfilerToggles()) {
+			++profilerToggles;
+			ToggleProfiler();
+		}
+		UpdateTrace();
+
+		std::uint64_t tickStart = GetMicroseconds();
+		Update();
+
+		// Spend the time until the next tick waiting for network events, so that
+		// inputs are received as soon as they arrive
+		std::uint32_t tickRate = config.TickRate();
+		nextTick += 1000000 / tickRate;
+		tickRemainder += 1000000 % tickRate;
+		if (tickRemainder >= tickRate) {
+			tickRemainder -= tickRate;
+			++nextTick;
+		}
+		std::uint64_t now = GetMicroseconds();
+		if (nextTick < now) {
+			nextTick = now;
+		}
+
+		// Garbage is collected in the idle time before the next tick, using at
+		// most half of it
+		if (config.GCIdleBudget() > 0 && now < nextTick) {
+			TraceScope trace("Scene::CollectGarbage");
+			SubsystemScope subsystem(Subsystem::Script);
+			script.CollectGarbage(std::min<std::uint64_t>(config.GCIdleBudget(), (nextTick - now) / 2));
+			now = GetMicroseconds();
+		}
+
+		// Inputs can start the next tick early, but at most once per half tick
+		// interval, so that clients with a high frame rate cannot drive the tick
+		// rate
+		std::uint64_t earliestTick = tickStart + 500000 / tickRate;
+		TraceScope trace("Scene::Wait");
+		while (now < nextTick) {
+			// The timeout is rounded up, so that waiting does not spin during the
+			// last millisecond
+			if (Wait(static_cast<std::uint32_t>((nextTick - now + 999) / 1000)) && config.LowLatency()) {
+				nextTick = std::min(nextTick, std::max(GetMicroseconds(), earliestTick));
+			}
+			now = GetMicroseconds();
+		}
 	}
 }
 
-void Scene::Update() {
-	ENetEvent event;
-	while (enet_host_service(host, &event, 0) > 0) {
+bool Scene::ReplayTick() {
+	std::uint64_t time;
+	if (!replayer->ReadTick(time)) {
+		return false;
+	}
+	FreezeClock(time * 1000);
+	Update();
+	return true;
+}
+
+void Scene::RunReplay() {
+	// The clock of the scene is frozen at the recorded times, the duration of
+	// the ticks is measured with a separate clock
+	Histogram replayTimes;
+	std::uint64_t ticks = 0, firstTime = 0, lastTime = 0;
+	std::clock_t cpuStart = std::clock();
+	auto replayStart = std::chrono::steady_clock::now();
+
+	while (true) {
+		auto tickStart = std::chrono::steady_clock::now();
+		if (!ReplayTick()) {
+			break;
+		}
+		replayTimes.Add(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - tickStart).count());
+		if (ticks == 0) {
+			firstTime = GetTicks();
+		}
+		lastTime = GetTicks();
+		++ticks;
+	}
+
+	double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - replayStart).count();
+	double cpu = static_cast<double>(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+	std::cout << "Replayed " << ticks << " ticks (" << (lastTime - firstTime) / 1000.0 << " s of play) in "
+		<< total << " s, " << cpu << " s CPU time\n";
+	std::cout << "Tick time: " << (ticks > 0 ? total * 1e6 / ticks : 0.0) << " us average, " << replayTimes.GetPercentile(0.5) << " us p50, "
+		<< replayTimes.GetPercentile(0.99) << " us p99, " << replayTimes.GetMax() << " us max" << std::endl;
+}
+
+void Scene::ReplayEvents() {
+	ReplayEvent event;
+	while (replayer->ReadEvent(event)) {
 		switch (event.type) {
-		case ENET_EVENT_TYPE_CONNECT:
-			event.peer->data = nullptr;
+		case RecordType::Login:
+			if (players.find(event.playerName) == players.end() && pendingLogins.find(event.playerName) == pendingLogins.end()) {
+				pendingLogins[event.playerName].replayed = true;
+				Login(event.playerName);
+			}
 			break;
-		case ENET_EVENT_TYPE_DISCONNECT:
-		case ENET_EVENT_TYPE_DISCONNECT_TIMEOUT:
-			if (event.peer->data != nullptr) {
-				Player* player = reinterpret_cast<Player*>(event.peer->data);
-				script.OnDisconnect(player->playerName);
-				players.erase(player->playerName);
+		case RecordType::Input: {
+			auto it = players.find(event.playerName);
+			if (it != players.end()) {
+				HandleInput(it->second, event.input);
 			}
 			break;
-		case ENET_EVENT_TYPE_RECEIVE:
-			if (event.channelID == 0) {
-				ReadPacket packet(event.packet);
-				std::string playerName = packet.ReadString();
-
-				if (players.find(playerName) != players.end() || !script.OnLogin(playerName)) {
-					enet_peer_disconnect(event.peer, 0);
-				}
-				else {
-					Player& player = players[playerName];
-					player.playerName = playerName;
-					player.peer = event.peer;
+		}
+		case RecordType::Disconnect: {
+			auto it = players.find(event.playerName);
+			if (it != players.end()) {
+				plugins.OnDisconnect(event.playerName);
+				script.OnDisconnect(event.playerName);
+				players.erase(it);
+			}
+			auto pending = pendingLogins.find(event.playerName);
+			if (pending != pendingLogins.end()) {
+				pending->second.replayed = false;
+			}
+			break;
+		}
+		default:
+			break;
+		}
+	}
+}
 
-					event.peer->data = &player;
+// Clients send an input packet every frame, even without any events. Only
+// inputs with key, button, mouse or text events are worth an early tick.
+static bool HasInputEvents(const ENetPacket* packet) {
+	// Key count, button count, mouse motion, mouse motion flag, text length
+	constexpr std::size_t EmptyInputSize = 4 + 4 + 8 + 1 + 4;
+	return packet->dataLength > EmptyInputSize || (packet->dataLength == EmptyInputSize && packet->data[16] != 0);
+}
 
-					script.OnJoin(playerName);
-				}
-			}
-			else if (event.channelID == 2) {
-				if (event.peer->data == nullptr) {
-					break;
+bool Scene::Wait(std::uint32_t timeout) {
+	SubsystemScope subsystem(Subsystem::Network);
+	std::size_t start = events.size();
+	if (queue) {
+		queue->Wait(events, timeout);
+	}
+	else if (host) {
+		ENetEvent event;
+		int result = enet_host_service(host, &event, timeout);
+		if (result < 0) {
+			HAZARD_ERROR("Could not receive network events");
+			// Retrying at once would spin until the next tick
+			std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+		}
+		else if (result > 0) {
+			do {
+				// Same as in Rooms, so that captures can tell the peers apart
+				if (event.type == ENET_EVENT_TYPE_RECEIVE) {
+					event.data = event.peer->connectID;
 				}
+				events.push_back(event);
+			} while (enet_host_service(host, &event, 0) > 0);
+		}
+	}
 
-				Player* player = reinterpret_cast<Player*>(event.peer->data);
-
-				ReadPacket packet(event.packet);
-				std::uint32_t keyboardInputs = packet.Read32();
-				for (std::uint32_t i = 0; i < keyboardInputs; ++i) {
-					SDL_Keycode keycode = packet.Read32();
-					std::uint8_t pressed = packet.Read8();
-					std::string key = SDL_GetKeyName(keycode);
-					if (pressed) {
-						players[player->playerName].keys[key] = true;
-						script.OnKeyEvent(player->playerName, key, true);
-					}
-					else {
-						players[player->playerName].keys[key] = false;
-						script.OnKeyEvent(player->playerName, key, false);
-					}
-					if (keycode == SDLK_BACKSPACE && pressed) {
-						std::string& composition = players[player->playerName].composition;
-						while (composition.length() > 0 && (composition[composition.length() - 1] & 0xC0) == 0x80) {
-							composition.erase(composition.end() - 1);
-						}
-						if (composition.length() > 0) {
-							composition.erase(composition.end() - 1);
-						}
-					}
-				}
-				std::uint32_t buttonInputs = packet.Read32();
-				for (std::uint32_t i = 0; i < buttonInputs; ++i) {
-					std::string button = GetButtonName(packet.Read8());
-					if (packet.Read8()) {
-						players[player->playerName].buttons[button] = true;
-						script.OnButtonEvent(player->playerName, button, true);
-					}
-					else {
-						players[player->playerName].buttons[button] = false;
-						script.OnButtonEvent(player->playerName, button, false);
-					}
-				}
-				std::int32_t mouseMotionX = packet.Read32();
-				std::int32_t mouseMotionY = packet.Read32();
-				if (packet.Read8()) {
-					players[player->playerName].mouseX = mouseMotionX;
-					players[player->playerName].mouseY = mouseMotionY;
-					script.OnAxisEvent(player->playerName, "Mouse X", mouseMotionX);
-					script.OnAxisEvent(player->playerName, "Mouse Y", mouseMotionY);
-				}
-				players[player->playerName].composition += packet.ReadString();
-			}
-			enet_packet_destroy(event.packet);
-			break;
+	for (std::size_t i = start; i < events.size(); ++i) {
+		if (events[i].type == ENET_EVENT_TYPE_RECEIVE && events[i].channelID == 2 && HasInputEvents(events[i].packet)) {
+			return true;
 		}
 	}
+	return false;
+}
+
+void Scene::Update() {
+	TraceScope trace("Scene::Update");
+	SubsystemScope subsystem(Subsystem::Scene);
+	std::uint64_t start = GetMicroseconds();
+	script.BeginTick(start);
+	std::uint64_t phaseStart = start;
+
+	// The time is taken before the input, so that replays can handle the input
+	// of a tick at the recorded time
+	std::uint64_t now = GetTicks();
+	recorder.Tick(now);
+
+	if (replayer) {
+		ReplayEvents();
+	}
+	else {
+		Wait(0);
+		for (ENetEvent& event : events) {
+			HandleEvent(event);
+		}
+		events.clear();
+		UpdateLocalPlayer();
+	}
+	EndPhase(Phase::Input, phaseStart);
 
-	std::uint64_t now = SDL_GetTicks64();
 	double dt = (now - lastTicks) / 1000.0;
 	lastTicks = now;
+
+	script.RunTimers();
+	script.ResumeJobs();
+	EndPhase(Phase::Timers, phaseStart);
+
+	plugins.OnTick(dt);
 	script.OnTick(dt);
 
 	for (const std::string& kickedPlayer : kickedPlayers) {
 		if (players.find(kickedPlayer) != players.end()) {
-			enet_peer_disconnect(players[kickedPlayer].peer, 0);
+			Player& player = players[kickedPlayer];
+			if (player.link) {
+				player.link->kicked = true;
+			}
+			else {
+				Disconnect(player.peer, player.connectID, false);
+			}
 		}
 	}
 
 	kickedPlayers.clear();
+	EndPhase(Phase::Tick, phaseStart);
 
+	double halfTick = 500.0 / config.TickRate();
 	for (auto& pair : players) {
-		WritePacket statePacket;
-		statePacket.Write32(static_cast<std::uint32_t>(pair.second.sprites.size()));
-		for (const Sprite& sprite : pair.second.sprites) {
-			statePacket.Write32(sprite.x);
-			statePacket.Write32(sprite.y);
-			statePacket.Write32(sprite.scale);
-			if (sprite.isText) {
-				statePacket.Write8(1);
-				statePacket.Write8(sprite.r);
-				statePacket.Write8(sprite.g);
-				statePacket.Write8(sprite.b);
-				statePacket.WriteString(sprite.text);
+		Player& player = pair.second;
+		if (player.link) {
+			// Audio commands must not get lost, so they are only published once the
+			// client took the previous ones
+			std::vector<AudioCommand>& audioCommands = player.link->audioCommands.Back();
+			audioCommands.insert(audioCommands.end(), player.audioCommands.begin(), player.audioCommands.end());
+			player.audioCommands.clear();
+			if (audioCommands.size() > 0 && player.link->audioCommands.TryPublish()) {
+				player.link->audioCommands.Back().clear();
+			}
+		}
+		else if (player.audioCommands.size() > 0) {
+			WritePacket audioPacket(&tickArena, 4 + player.audioCommands.size() * 8);
+			audioPacket.Write32(static_cast<std::uint32_t>(player.audioCommands.size()));
+			for (const AudioCommand& audioCommand : player.audioCommands) {
+				audioPacket.Write8(static_cast<std::uint8_t>(audioCommand.type));
+				audioPacket.Write8(audioCommand.volume);
+				audioPacket.Write16(audioCommand.channel);
+				audioPacket.Write32(audioCommand.sound);
+			}
+			Send(player, 3, audioPacket.GetPacket(true));
+			player.audioCommands.clear();
+		}
+
+		// Every callback of the tick can draw, so the sprites are always recorded
+		// and only dropped here. A snapshot is due if it would be due before the
+		// next tick has run half way.
+		if (now + halfTick < player.nextSnapshot) {
+			player.sprites.Clear();
+			continue;
+		}
+
+		player.nextSnapshot += GetSnapshotInterval(player, now);
+		if (player.nextSnapshot < now) {
+			player.nextSnapshot = static_cast<double>(now);
+		}
+
+		metricsSprites += player.sprites.GetSprites().size();
+		if (player.link) {
+			player.link->sprites.Back().Swap(player.sprites);
+			player.link->sprites.Publish();
+			player.sprites.Clear();
+			continue;
+		}
+
+		WritePacket statePacket(&tickArena, 4 + player.sprites.GetSprites().size() * 21);
+		WriteSnapshot(statePacket, player.sprites);
+		Send(player, 1, statePacket.GetPacket(false));
+		player.sprites.Clear();
+	}
+
+	tickArena.Reset();
+	EndPhase(Phase::Send, phaseStart);
+	script.EndTick();
+
+	std::uint64_t tickTime = phaseStart - start;
+	++statsTicks;
+	statsTickTime += tickTime;
+	if (tickTime > statsMaxTickTime) {
+		statsMaxTickTime = tickTime;
+	}
+	tickTimes.Add(tickTime);
+	++metricsTicks;
+	metricsTickTime += tickTime;
+	metricsTickTimes.Add(tickTime);
+	std::uint64_t budget = config.TickBudget() > 0 ? config.TickBudget() * 1000ull : 1000000ull / config.TickRate();
+	if (tickTime > budget) {
+		++statsOverBudget;
+	}
+	if (config.StatsInterval() > 0 && now >= nextStats) {
+		if (nextStats > 0) {
+			PrintStats();
+		}
+		else {
+			// Loading the scripts is not part of any tick
+			statsAllocations = GetThreadAllocations();
+		}
+		nextStats = now + config.StatsInterval() * 1000ull;
+	}
+	if (GetMetrics().IsRunning() && now >= nextMetrics) {
+		PublishMetrics();
+		nextMetrics = now + 1000;
+	}
+}
+
+void Scene::AddLocalPlayer(LocalLink& link) {
+	localLink = &link;
+}
+
+void Scene::UpdateLocalPlayer() {
+	if (!localLink) {
+		return;
+	}
+
+	const std::string& playerName = localLink->playerName;
+	auto it = players.find(playerName);
+	bool joined = it != players.end() && it->second.link == localLink;
+
+	auto pending = pendingLogins.find(playerName);
+	bool waiting = pending != pendingLogins.end() && pending->second.link == localLink;
+
+	if (!localLink->connected || localLink->kicked) {
+		if (joined || waiting) {
+			recorder.Disconnect(playerName);
+		}
+		if (joined) {
+			plugins.OnDisconnect(playerName);
+			script.OnDisconnect(playerName);
+			players.erase(it);
+		}
+		if (waiting) {
+			pending->second.link = nullptr;
+		}
+		localLink = nullptr;
+		return;
+	}
+
+	if (!joined) {
+		if (waiting) {
+			return;
+		}
+		if (it != players.end() || pending != pendingLogins.end()) {
+			localLink->kicked = true;
+			localLink = nullptr;
+			return;
+		}
+
+		pendingLogins[playerName].link = localLink;
+		Login(playerName);
+	}
+	else if (localLink->input.Update()) {
+		HandleInput(it->second, localLink->input.Front());
+	}
+}
+
+void Scene::HandleEvent(ENetEvent& event) {
+	SubsystemScope subsystem(Subsystem::Network);
+	switch (event.type) {
+	case ENET_EVENT_TYPE_CONNECT:
+		break;
+	case ENET_EVENT_TYPE_DISCONNECT:
+	case ENET_EVENT_TYPE_DISCONNECT_TIMEOUT:
+		if (peers.find(event.peer) != peers.end()) {
+			Player* player = peers[event.peer];
+			peers.erase(event.peer);
+			recorder.Disconnect(player->playerName);
+			plugins.OnDisconnect(player->playerName);
+			script.OnDisconnect(player->playerName);
+			players.erase(player->playerName);
+		}
+		else {
+			// The name stays reserved until Game.on_login has returned
+			for (auto& pair : pendingLogins) {
+				if (pair.second.peer == event.peer) {
+					recorder.Disconnect(pair.first);
+					pair.second.peer = nullptr;
+				}
+			}
+		}
+		break;
+	case ENET_EVENT_TYPE_RECEIVE:
+		GetCapture().Write(CaptureDirection::Received, event.data, event.channelID, event.packet);
+		if (event.channelID == 0) {
+			ReadPacket packet(event.packet);
+			std::string playerName = packet.ReadString();
+
+			bool loggingIn = false;
+			for (auto& pair : pendingLogins) {
+				loggingIn = loggingIn || pair.second.peer == event.peer;
+			}
+
+			if (loggingIn || peers.find(event.peer) != peers.end() || players.find(playerName) != players.end() || pendingLogins.find(playerName) != pendingLogins.end()) {
+				Disconnect(event.peer, event.data, false);
 			}
 			else {
-				statePacket.Write8(0);
-				statePacket.Write32(sprite.texture);
-				statePacket.Write32(sprite.animation);
+				PendingLogin& login = pendingLogins[playerName];
+				login.peer = event.peer;
+				login.connectID = event.data;
+				Login(playerName);
+			}
+		}
+		else if (event.channelID == 2 && peers.find(event.peer) != peers.end()) {
+			ReadPacket packet(event.packet);
+			receivedInput.Clear();
+
+			std::uint32_t keyboardInputs = packet.Read32();
+			for (std::uint32_t i = 0; i < keyboardInputs && packet.Remaining() > 0; ++i) {
+				KeyboardInput keyboardInput;
+				keyboardInput.key = packet.Read32();
+				keyboardInput.pressed = packet.Read8();
+				receivedInput.keyboardInputs.push_back(keyboardInput);
+			}
+			std::uint32_t buttonInputs = packet.Read32();
+			for (std::uint32_t i = 0; i < buttonInputs && packet.Remaining() > 0; ++i) {
+				ButtonInput buttonInput;
+				buttonInput.button = packet.Read8();
+				buttonInput.pressed = packet.Read8();
+				receivedInput.buttonInputs.push_back(buttonInput);
 			}
+			receivedInput.mouseMotionX = packet.Read32();
+			receivedInput.mouseMotionY = packet.Read32();
+			receivedInput.mouseMotion = packet.Read8();
+			std::uint32_t textLength;
+			const char* text = packet.ReadString(textLength);
+			receivedInput.textInput.assign(text, textLength);
+
+			HandleInput(*peers[event.peer], receivedInput);
 		}
-		enet_peer_send(pair.second.peer, 1, statePacket.GetPacket(false));
-		pair.second.sprites.clear();
+		enet_packet_destroy(event.packet);
+		break;
+	}
+}
+
+void Scene::Login(const std::string& playerName) {
+	recorder.Login(playerName);
+	if (!plugins.OnLogin(playerName)) {
+		FinishLogin(playerName, false);
+		return;
+	}
+	LoginResult result = script.OnLogin(playerName);
+	if (result != LoginResult::Pending) {
+		FinishLogin(playerName, result == LoginResult::Accepted);
+	}
+}
 
-		WritePacket audioPacket;
-		audioPacket.Write32(static_cast<std::uint32_t>(pair.second.audioCommands.size()));
-		for (const AudioCommand& audioCommand : pair.second.audioCommands) {
-			audioPacket.Write8(static_cast<std::uint8_t>(audioCommand.type));
-			audioPacket.Write8(audioCommand.volume);
-			audioPacket.Write16(audioCommand.channel);
-			audioPacket.Write32(audioCommand.sound);
+void Scene::FinishLogin(const std::string& playerName, bool accepted) {
+	auto it = pendingLogins.find(playerName);
+	if (it == pendingLogins.end()) {
+		return;
+	}
+	PendingLogin login = it->second;
+	pendingLogins.erase(it);
+
+	if (!accepted) {
+		if (login.link) {
+			login.link->kicked = true;
+			if (localLink == login.link) {
+				localLink = nullptr;
+			}
+		}
+		else if (login.peer) {
+			Disconnect(login.peer, login.connectID, false);
 		}
-		enet_peer_send(pair.second.peer, 3, audioPacket.GetPacket(true));
-		pair.second.audioCommands.clear();
+		return;
+	}
+	if (!login.link && !login.peer && !login.replayed) {
+		// The player disconnected while Game.on_login was waiting
+		return;
+	}
+
+	Player& player = players[playerName];
+	player.playerName = playerName;
+	player.peer = login.peer;
+	player.connectID = login.connectID;
+	player.link = login.link;
+	player.lastActivity = GetTicks();
+	player.nextSnapshot = static_cast<double>(player.lastActivity);
+
+	if (login.peer) {
+		peers[login.peer] = &player;
+	}
+
+	plugins.OnJoin(playerName);
+	script.OnJoin(playerName);
+}
+
+void Scene::HandleInput(Player& player, const Input& input) {
+	recorder.Input(player.playerName, input);
+	bool active = false;
+	for (const KeyboardInput& keyboardInput : input.keyboardInputs) {
+		std::string key = GetKeyName(keyboardInput.key);
+		player.keys[key] = keyboardInput.pressed;
+		plugins.OnKeyEvent(player.playerName, key, keyboardInput.pressed);
+		script.OnKeyEvent(player.playerName, key, keyboardInput.pressed);
+		if (keyboardInput.key == HAZARD_KEY_BACKSPACE && keyboardInput.pressed) {
+			std::string& composition = player.composition;
+			while (composition.length() > 0 && (composition[composition.length() - 1] & 0xC0) == 0x80) {
+				composition.erase(composition.end() - 1);
+			}
+			if (composition.length() > 0) {
+				composition.erase(composition.end() - 1);
+			}
+		}
+		active = true;
+	}
+	for (const ButtonInput& buttonInput : input.buttonInputs) {
+		std::string button = GetButtonName(buttonInput.button);
+		player.buttons[button] = buttonInput.pressed;
+		plugins.OnButtonEvent(player.playerName, button, buttonInput.pressed);
+		script.OnButtonEvent(player.playerName, button, buttonInput.pressed);
+		active = true;
+	}
+	if (input.mouseMotion) {
+		player.mouseX = input.mouseMotionX;
+		player.mouseY = input.mouseMotionY;
+		plugins.OnAxisEvent(player.playerName, "Mouse X", input.mouseMotionX);
+		plugins.OnAxisEvent(player.playerName, "Mouse Y", input.mouseMotionY);
+		script.OnAxisEvent(player.playerName, "Mouse X", input.mouseMotionX);
+		script.OnAxisEvent(player.playerName, "Mouse Y", input.mouseMotionY);
+		active = true;
+	}
+	if (input.textInput.length() > 0) {
+		player.composition += input.textInput;
+		active = true;
+	}
+	if (active) {
+		player.lastActivity = GetTicks();
+	}
+}
+
+void Scene::Send(Player& player, std::uint8_t channel, ENetPacket* packet) {
+	SubsystemScope subsystem(Subsystem::Network);
+	player.sentBytes[channel] += packet->dataLength;
+	if (!player.peer) {
+		// Replayed players only cost the serialization
+		enet_packet_destroy(packet);
+	}
+	else if (queue) {
+		GetCapture().Write(CaptureDirection::Sent, player.connectID, channel, packet);
+		queue->Send(player.peer, player.connectID, channel, packet);
+	}
+	else {
+		GetCapture().Write(CaptureDirection::Sent, player.connectID, channel, packet);
+		enet_peer_send(player.peer, channel, packet);
+	}
+}
+
+void Scene::Disconnect(ENetPeer* peer, std::uint32_t connectID, bool now) {
+	if (!peer) {
+		return;
+	}
+	if (queue) {
+		queue->Disconnect(peer, connectID, now);
+	}
+	else if (now) {
+		enet_peer_disconnect_now(peer, 0);
+	}
+	else {
+		enet_peer_disconnect(peer, 0);
 	}
 }
 
 void Scene::Reload() {
 	config.Reload();
+	LoadAssets();
+	script.SetMemoryLimit(config.ScriptMemoryLimit() * 1024ull);
+	script.ConfigureGC(config);
+	script.ConfigureWatchdog(config);
+	GetJobPool().Reload();
+	script.Reload();
+}
 
+void Scene::LoadAssets() {
 	loadedTextures.clear();
 	std::uint32_t i = 0;
 	for (const std::string& texture : config.GetTextures()) {
@@ -218,12 +676,183 @@ void Scene::Reload() {
 	for (const std::string& sound : config.GetSounds()) {
 		loadedSounds[sound] = i++;
 	}
+}
 
-	script.Reload();
+void Scene::StartRecording() {
+	if (!config.Record()) {
+		return;
+	}
+	std::uint64_t seed = static_cast<std::uint64_t>(std::time(nullptr)) * 31 + room;
+	std::string path = "record-room" + std::to_string(room) + '-' + std::to_string(std::time(nullptr)) + ".hzr";
+	if (recorder.Open(path, room, seed, lastTicks)) {
+		script.SetRandomSeed(seed);
+		HAZARD_INFO("Recording room " << room << " to " << path);
+	}
 }
 
-std::vector<std::string> Scene::GetPlayers() {
-	std::vector<std::string> list;
+void Scene::ToggleProfiler() {
+	if (!script.IsProfiling()) {
+		script.StartProfiler(config.ProfilerInstructions(), config.ProfilerInterval());
+		HAZARD_INFO("Profiling room " << room);
+		return;
+	}
+
+	std::string path = "profile-room" + std::to_string(room) + '-' + std::to_string(std::time(nullptr)) + ".folded";
+	if (script.StopProfiler(path)) {
+		HAZARD_INFO("Profile of room " << room << " written to " << path);
+	}
+	else {
+		HAZARD_ERROR("Could not write profile " << path);
+	}
+}
+
+void Scene::RegisterPluginFunctions(lua_State* L) {
+	plugins.RegisterFunctions(L);
+}
+
+std::uint32_t Scene::GetRoom() const {
+	return room;
+}
+
+bool Scene::IsIdle(const Player& player, std::uint64_t now) const {
+	return config.IdleTimeout() > 0 && now - player.lastActivity >= config.IdleTimeout() * 1000ull;
+}
+
+double Scene::GetSnapshotInterval(const Player& player, std::uint64_t now) {
+	double rate = config.SnapshotRate();
+	double minRate = config.MinSnapshotRate();
+	if (IsIdle(player, now)) {
+		rate = minRate;
+	}
+	else if (config.AdaptiveSnapshots() && player.peer) {
+		PeerStats stats = queue ? queue->GetStats(player.peer) : GetPeerStats(player.peer);
+
+		// ENet lowers the packet throttle of a peer when its link is congested
+		rate *= static_cast<double>(stats.packetThrottle) / ENET_PEER_PACKET_THROTTLE_SCALE;
+
+		// Every percent of packet loss reduces the rate by 5 percent
+		double packetLoss = static_cast<double>(stats.packetLoss) / ENET_PEER_PACKET_LOSS_SCALE;
+		rate *= 1.0 - std::min(packetLoss * 5.0, 1.0);
+
+		// Peers with a high round trip time cannot use snapshots faster than they arrive
+		if (stats.roundTripTime > 100) {
+			rate *= 100.0 / stats.roundTripTime;
+		}
+	}
+
+	if (rate < minRate) {
+		rate = minRate;
+	}
+	return 1000.0 / rate;
+}
+
+void Scene::EndPhase(Phase phase, std::uint64_t& phaseStart) {
+	std::uint64_t end = GetMicroseconds();
+	phaseTimes[static_cast<int>(phase)].Add(end - phaseStart);
+	TraceEvent(phaseNames[static_cast<int>(phase)], phaseStart, end);
+	phaseStart = end;
+}
+
+void Scene::PrintStats() {
+	const ArenaStats& arenaStats = tickArena.GetStats();
+
+	// Rooms print from their own threads, so every report is written at once
+	std::ostringstream stats;
+	stats << "STATS: Room " << room << ": " << statsTicks << " ticks, "
+		<< (statsTicks > 0 ? statsTickTime / statsTicks : 0) << " us average tick time, "
+		<< statsMaxTickTime << " us maximum tick time, " << players.size() << " players\n";
+	stats << "STATS: Room " << room << ": Tick arena: " << arenaStats.allocations << " allocations, "
+		<< arenaStats.bytes << " bytes, " << arenaStats.peakBytes << " bytes peak, "
+		<< arenaStats.heapAllocations << " heap allocations\n";
+	const LuaMemoryStats& memoryStats = script.GetMemoryStats();
+	stats << "STATS: Room " << room << ": Lua memory: " << memoryStats.liveBytes << " bytes live, "
+		<< memoryStats.peakBytes << " bytes peak, " << memoryStats.allocations << " allocations, "
+		<< memoryStats.heapAllocations << " heap allocations, " << memoryStats.failedAllocations << " failed allocations\n";
+	const GCStats& gcStats = script.GetGCStats();
+	stats << "STATS: Room " << room << ": GC: " << gcStats.steps << " idle steps, " << gcStats.cycles << " cycles, "
+		<< gcStats.totalTime << " us total, " << gcStats.maxPause << " us maximum pause\n";
+	stats << "STATS: Room " << room << ": Scheduler: " << script.GetTimerCount() << " timers, "
+		<< script.GetWaitingCount() << " waiting coroutines, " << pendingLogins.size() << " pending logins\n";
+
+	stats << "STATS: Room " << room << ": Phases:";
+	for (int i = 0; i < Phases; ++i) {
+		stats << (i > 0 ? ", " : " ") << phaseNames[i] << " p50 " << phaseTimes[i].GetPercentile(0.5)
+			<< " us p99 " << phaseTimes[i].GetPercentile(0.99) << " us max " << phaseTimes[i].GetMax() << " us";
+	}
+	stats << '\n';
+	stats << "STATS: Room " << room << ": Tick histogram:";
+	for (int i = 0; i < Histogram::Buckets; ++i) {
+		if (tickTimes.GetBucket(i) == 0) {
+			continue;
+		}
+		if (i < Histogram::Buckets - 1) {
+			stats << " <" << Histogram::GetBucketLimit(i) << " us " << tickTimes.GetBucket(i) << ',';
+		}
+		else {
+			stats << " >=" << Histogram::GetBucketLimit(i - 1) << " us " << tickTimes.GetBucket(i) << ',';
+		}
+	}
+	const WatchdogStats& watchdogStats = script.GetWatchdogStats();
+	stats << " " << statsOverBudget << " ticks over budget, " << watchdogStats.overruns << " callbacks over budget, "
+		<< watchdogStats.aborts << " aborted callbacks\n";
+	// Rooms run on their own threads, so the allocations of this thread are the
+	// allocations of the room
+	AllocationStats allocations = GetThreadAllocations() - statsAllocations;
+	statsAllocations = GetThreadAllocations();
+	double ticks = static_cast<double>(std::max<std::uint64_t>(statsTicks, 1));
+	stats << "STATS: Room " << room << ": Allocations per tick:" << std::fixed << std::setprecision(1);
+	bool allocated = false;
+	for (std::size_t i = 0; i < Allocators; ++i) {
+		for (std::size_t j = 0; j < Subsystems; ++j) {
+			const AllocationCounter& counter = allocations.counters[i][j];
+			if (counter.allocations == 0) {
+				continue;
+			}
+			stats << (allocated ? ", " : " ") << GetSubsystemName(static_cast<Subsystem>(j)) << '/' << GetAllocatorName(static_cast<Allocator>(i))
+				<< ' ' << counter.allocations / ticks << " (" << counter.bytes / ticks << " bytes, " << counter.frees / ticks << " frees)";
+			allocated = true;
+		}
+	}
+	stats << (allocated ? "" : " none") << (IsTrackingHeap() ? "\n" : ", heap not tracked\n");
+	if (room == 0) {
+		// The job pool and the ENet pool are shared by all rooms
+		JobStats jobStats = GetJobPool().GetStats();
+		stats << "STATS: Jobs: " << jobStats.submitted << " submitted, " << jobStats.completed << " completed, "
+			<< jobStats.failed << " failed, " << jobStats.queued << " queued, " << jobStats.workers << " workers\n";
+
+		PoolStats poolStats = GetENetPool().GetStats();
+		double hitRate = 0.0;
+		if (poolStats.allocations > 0) {
+			hitRate = 100.0 * (poolStats.allocations - poolStats.heapAllocations) / poolStats.allocations;
+		}
+		stats << "STATS: ENet pool: " << poolStats.allocations << " allocations, " << std::fixed << std::setprecision(1) << hitRate << "% hit rate, "
+			<< poolStats.heapAllocations << " heap allocations, " << poolStats.largeAllocations << " large allocations, "
+			<< poolStats.liveBytes << " bytes live, " << poolStats.highWaterBytes << " bytes high water\n";
+	}
+	// The report is logged as one message without the last line break. All
+	// rooms report in the same second, so it bypasses the rate limit of
+	// HAZARD_INFO.
+	if (GetLogger().GetLevel() <= LogLevel::Info) {
+		std::string report = stats.str();
+		report.pop_back();
+		GetLogger().Log(LogLevel::Info, std::move(report));
+	}
+
+	statsTicks = 0;
+	statsTickTime = 0;
+	statsMaxTickTime = 0;
+	statsOverBudget = 0;
+	tickTimes.Clear();
+	for (Histogram& histogram : phaseTimes) {
+		histogram.Clear();
+	}
+	script.ClearWatchdogStats();
+	tickArena.ClearStats();
+}
+
+ArenaVector<std::string_view> Scene::GetPlayers() {
+	ArenaVector<std::string_view> list(&tickArena);
+	list.reserve(players.size());
 	for (const auto& pair : players) {
 		list.push_back(pair.first);
 	}
@@ -238,6 +867,10 @@ void Scene::Kick(const std::string& playerName) {
 	kickedPlayers.push_back(playerName);
 }
 
+bool Scene::IsIdle(const std::string& playerName) {
+	return IsIdle(players[playerName], GetTicks());
+}
+
 bool Scene::IsKeyDown(const std::string& playerName, const std::string& key) {
 	return players[playerName].keys[key];
 }
@@ -262,7 +895,7 @@ const std::string& Scene::GetComposition(const std::string& playerName) {
 	return players[playerName].composition;
 }
 
-void Scene::SetComposition(const std::string& playerName, std::string composition) {
+void Scene::SetComposition(const std::string& playerName, const std::string& composition) {
 	players[playerName].composition = composition;
 }
 
@@ -271,29 +904,11 @@ bool Scene::IsTextureLoaded(const std::string& texture) {
 }
 
 void Scene::DrawSprite(const std::string& playerName, const std::string& texture, std::int32_t x, std::int32_t y, std::uint32_t scale, std::uint32_t animation) {
-	Sprite sprite;
-	sprite.isText = false;
-	sprite.x = x;
-	sprite.y = y;
-	sprite.scale = scale;
-	sprite.texture = loadedTextures[texture];
-	sprite.animation = animation;
-
-	players[playerName].sprites.push_back(sprite);
+	players[playerName].sprites.AddSprite(x, y, scale, loadedTextures[texture], animation);
 }
 
-void Scene::DrawTextSprite(const std::string& playerName, const std::string& text, std::int32_t x, std::int32_t y, std::uint8_t r, std::uint8_t g, std::uint8_t b, std::uint32_t lineLength) {
-	Sprite sprite;
-	sprite.isText = true;
-	sprite.x = x;
-	sprite.y = y;
-	sprite.scale = lineLength;
-	sprite.text = text;
-	sprite.r = r;
-	sprite.g = g;
-	sprite.b = b;
-
-	players[playerName].sprites.push_back(sprite);
+void Scene::DrawTextSprite(const std::string& playerName, const char* text, std::uint32_t length, std::int32_t x, std::int32_t y, std::uint8_t r, std::uint8_t g, std::uint8_t b, std::uint32_t lineLength) {
+	players[playerName].sprites.AddTextSprite(x, y, lineLength, r, g, b, text, length);
 }
 
 bool Scene::IsSoundLoaded(const std::string& sound) {
@@ -343,3 +958,59 @@ void Scene::StopAll(const std::string& playerName) {
 
 	players[playerName].audioCommands.push_back(audioCommand);
 }
+
+void Scene::PublishMetrics() {
+	static const std::pair<double, const char*> quantiles[] = { { 0.5, "0.5" }, { 0.9, "0.9" }, { 0.99, "0.99" } };
+
+	std::vector<MetricSample>& samples = GetMetrics().GetBack(room);
+	samples.clear();
+	std::string roomLabel = MetricLabel("room", std::to_string(room));
+	samples.push_back({ "hazard_ticks_total", roomLabel, static_cast<double>(metricsTicks) });
+	for (const auto& quantile : quantiles) {
+		samples.push_back({ "hazard_tick_seconds", roomLabel + ",quantile=\"" + quantile.second + '"', metricsTickTimes.GetPercentile(quantile.first) / 1e6 });
+	}
+	samples.push_back({ "hazard_tick_seconds_sum", roomLabel, metricsTickTime / 1e6 });
+	samples.push_back({ "hazard_tick_seconds_count", roomLabel, static_cast<double>(metricsTicks) });
+	samples.push_back({ "hazard_lua_seconds_total", roomLabel, script.GetLuaTime() / 1e6 });
+	samples.push_back({ "hazard_players", roomLabel, static_cast<double>(players.size()) });
+	samples.push_back({ "hazard_sprites_total", roomLabel, static_cast<double>(metricsSprites) });
+
+	const LuaMemoryStats& memoryStats = script.GetMemoryStats();
+	samples.push_back({ "hazard_lua_memory_bytes", roomLabel, static_cast<double>(memoryStats.liveBytes) });
+	samples.push_back({ "hazard_lua_allocations_total", roomLabel, static_cast<double>(memoryStats.allocations) });
+
+	const AllocationStats& allocations = GetThreadAllocations();
+	for (std::size_t i = 0; i < Allocators; ++i) {
+		for (std::size_t j = 0; j < Subsystems; ++j) {
+			const AllocationCounter& counter = allocations.counters[i][j];
+			if (counter.allocations == 0) {
+				continue;
+			}
+			std::string labels = roomLabel + ',' + MetricLabel("subsystem", GetSubsystemName(static_cast<Subsystem>(j)))
+				+ ',' + MetricLabel("allocator", GetAllocatorName(static_cast<Allocator>(i)));
+			samples.push_back({ "hazard_allocations_total", labels, static_cast<double>(counter.allocations) });
+			samples.push_back({ "hazard_allocated_bytes_total", labels, static_cast<double>(counter.bytes) });
+		}
+	}
+
+	for (const auto& pair : players) {
+		const Player& player = pair.second;
+		if (!player.peer) {
+			continue;
+		}
+		std::string playerLabels = roomLabel + ',' + MetricLabel("player", player.playerName);
+		PeerStats stats = queue ? queue->GetStats(player.peer) : GetPeerStats(player.peer);
+		samples.push_back({ "hazard_rtt_seconds", playerLabels, stats.roundTripTime / 1e3 });
+		samples.push_back({ "hazard_packet_loss_ratio", playerLabels, static_cast<double>(stats.packetLoss) / ENET_PEER_PACKET_LOSS_SCALE });
+		for (std::uint32_t channel = 0; channel < 4; ++channel) {
+			samples.push_back({ "hazard_sent_bytes_total", playerLabels + ',' + MetricLabel("channel", std::to_string(channel)), static_cast<double>(player.sentBytes[channel]) });
+		}
+	}
+
+	for (const auto& gauge : script.GetGauges()) {
+		samples.push_back({ "hazard_script_" + gauge.first, roomLabel, gauge.second });
+	}
+
+	GetMetrics().Publish(room);
+	metricsTickTimes.Clear();
+}
@@ -3,43 +3,77 @@
 #ifndef Hazard_Scene_h
 #define Hazard_Scene_h
 
+#include <atomic>
 #include <cstdint>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
 #include <enet.h>
 
+#include "Allocations.h"
+#include "Arena.h"
 #include "Common.h"
 #include "Config.h"
+#include "Histogram.h"
+#include "LocalLink.h"
+#include "Net.h"
+#include "Plugins.h"
+#include "Recording.h"
 #include "Script.h"
 
 namespace Hazard {
+	class RoomQueue;
+
 	class Scene {
 	public:
 		Scene(std::string script, Config& config, std::uint16_t port = 0);
+		Scene(std::string script, Config& config, RoomQueue& queue, std::uint32_t room);
+		// Runs a recording without network
+		Scene(std::string script, Config& config, Replayer& replayer);
 		Scene(const Scene&) = delete;
 		~Scene();
 
 		Scene& operator=(const Scene&) = delete;
 
+		void Run(const std::atomic<bool>& running, std::atomic<bool>& shouldReload);
+		// Runs all ticks of the recording as fast as possible and prints how long
+		// they took
+		void RunReplay();
+		// Runs the next tick of the recording, returns false at its end
+		bool ReplayTick();
+
+		void AddLocalPlayer(LocalLink& link);
+
+		bool Wait(std::uint32_t timeout);
 		void Update();
 
 		void Reload();
 
-		std::vector<std::string> GetPlayers();
+		// Completes a login that Game.on_login has deferred
+		void FinishLogin(const std::string& playerName, bool accepted);
+
+		void ToggleProfiler();
+		void RegisterPluginFunctions(lua_State* L);
+
+		std::uint32_t GetRoom() const;
+
+		// The list is only valid until the end of the current tick
+		ArenaVector<std::string_view> GetPlayers();
 		bool IsOnline(const std::string& playerName);
 		void Kick(const std::string& playerName);
+		bool IsIdle(const std::string& playerName);
 
 		bool IsKeyDown(const std::string& playerName, const std::string& key);
 		bool IsButtonDown(const std::string& playerName, const std::string& button);
 		std::int32_t GetAxis(const std::string& playerName, const std::string& axis);
 		const std::string& GetComposition(const std::string& playerName);
-		void SetComposition(const std::string& playerName, std::string composition);
+		void SetComposition(const std::string& playerName, const std::string& composition);
 
 		bool IsTextureLoaded(const std::string& texture);
 		void DrawSprite(const std::string& playerName, const std::string& texture, std::int32_t x, std::int32_t y, std::uint32_t scale, std::uint32_t animation);
-		void DrawTextSprite(const std::string& playerName, const std::string& text, std::int32_t x, std::int32_t y, std::uint8_t r, std::uint8_t g, std::uint8_t b, std::uint32_t lineLength);
+		void DrawTextSprite(const std::string& playerName, const char* text, std::uint32_t length, std::int32_t x, std::int32_t y, std::uint8_t r, std::uint8_t g, std::uint8_t b, std::uint32_t lineLength);
 
 		bool IsSoundLoaded(const std::string& sound);
 		bool IsChannelValid(std::uint16_t channel);
@@ -51,9 +85,11 @@ namespace Hazard {
 	private:
 		struct Player {
 			std::string playerName;
-			ENetPeer* peer;
+			ENetPeer* peer = nullptr;
+			std::uint32_t connectID = 0;
+			LocalLink* link = nullptr;
 
-			std::vector<Sprite> sprites;
+			SpriteBuffer sprites;
 			std::vector<AudioCommand> audioCommands;
 
 			std::string composition;
@@ -61,20 +97,89 @@ namespace Hazard {
 			std::unordered_map<std::string, bool> buttons;
 
 			std::int32_t mouseX = 0, mouseY = 0;
+
+			// Bytes sent on every channel
+			std::uint64_t sentBytes[4] = {};
+
+			std::uint64_t lastActivity = 0;
+			double nextSnapshot = 0;
+		};
+
+		struct PendingLogin {
+			ENetPeer* peer = nullptr;
+			std::uint32_t connectID = 0;
+			LocalLink* link = nullptr;
+			// The player has no connection because it is part of a recording
+			bool replayed = false;
 		};
 
 		ENetHost* host = nullptr;
+		RoomQueue* queue = nullptr;
+		std::uint32_t room = 0;
+		std::vector<ENetEvent> events;
+		Input receivedInput;
+		LocalLink* localLink = nullptr;
+		Recorder recorder;
+		Replayer* replayer = nullptr;
 
 		Config& config;
-		Script script;
 
 		std::unordered_map<std::string, std::uint32_t> loadedTextures;
 		std::unordered_map<std::string, std::uint32_t> loadedSounds;
 
 		std::unordered_map<std::string, Player> players;
+		std::unordered_map<ENetPeer*, Player*> peers;
 		std::vector<std::string> kickedPlayers;
+		std::unordered_map<std::string, PendingLogin> pendingLogins;
 
 		std::uint64_t lastTicks;
+
+		// Memory for objects that are only needed during one tick
+		Arena tickArena;
+
+		// Plugins and scripts can use the players while they are loaded and
+		// unloaded, so they are constructed after and destroyed before them.
+		// Plugins register Lua functions, so they are loaded before the script.
+		Plugins plugins;
+		Script script;
+
+		std::uint64_t nextStats = 0;
+		std::uint64_t statsTicks = 0;
+		std::uint64_t statsTickTime = 0, statsMaxTickTime = 0;
+		std::uint64_t statsOverBudget = 0;
+		AllocationStats statsAllocations;
+
+		// Parts of a tick that are measured separately
+		enum class Phase {
+			Input,
+			Timers,
+			Tick,
+			Send
+		};
+		static constexpr int Phases = 4;
+		Histogram phaseTimes[Phases];
+		Histogram tickTimes;
+
+		std::uint64_t nextMetrics = 0;
+		std::uint64_t metricsTicks = 0, metricsTickTime = 0, metricsSprites = 0;
+		// Only covers the ticks since the last metrics were published
+		Histogram metricsTickTimes;
+
+		void LoadAssets();
+		void StartRecording();
+		void ReplayEvents();
+		void HandleEvent(ENetEvent& event);
+		void Login(const std::string& playerName);
+		void HandleInput(Player& player, const Input& input);
+		void UpdateLocalPlayer();
+		void Send(Player& player, std::uint8_t channel, ENetPacket* packet);
+		void Disconnect(ENetPeer* peer, std::uint32_t connectID, bool now);
+		bool IsIdle(const Player& player, std::uint64_t now) const;
+		double GetSnapshotInterval(const Player& player, std::uint64_t now);
+		// Adds the time since 'phaseStart' to the phase and starts the next one
+		void EndPhase(Phase phase, std::uint64_t& phaseStart);
+		void PrintStats();
+		void PublishMetrics();
 	};
 }
 
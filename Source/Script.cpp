@@ -1,23 +1,38 @@
 // Copyright 2022 Justus Zorn
 
-#include <iostream>
+#include <array>
+#include <deque>
+#include <new>
 #include <vector>
 
-#include <SDL.h>
-
+#include "Allocations.h"
+#include "Bytecode.h"
+#include "Clock.h"
+#include "Log.h"
 #include "Scene.h"
 #include "Script.h"
+#include "Serializer.h"
 
 using namespace Hazard;
 
-Script::Script(std::string path, Scene* scene) : path{ path }, scene{ scene } {
-	L = luaL_newstate();
+// Bindings can run callbacks that call bindings again, so every level of
+// nesting has its own argument buffers. A deque keeps the buffers of the
+// outer levels in place when it grows.
+static thread_local std::deque<std::array<std::string, Script::MaxStringArguments>> argumentBuffers;
+static thread_local std::size_t callbackDepth = 0;
+
+Script::Script(std::string path, Scene* scene, std::size_t memoryLimit) : path{ path }, scene{ scene }, allocator(memoryLimit), timerWheel(Hazard::GetTicks()) {
+	L = allocator.NewState();
 	if (!L) {
-		std::cerr << "ERROR: Lua initialization failed\n";
+		HAZARD_ERROR("Lua initialization failed");
 		return;
 	}
+	// Coroutines copy the extra space of the main thread, so the hook can
+	// always find the script
+	*static_cast<Script**>(lua_getextraspace(L)) = this;
 
 	luaL_openlibs(L);
+	AddCachedSearcher(L);
 
 	Reload();
 }
@@ -27,6 +42,9 @@ Script::~Script() {
 }
 
 void Script::Reload() {
+	ClearTimers();
+	gauges.clear();
+
 	lua_newtable(L);
 	lua_setglobal(L, "Game");
 
@@ -42,6 +60,10 @@ void Script::Reload() {
 	lua_pushcclosure(L, Kick, 1);
 	lua_setglobal(L, "kick");
 
+	lua_pushlightuserdata(L, scene);
+	lua_pushcclosure(L, IsIdle, 1);
+	lua_setglobal(L, "is_idle");
+
 	lua_pushlightuserdata(L, scene);
 	lua_pushcclosure(L, IsKeyDown, 1);
 	lua_setglobal(L, "is_key_down");
@@ -85,41 +107,194 @@ void Script::Reload() {
 	lua_pushcclosure(L, GetTicks, 0);
 	lua_setglobal(L, "get_ticks");
 
-	if (luaL_dofile(L, path.c_str()) != LUA_OK) {
-		std::cerr << "ERROR: Error while loading Lua script: " << lua_tostring(L, -1) << '\n';
+	lua_pushlightuserdata(L, scene);
+	lua_pushcclosure(L, GetRoom, 1);
+	lua_setglobal(L, "get_room");
+
+	lua_pushcclosure(L, GetMemoryStats, 0);
+	lua_setglobal(L, "get_memory_stats");
+
+	lua_pushlightuserdata(L, this);
+	lua_pushcclosure(L, GetGCStats, 1);
+	lua_setglobal(L, "get_gc_stats");
+
+	lua_pushlightuserdata(L, this);
+	lua_pushcclosure(L, SetGauge, 1);
+	lua_setglobal(L, "set_gauge");
+
+	lua_pushlightuserdata(L, this);
+	lua_pushcclosure(L, SetTimeout, 1);
+	lua_setglobal(L, "set_timeout");
+
+	lua_pushlightuserdata(L, this);
+	lua_pushcclosure(L, SetInterval, 1);
+	lua_setglobal(L, "set_interval");
+
+	lua_pushlightuserdata(L, this);
+	lua_pushcclosure(L, CancelTimer, 1);
+	lua_setglobal(L, "cancel_timer");
+
+	lua_pushlightuserdata(L, this);
+	lua_pushcclosure(L, Wait, 1);
+	lua_setglobal(L, "wait");
+
+	lua_pushcclosure(L, RunJob, 0);
+	lua_setglobal(L, "run_job");
+
+	if (luaL_newmetatable(L, "Hazard.Job")) {
+		lua_pushcfunction(L, FreeJob);
+		lua_setfield(L, -2, "__gc");
+
+		lua_newtable(L);
+		lua_pushcfunction(L, IsJobDone);
+		lua_setfield(L, -2, "done");
+		lua_pushcfunction(L, GetJobResult);
+		lua_setfield(L, -2, "result");
+		lua_pushlightuserdata(L, this);
+		lua_pushcclosure(L, AwaitJob, 1);
+		lua_setfield(L, -2, "await");
+		lua_setfield(L, -2, "__index");
+	}
+	lua_pop(L, 1);
+
+	scene->RegisterPluginFunctions(L);
+
+	if (LoadCachedFile(L, path) != LUA_OK || lua_pcall(L, 0, LUA_MULTRET, 0) != LUA_OK) {
+		HAZARD_ERROR("Error while loading Lua script: " << lua_tostring(L, -1));
+	}
+}
+
+void Script::SetMemoryLimit(std::size_t memoryLimit) {
+	allocator.SetLimit(memoryLimit);
+}
+
+const LuaMemoryStats& Script::GetMemoryStats() const {
+	return allocator.GetStats();
+}
+
+void Script::ConfigureGC(const Config& config) {
+	// Parameters of 0 keep the current values of Lua
+	generationalGC = config.GenerationalGC();
+	if (generationalGC) {
+		lua_gc(L, LUA_GCGEN, static_cast<int>(config.GCMinorMultiplier()), static_cast<int>(config.GCMajorMultiplier()));
+		gcGrowth = config.GCMinorMultiplier() > 0 ? config.GCMinorMultiplier() : 20;
+	}
+	else {
+		lua_gc(L, LUA_GCINC, static_cast<int>(config.GCPause()), static_cast<int>(config.GCStepMultiplier()), static_cast<int>(config.GCStepSize()));
+		gcGrowth = config.GCPause() > 100 ? config.GCPause() - 100 : 100;
+	}
+	collecting = false;
+}
+
+void Script::CollectGarbage(std::uint64_t budget) {
+	std::uint64_t liveBytes = allocator.GetStats().liveBytes;
+	if (!collecting) {
+		// A new cycle is started once the heap has grown half as much as the
+		// automatic collector waits for, so that it rarely gets the chance to run
+		if (liveBytes < gcBase + gcBase * gcGrowth / 200) {
+			return;
+		}
+		collecting = true;
+	}
+
+	std::uint64_t start = GetMicroseconds();
+	std::uint64_t now = start;
+	do {
+		// In generational mode, every step is a complete minor collection
+		bool finished = lua_gc(L, LUA_GCSTEP, 0) || generationalGC;
+
+		std::uint64_t end = GetMicroseconds();
+		++gcStats.steps;
+		if (end - now > gcStats.maxPause) {
+			gcStats.maxPause = end - now;
+		}
+		now = end;
+
+		if (finished) {
+			++gcStats.cycles;
+			collecting = false;
+			gcBase = allocator.GetStats().liveBytes;
+			break;
+		}
+	} while (now - start < budget);
+
+	gcStats.totalTime += now - start;
+}
+
+const GCStats& Script::GetGCStats() const {
+	return gcStats;
+}
+
+void Script::RunTimers() {
+	std::uint64_t now = Hazard::GetTicks();
+	expiredTimers.clear();
+	timerWheel.Advance(now, expiredTimers);
+
+	for (const TimerWheel::Entry& entry : expiredTimers) {
+		auto it = timers.find(entry.id);
+		if (it == timers.end()) {
+			// The timer was cancelled
+			continue;
+		}
+		Timer timer = it->second;
+
+		if (timer.coroutine) {
+			timers.erase(it);
+			if (tasks.find(timer.ref) == tasks.end()) {
+				// The callback of the coroutine already ended
+				continue;
+			}
+			lua_rawgeti(L, LUA_REGISTRYINDEX, timer.ref);
+			lua_State* co = lua_tothread(L, -1);
+			lua_pop(L, 1);
+			Resume(co, timer.ref, 0);
+			continue;
+		}
+
+		lua_rawgeti(L, LUA_REGISTRYINDEX, timer.ref);
+		if (timer.interval > 0) {
+			// Intervals that fell behind skip the missed calls
+			std::uint64_t expiry = entry.expiry + timer.interval;
+			timerWheel.Add(entry.id, expiry > now ? expiry : now + 1);
+		}
+		else {
+			luaL_unref(L, LUA_REGISTRYINDEX, timer.ref);
+			timers.erase(it);
+		}
+
+		Task task;
+		task.callback = "timer";
+		Start(task, 0);
+		lua_settop(L, 0);
 	}
 }
 
 void Script::OnTick(double dt) {
 	if (GetFunction("on_tick")) {
 		lua_pushnumber(L, dt);
-		if (lua_pcall(L, 1, 0, 0) != LUA_OK) {
-			std::cerr << "ERROR: Error while calling Game.on_tick: " << lua_tostring(L, -1) << '\n';
-		}
+		Task task;
+		task.callback = "Game.on_tick";
+		Start(task, 1);
 	}
 	
 	lua_settop(L, 0);
 }
 
-bool Script::OnLogin(const std::string& playerName) {
-	bool result = false;
+LoginResult Script::OnLogin(const std::string& playerName) {
+	LoginResult result = LoginResult::Accepted;
 	if (GetFunction("on_login")) {
 		lua_pushstring(L, playerName.c_str());
-		if (lua_pcall(L, 1, 1, 0) != LUA_OK) {
-			std::cerr << "ERROR: Error while calling Game.on_login: " << lua_tostring(L, -1) << '\n';
+		Task task;
+		task.callback = "Game.on_login";
+		task.login = true;
+		task.playerName = playerName;
+		if (Start(task, 1) == LUA_YIELD) {
+			result = LoginResult::Pending;
 		}
 		else {
-			if (!lua_isboolean(L, -1)) {
-				std::cerr << "ERROR: Error while calling Game.on_login: Function must return a boolean\n";
-			}
-			else {
-				result = lua_toboolean(L, -1);
-			}
+			result = loginAccepted ? LoginResult::Accepted : LoginResult::Rejected;
 		}
 	}
-	else {
-		result = true;
-	}
 
 	lua_settop(L, 0);
 	return result;
@@ -128,9 +303,9 @@ bool Script::OnLogin(const std::string& playerName) {
 void Script::OnJoin(const std::string& playerName) {
 	if (GetFunction("on_join")) {
 		lua_pushstring(L, playerName.c_str());
-		if (lua_pcall(L, 1, 0, 0) != LUA_OK) {
-			std::cerr << "ERROR: Error while calling Game.on_join: " << lua_tostring(L, -1) << '\n';
-		}
+		Task task;
+		task.callback = "Game.on_join";
+		Start(task, 1);
 	}
 
 	lua_settop(L, 0);
@@ -139,9 +314,9 @@ void Script::OnJoin(const std::string& playerName) {
 void Script::OnDisconnect(const std::string& playerName) {
 	if (GetFunction("on_disconnect")) {
 		lua_pushstring(L, playerName.c_str());
-		if (lua_pcall(L, 1, 0, 0) != LUA_OK) {
-			std::cerr << "ERROR: Error while calling Game.on_disconnect: " << lua_tostring(L, -1) << '\n';
-		}
+		Task task;
+		task.callback = "Game.on_disconnect";
+		Start(task, 1);
 	}
 
 	lua_settop(L, 0);
@@ -152,9 +327,9 @@ void Script::OnKeyEvent(const std::string& playerName, const std::string& key, b
 		lua_pushstring(L, playerName.c_str());
 		lua_pushstring(L, key.c_str());
 		lua_pushboolean(L, pressed);
-		if (lua_pcall(L, 3, 0, 0) != LUA_OK) {
-			std::cerr << "ERROR: Error while calling Game.on_key_event: " << lua_tostring(L, -1) << '\n';
-		}
+		Task task;
+		task.callback = "Game.on_key_event";
+		Start(task, 3);
 	}
 
 	lua_settop(L, 0);
@@ -165,9 +340,9 @@ void Script::OnButtonEvent(const std::string& playerName, const std::string& but
 		lua_pushstring(L, playerName.c_str());
 		lua_pushstring(L, button.c_str());
 		lua_pushboolean(L, pressed);
-		if (lua_pcall(L, 3, 0, 0) != LUA_OK) {
-			std::cerr << "ERROR: Error while calling Game.on_button_event: " << lua_tostring(L, -1) << '\n';
-		}
+		Task task;
+		task.callback = "Game.on_button_event";
+		Start(task, 3);
 	}
 
 	lua_settop(L, 0);
@@ -178,23 +353,55 @@ void Script::OnAxisEvent(const std::string& playerName, const std::string& axis,
 		lua_pushstring(L, playerName.c_str());
 		lua_pushstring(L, axis.c_str());
 		lua_pushinteger(L, state);
-		if (lua_pcall(L, 3, 0, 0) != LUA_OK) {
-			std::cerr << "ERROR: Error while calling Game.on_axis_event: " << lua_tostring(L, -1) << '\n';
-		}
+		Task task;
+		task.callback = "Game.on_axis_event";
+		Start(task, 3);
 	}
 
 	lua_settop(L, 0);
 }
 
+void Script::ResumeJobs() {
+	for (std::size_t i = 0; i < jobWaits.size();) {
+		if (!jobWaits[i].job->done.load(std::memory_order_acquire)) {
+			++i;
+			continue;
+		}
+		int ref = jobWaits[i].ref;
+		jobWaits[i] = std::move(jobWaits.back());
+		jobWaits.pop_back();
+		if (tasks.find(ref) == tasks.end()) {
+			continue;
+		}
+
+		lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+		lua_State* co = lua_tothread(L, -1);
+		lua_pop(L, 1);
+		Resume(co, ref, 0);
+	}
+}
+
+std::size_t Script::GetTimerCount() const {
+	std::size_t count = 0;
+	for (const auto& pair : timers) {
+		count += !pair.second.coroutine;
+	}
+	return count;
+}
+
+std::size_t Script::GetWaitingCount() const {
+	return tasks.size();
+}
+
 int Script::GetPlayers(lua_State* L) {
 	Scene* scene = reinterpret_cast<Scene*>(lua_touserdata(L, lua_upvalueindex(1)));
-	std::vector<std::string> players = scene->GetPlayers();
+	ArenaVector<std::string_view> players = scene->GetPlayers();
 
 	lua_createtable(L, static_cast<int>(players.size()), 0);
 
 	std::uint32_t i = 1;
-	for (const std::string& player : players) {
-		lua_pushstring(L, player.c_str());
+	for (std::string_view player : players) {
+		lua_pushlstring(L, player.data(), player.length());
 		lua_rawseti(L, -2, i);
 		++i;
 	}
@@ -204,14 +411,14 @@ int Script::GetPlayers(lua_State* L) {
 
 int Script::IsOnline(lua_State* L) {
 	Scene* scene = reinterpret_cast<Scene*>(lua_touserdata(L, lua_upvalueindex(1)));
-	std::string playerName = luaL_checkstring(L, 1);
+	const std::string& playerName = CheckString<1>(L);
 	lua_pushboolean(L, scene->IsOnline(playerName));
 	return 1;
 }
 
 int Script::Kick(lua_State* L) {
 	Scene* scene = reinterpret_cast<Scene*>(lua_touserdata(L, lua_upvalueindex(1)));
-	std::string playerName = luaL_checkstring(L, 1);
+	const std::string& playerName = CheckString<1>(L);
 	if (!scene->IsOnline(playerName)) {
 		return luaL_error(L, "Player %s is not online", playerName.c_str());
 	}
@@ -219,42 +426,52 @@ int Script::Kick(lua_State* L) {
 	return 0;
 }
 
+int Script::IsIdle(lua_State* L) {
+	Scene* scene = reinterpret_cast<Scene*>(lua_touserdata(L, lua_upvalueindex(1)));
+	const std::string& playerName = CheckString<1>(L);
+	if (!scene->IsOnline(playerName)) {
+		return luaL_error(L, "Player %s is not online", playerName.c_str());
+	}
+	lua_pushboolean(L, scene->IsIdle(playerName));
+	return 1;
+}
+
 int Script::IsKeyDown(lua_State* L) {
 	Scene* scene = reinterpret_cast<Scene*>(lua_touserdata(L, lua_upvalueindex(1)));
-	std::string playerName = luaL_checkstring(L, 1);
+	const std::string& playerName = CheckString<1>(L);
 	if (!scene->IsOnline(playerName)) {
 		return luaL_error(L, "Player %s is not online", playerName.c_str());
 	}
-	std::string key = luaL_checkstring(L, 2);
+	const std::string& key = CheckString<2>(L);
 	lua_pushboolean(L, scene->IsKeyDown(playerName, key));
 	return 1;
 }
 
 int Script::IsButtonDown(lua_State* L) {
 	Scene* scene = reinterpret_cast<Scene*>(lua_touserdata(L, lua_upvalueindex(1)));
-	std::string playerName = luaL_checkstring(L, 1);
+	const std::string& playerName = CheckString<1>(L);
 	if (!scene->IsOnline(playerName)) {
 		return luaL_error(L, "Player %s is not online", playerName.c_str());
 	}
-	std::string button = luaL_checkstring(L, 2);
+	const std::string& button = CheckString<2>(L);
 	lua_pushboolean(L, scene->IsButtonDown(playerName, button));
 	return 1;
 }
 
 int Script::GetAxis(lua_State* L) {
 	Scene* scene = reinterpret_cast<Scene*>(lua_touserdata(L, lua_upvalueindex(1)));
-	std::string playerName = luaL_checkstring(L, 1);
+	const std::string& playerName = CheckString<1>(L);
 	if (!scene->IsOnline(playerName)) {
 		return luaL_error(L, "Player %s is not online", playerName.c_str());
 	}
-	std::string axis = luaL_checkstring(L, 2);
+	const std::string& axis = CheckString<2>(L);
 	lua_pushinteger(L, scene->GetAxis(playerName, axis));
 	return 1;
 }
 
 int Script::GetComposition(lua_State* L) {
 	Scene* scene = reinterpret_cast<Scene*>(lua_touserdata(L, lua_upvalueindex(1)));
-	std::string playerName = luaL_checkstring(L, 1);
+	const std::string& playerName = CheckString<1>(L);
 	if (!scene->IsOnline(playerName)) {
 		return luaL_error(L, "Player %s is not online", playerName.c_str());
 	}
@@ -264,22 +481,22 @@ int Script::GetComposition(lua_State* L) {
 
 int Script::SetComposition(lua_State* L) {
 	Scene* scene = reinterpret_cast<Scene*>(lua_touserdata(L, lua_upvalueindex(1)));
-	std::string playerName = luaL_checkstring(L, 1);
+	const std::string& playerName = CheckString<1>(L);
 	if (!scene->IsOnline(playerName)) {
 		return luaL_error(L, "Player %s is not online", playerName.c_str());
 	}
-	std::string composition = luaL_checkstring(L, 2);
+	const std::string& composition = CheckString<2>(L);
 	scene->SetComposition(playerName, composition);
 	return 0;
 }
 
 int Script::DrawSprite(lua_State* L) {
 	Scene* scene = reinterpret_cast<Scene*>(lua_touserdata(L, lua_upvalueindex(1)));
-	std::string playerName = luaL_checkstring(L, 1);
+	const std::string& playerName = CheckString<1>(L);
 	if (!scene->IsOnline(playerName)) {
 		return luaL_error(L, "Player %s is not online", playerName.c_str());
 	}
-	std::string texture = luaL_checkstring(L, 2);
+	const std::string& texture = CheckString<2>(L);
 	if (!scene->IsTextureLoaded(texture)) {
 		return luaL_error(L, "Texture %s is not loaded", texture.c_str());
 	}
@@ -293,7 +510,7 @@ int Script::DrawSprite(lua_State* L) {
 		if (lua_gettop(L) > 6) {
 			start = static_cast<std::uint32_t>(luaL_checknumber(L, 7));
 		}
-		animation = static_cast<std::uint32_t>((SDL_GetTicks64() - start) / frameTime);
+		animation = static_cast<std::uint32_t>((Hazard::GetTicks() - start) / frameTime);
 	}
 
 	scene->DrawSprite(playerName, texture, x, y, scale, animation);
@@ -303,11 +520,12 @@ int Script::DrawSprite(lua_State* L) {
 
 int Script::DrawTextSprite(lua_State* L) {
 	Scene* scene = reinterpret_cast<Scene*>(lua_touserdata(L, lua_upvalueindex(1)));
-	std::string playerName = luaL_checkstring(L, 1);
+	const std::string& playerName = CheckString<1>(L);
 	if (!scene->IsOnline(playerName)) {
 		return luaL_error(L, "Player %s is not online", playerName.c_str());
 	}
-	std::string text = luaL_checkstring(L, 2);
+	std::size_t length;
+	const char* text = luaL_checklstring(L, 2, &length);
 	std::int32_t x = static_cast<std::int32_t>(luaL_checknumber(L, 3));
 	std::int32_t y = static_cast<std::int32_t>(luaL_checknumber(L, 4));
 	std::uint8_t r = static_cast<std::uint8_t>(luaL_checknumber(L, 5));
@@ -318,18 +536,18 @@ int Script::DrawTextSprite(lua_State* L) {
 		lineLength = static_cast<std::uint32_t>(luaL_checknumber(L, 8));
 	}
 
-	scene->DrawTextSprite(playerName, text, x, y, r, g, b, lineLength);
+	scene->DrawTextSprite(playerName, text, static_cast<std::uint32_t>(length), x, y, r, g, b, lineLength);
 
 	return 0;
 }
 
 int Script::Play(lua_State* L) {
 	Scene* scene = reinterpret_cast<Scene*>(lua_touserdata(L, lua_upvalueindex(1)));
-	std::string playerName = luaL_checkstring(L, 1);
+	const std::string& playerName = CheckString<1>(L);
 	if (!scene->IsOnline(playerName)) {
 		return luaL_error(L, "Player %s is not online", playerName.c_str());
 	}
-	std::string sound = luaL_checkstring(L, 2);
+	const std::string& sound = CheckString<2>(L);
 	if (!scene->IsSoundLoaded(sound)) {
 		return luaL_error(L, "Sound %s is not loaded", sound.c_str());
 	}
@@ -353,7 +571,7 @@ int Script::Play(lua_State* L) {
 
 int Script::Stop(lua_State* L) {
 	Scene* scene = reinterpret_cast<Scene*>(lua_touserdata(L, lua_upvalueindex(1)));
-	std::string playerName = luaL_checkstring(L, 1);
+	const std::string& playerName = CheckString<1>(L);
 	if (!scene->IsOnline(playerName)) {
 		return luaL_error(L, "Player %s is not online", playerName.c_str());
 	}
@@ -367,7 +585,7 @@ int Script::Stop(lua_State* L) {
 
 int Script::StopAll(lua_State* L) {
 	Scene* scene = reinterpret_cast<Scene*>(lua_touserdata(L, lua_upvalueindex(1)));
-	std::string playerName = luaL_checkstring(L, 1);
+	const std::string& playerName = CheckString<1>(L);
 	if (!scene->IsOnline(playerName)) {
 		return luaL_error(L, "Player %s is not online", playerName.c_str());
 	}
@@ -376,14 +594,476 @@ int Script::StopAll(lua_State* L) {
 }
 
 int Script::GetTicks(lua_State* L) {
-	lua_pushinteger(L, static_cast<lua_Integer>(SDL_GetTicks64()));
+	lua_pushinteger(L, static_cast<lua_Integer>(Hazard::GetTicks()));
+	return 1;
+}
+
+int Script::GetRoom(lua_State* L) {
+	Scene* scene = reinterpret_cast<Scene*>(lua_touserdata(L, lua_upvalueindex(1)));
+	lua_pushinteger(L, scene->GetRoom());
+	return 1;
+}
+
+int Script::GetMemoryStats(lua_State* L) {
+	void* allocator;
+	lua_getallocf(L, &allocator);
+	const LuaMemoryStats& stats = static_cast<LuaAllocator*>(allocator)->GetStats();
+
+	lua_createtable(L, 0, 5);
+	lua_pushinteger(L, static_cast<lua_Integer>(stats.liveBytes));
+	lua_setfield(L, -2, "live");
+	lua_pushinteger(L, static_cast<lua_Integer>(stats.peakBytes));
+	lua_setfield(L, -2, "peak");
+	lua_pushinteger(L, static_cast<lua_Integer>(stats.limit));
+	lua_setfield(L, -2, "limit");
+	lua_pushinteger(L, static_cast<lua_Integer>(stats.allocations));
+	lua_setfield(L, -2, "allocations");
+	lua_pushinteger(L, static_cast<lua_Integer>(stats.failedAllocations));
+	lua_setfield(L, -2, "failed_allocations");
+	return 1;
+}
+
+int Script::GetGCStats(lua_State* L) {
+	Script* script = reinterpret_cast<Script*>(lua_touserdata(L, lua_upvalueindex(1)));
+	const GCStats& stats = script->GetGCStats();
+
+	lua_createtable(L, 0, 4);
+	lua_pushinteger(L, static_cast<lua_Integer>(stats.steps));
+	lua_setfield(L, -2, "steps");
+	lua_pushinteger(L, static_cast<lua_Integer>(stats.cycles));
+	lua_setfield(L, -2, "cycles");
+	lua_pushinteger(L, static_cast<lua_Integer>(stats.totalTime));
+	lua_setfield(L, -2, "total_time");
+	lua_pushinteger(L, static_cast<lua_Integer>(stats.maxPause));
+	lua_setfield(L, -2, "max_pause");
+	return 1;
+}
+
+int Script::SetGauge(lua_State* L) {
+	Script* script = reinterpret_cast<Script*>(lua_touserdata(L, lua_upvalueindex(1)));
+	const std::string& name = CheckString<1>(L);
+	if (name.empty() || name.find_first_not_of("abcdefghijklmnopqrstuvwxyz0123456789_") != std::string::npos) {
+		return luaL_error(L, "Invalid gauge name, must only contain lowercase letters, digits and underscores");
+	}
+	if (lua_isnoneornil(L, 2)) {
+		script->gauges.erase(name);
+	}
+	else {
+		script->gauges[name] = static_cast<double>(luaL_checknumber(L, 2));
+	}
+	return 0;
+}
+
+int Script::SetTimeout(lua_State* L) {
+	Script* script = reinterpret_cast<Script*>(lua_touserdata(L, lua_upvalueindex(1)));
+	lua_Integer delay = luaL_checkinteger(L, 1);
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+	if (delay < 0) {
+		return luaL_error(L, "Invalid delay, must not be negative");
+	}
+	lua_settop(L, 2);
+	lua_pushinteger(L, script->AddTimer(luaL_ref(L, LUA_REGISTRYINDEX), static_cast<std::uint64_t>(delay), 0, false));
+	return 1;
+}
+
+int Script::SetInterval(lua_State* L) {
+	Script* script = reinterpret_cast<Script*>(lua_touserdata(L, lua_upvalueindex(1)));
+	lua_Integer interval = luaL_checkinteger(L, 1);
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+	if (interval <= 0 || interval > 0xFFFFFFFF) {
+		return luaL_error(L, "Invalid interval, must be greater than 0");
+	}
+	lua_settop(L, 2);
+	std::uint32_t milliseconds = static_cast<std::uint32_t>(interval);
+	lua_pushinteger(L, script->AddTimer(luaL_ref(L, LUA_REGISTRYINDEX), milliseconds, milliseconds, false));
 	return 1;
 }
 
+int Script::CancelTimer(lua_State* L) {
+	Script* script = reinterpret_cast<Script*>(lua_touserdata(L, lua_upvalueindex(1)));
+	lua_Integer id = luaL_checkinteger(L, 1);
+	auto it = script->timers.find(static_cast<std::uint32_t>(id));
+	if (it != script->timers.end() && !it->second.coroutine) {
+		luaL_unref(L, LUA_REGISTRYINDEX, it->second.ref);
+		script->timers.erase(it);
+	}
+	return 0;
+}
+
+int Script::Wait(lua_State* L) {
+	Script* script = reinterpret_cast<Script*>(lua_touserdata(L, lua_upvalueindex(1)));
+	lua_Integer delay = luaL_checkinteger(L, 1);
+	if (delay < 0) {
+		return luaL_error(L, "Invalid delay, must not be negative");
+	}
+	if (L != script->running) {
+		return luaL_error(L, "wait can only be used in callbacks and timers");
+	}
+	if (!lua_isyieldable(L)) {
+		// For example in a comparator of table.sort
+		return luaL_error(L, "wait cannot be used inside a function that is called by C");
+	}
+
+	script->AddTimer(script->runningRef, static_cast<std::uint64_t>(delay), 0, true);
+	script->waiting = true;
+	return lua_yield(L, 0);
+}
+
+int Script::RunJob(lua_State* L) {
+	std::shared_ptr<Job> job = std::make_shared<Job>();
+	job->module = CheckString<1>(L);
+	job->function = CheckString<2>(L);
+
+	std::string error;
+	if (!SerializeValues(L, 3, lua_gettop(L) - 2, job->data, error)) {
+		return luaL_error(L, "Invalid job argument: %s", error.c_str());
+	}
+
+	std::shared_ptr<Job>* future = static_cast<std::shared_ptr<Job>*>(lua_newuserdatauv(L, sizeof(std::shared_ptr<Job>), 0));
+	new (future) std::shared_ptr<Job>(job);
+	luaL_setmetatable(L, "Hazard.Job");
+
+	if (!GetJobPool().Submit(std::move(job))) {
+		return luaL_error(L, "Jobs are disabled");
+	}
+	return 1;
+}
+
+int Script::IsJobDone(lua_State* L) {
+	std::shared_ptr<Job>& job = *static_cast<std::shared_ptr<Job>*>(luaL_checkudata(L, 1, "Hazard.Job"));
+	lua_pushboolean(L, job->done.load(std::memory_order_acquire));
+	return 1;
+}
+
+int Script::GetJobResult(lua_State* L) {
+	std::shared_ptr<Job>& job = *static_cast<std::shared_ptr<Job>*>(luaL_checkudata(L, 1, "Hazard.Job"));
+	if (!job->done.load(std::memory_order_acquire)) {
+		return luaL_error(L, "Job is not finished");
+	}
+	return PushJobResult(L, *job);
+}
+
+int Script::AwaitJob(lua_State* L) {
+	Script* script = reinterpret_cast<Script*>(lua_touserdata(L, lua_upvalueindex(1)));
+	std::shared_ptr<Job>& job = *static_cast<std::shared_ptr<Job>*>(luaL_checkudata(L, 1, "Hazard.Job"));
+	if (job->done.load(std::memory_order_acquire)) {
+		return PushJobResult(L, *job);
+	}
+	if (L != script->running) {
+		return luaL_error(L, "await can only be used in callbacks and timers");
+	}
+	if (!lua_isyieldable(L)) {
+		return luaL_error(L, "await cannot be used inside a function that is called by C");
+	}
+
+	script->jobWaits.push_back({ job, script->runningRef });
+	script->waiting = true;
+	lua_settop(L, 1);
+	return lua_yieldk(L, 0, 0, ContinueAwaitJob);
+}
+
+int Script::ContinueAwaitJob(lua_State* L, int, lua_KContext) {
+	// The job is still at index 1 when the coroutine is resumed
+	std::shared_ptr<Job>& job = *static_cast<std::shared_ptr<Job>*>(lua_touserdata(L, 1));
+	return PushJobResult(L, *job);
+}
+
+int Script::FreeJob(lua_State* L) {
+	std::shared_ptr<Job>* job = static_cast<std::shared_ptr<Job>*>(luaL_checkudata(L, 1, "Hazard.Job"));
+	job->~shared_ptr();
+	return 0;
+}
+
+int Script::PushJobResult(lua_State* L, const Job& job) {
+	if (job.failed) {
+		lua_pushlstring(L, reinterpret_cast<const char*>(job.data.data()), job.data.size());
+		return lua_error(L);
+	}
+	int results = DeserializeValues(L, job.data.data(), job.data.size());
+	if (results < 0) {
+		return luaL_error(L, "Invalid job result");
+	}
+	return results;
+}
+
+std::uint32_t Script::AddTimer(int ref, std::uint64_t delay, std::uint32_t interval, bool coroutine) {
+	// 0 is never used as an id
+	do {
+		++nextTimerID;
+	} while (nextTimerID == 0 || timers.find(nextTimerID) != timers.end());
+
+	Timer& timer = timers[nextTimerID];
+	timer.ref = ref;
+	timer.interval = interval;
+	timer.coroutine = coroutine;
+
+	timerWheel.Add(nextTimerID, Hazard::GetTicks() + delay);
+	return nextTimerID;
+}
+
+int Script::Start(Task& task, int nargs) {
+	// The function and its arguments are on top of the stack, and are moved
+	// into a coroutine from the pool
+	lua_State* co;
+	int ref;
+	if (coroutines.size() > 0) {
+		ref = coroutines.back();
+		coroutines.pop_back();
+		lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+		co = lua_tothread(L, -1);
+		lua_pop(L, 1);
+	}
+	else {
+		co = lua_newthread(L);
+		ref = luaL_ref(L, LUA_REGISTRYINDEX);
+	}
+	lua_xmove(L, co, nargs + 1);
+
+	tasks[ref] = std::move(task);
+	return Resume(co, ref, nargs);
+}
+
+int Script::Resume(lua_State* co, int ref, int nargs) {
+	auto current = tasks.find(ref);
+	if (current == tasks.end()) {
+		return LUA_ERRRUN;
+	}
+
+	SubsystemScope subsystem(Subsystem::Script);
+	lua_State* previous = running;
+	int previousRef = runningRef;
+	const char* previousName = runningName;
+	running = co;
+	runningRef = ref;
+	runningName = current->second.callback.c_str();
+	waiting = false;
+	SetHook(co);
+
+	int results;
+	std::uint64_t start = Hazard::GetMicroseconds();
+	++callbackDepth;
+	int status = lua_resume(co, L, nargs, &results);
+	--callbackDepth;
+	if (!previous) {
+		// Nested callbacks are already part of the outer one
+		luaTime += Hazard::GetMicroseconds() - start;
+	}
+
+	running = previous;
+	runningRef = previousRef;
+	runningName = previousName;
+
+	if (status == LUA_YIELD) {
+		// Only the yielded values are removed, the rest of the stack belongs to
+		// the function that yielded
+		lua_pop(co, results);
+		tasks[ref].suspended = true;
+		if (!waiting) {
+			// coroutine.yield() without wait continues in the next tick
+			AddTimer(ref, 1, 0, true);
+		}
+		return status;
+	}
+
+	auto it = tasks.find(ref);
+	Task task = std::move(it->second);
+	tasks.erase(it);
+
+	bool accepted = false;
+	if (status != LUA_OK) {
+		HAZARD_ERROR("Error while calling " << task.callback << ": " << lua_tostring(co, -1));
+	}
+	else if (task.login) {
+		if (results < 1 || !lua_isboolean(co, -results)) {
+			HAZARD_ERROR("Error while calling Game.on_login: Function must return a boolean");
+		}
+		else {
+			accepted = lua_toboolean(co, -results);
+		}
+	}
+	if (status == LUA_OK) {
+		lua_settop(co, 0);
+		coroutines.push_back(ref);
+	}
+	else {
+		// Lua does not re-enable hooks in a thread that was left by an error
+		// from a hook, so the coroutine is not reused
+		luaL_unref(L, LUA_REGISTRYINDEX, ref);
+	}
+
+	if (task.login) {
+		if (task.suspended) {
+			scene->FinishLogin(task.playerName, accepted);
+		}
+		else {
+			loginAccepted = accepted;
+		}
+	}
+	return status;
+}
+
+void Script::StartProfiler(std::uint32_t instructions, std::uint32_t interval) {
+	profiler.Start(interval);
+	profilerInstructions = static_cast<int>(instructions);
+	SetHook(L);
+}
+
+bool Script::StopProfiler(const std::string& path) {
+	bool result = profiler.Stop(path);
+	SetHook(L);
+	return result;
+}
+
+bool Script::IsProfiling() const {
+	return profiler.IsRunning();
+}
+
+void Script::ConfigureWatchdog(const Config& config) {
+	tickBudget = config.TickBudget() * 1000ull;
+	tickLimit = config.TickLimit() * 1000ull;
+	SetHook(L);
+}
+
+void Script::BeginTick(std::uint64_t start) {
+	tickStart = start;
+	inTick = true;
+	budgetReported = false;
+}
+
+void Script::EndTick() {
+	inTick = false;
+}
+
+const WatchdogStats& Script::GetWatchdogStats() const {
+	return watchdogStats;
+}
+
+void Script::ClearWatchdogStats() {
+	watchdogStats = WatchdogStats();
+}
+
+void Script::SetRandomSeed(std::uint64_t seed) {
+	lua_getglobal(L, "math");
+	if (lua_istable(L, -1)) {
+		lua_getfield(L, -1, "randomseed");
+		lua_pushinteger(L, static_cast<lua_Integer>(seed));
+		if (lua_pcall(L, 1, 0, 0) != LUA_OK) {
+			lua_pop(L, 1);
+		}
+	}
+	lua_pop(L, 1);
+}
+
+std::uint64_t Script::GetLuaTime() const {
+	return luaTime;
+}
+
+const std::map<std::string, double>& Script::GetGauges() const {
+	return gauges;
+}
+
+void Script::Hook(lua_State* L, lua_Debug* ar) {
+	// The profiler and the watchdog share one count hook
+	Script* script = *static_cast<Script**>(lua_getextraspace(L));
+	if (ar->event != LUA_HOOKCOUNT) {
+		return;
+	}
+	if (script->profiler.IsRunning()) {
+		script->profiler.Sample(L, script->runningName ? script->runningName : "main.lua");
+	}
+	if (script->running && script->inTick) {
+		script->CheckWatchdog(L);
+	}
+}
+
+void Script::CheckWatchdog(lua_State* L) {
+	std::uint64_t elapsed = Hazard::GetMicroseconds() - tickStart;
+	if (tickLimit > 0 && elapsed >= tickLimit) {
+		++watchdogStats.aborts;
+		// Level 0 is the Lua function that was interrupted by the hook
+		luaL_where(L, 0);
+		lua_pushfstring(L, "Aborted after %d ms, the tick took longer than Config.tick_limit_ms", static_cast<int>(elapsed / 1000));
+		lua_concat(L, 2);
+		lua_error(L);
+		return;
+	}
+	if (tickBudget > 0 && elapsed >= tickBudget && !budgetReported) {
+		// Only the first callback over the budget is reported in every tick
+		budgetReported = true;
+		++watchdogStats.overruns;
+		luaL_traceback(L, L, nullptr, 0);
+		HAZARD_ERROR(runningName << " exceeded the tick budget after " << elapsed / 1000 << " ms\n" << lua_tostring(L, -1));
+		lua_pop(L, 1);
+	}
+}
+
+void Script::SetHook(lua_State* thread) {
+	// The watchdog checks the time every WatchdogInstructions instructions,
+	// or as often as the profiler samples if it is running
+	constexpr int WatchdogInstructions = 1000;
+
+	int mask = 0;
+	int count = 0;
+	if (profiler.IsRunning()) {
+		mask = LUA_MASKCOUNT;
+		count = profilerInstructions;
+	}
+	else if (tickBudget > 0 || tickLimit > 0) {
+		mask = LUA_MASKCOUNT;
+		count = WatchdogInstructions;
+	}
+	if (lua_gethookmask(thread) != mask || (mask != 0 && lua_gethookcount(thread) != count)) {
+		lua_sethook(thread, mask != 0 ? Hook : nullptr, mask, count);
+	}
+}
+
+void Script::ClearTimers() {
+	for (auto& pair : timers) {
+		if (!pair.second.coroutine) {
+			luaL_unref(L, LUA_REGISTRYINDEX, pair.second.ref);
+		}
+	}
+	timers.clear();
+	jobWaits.clear();
+
+	// Waiting coroutines are dropped, and logins that were still waiting are
+	// rejected
+	for (auto& pair : tasks) {
+		lua_rawgeti(L, LUA_REGISTRYINDEX, pair.first);
+		lua_resetthread(lua_tothread(L, -1));
+		lua_pop(L, 1);
+		coroutines.push_back(pair.first);
+	}
+	std::unordered_map<int, Task> waitingTasks;
+	waitingTasks.swap(tasks);
+	for (auto& pair : waitingTasks) {
+		if (pair.second.login) {
+			scene->FinishLogin(pair.second.playerName, false);
+		}
+	}
+}
+
+template <int Arg>
+const std::string& Script::CheckString(lua_State* L) {
+	static_assert(Arg >= 1 && Arg <= MaxStringArguments, "No buffer for this argument");
+
+	// Arguments are copied into buffers that are reused by every call, so that
+	// bindings do not allocate once the buffers are large enough
+	if (argumentBuffers.size() <= callbackDepth) {
+		argumentBuffers.resize(callbackDepth + 1);
+	}
+
+	std::size_t length;
+	const char* value = luaL_checklstring(L, Arg, &length);
+	std::string& argument = argumentBuffers[callbackDepth][Arg - 1];
+	argument.assign(value, length);
+	return argument;
+}
+
 bool Script::GetFunction(const std::string& function) {
 	lua_getglobal(L, "Game");
 	if (lua_isnil(L, -1)) {
-		std::cerr << "ERROR: 'Game' is nil\n";
+		HAZARD_ERROR("'Game' is nil");
 		return false;
 	}
 	lua_getfield(L, -1, function.c_str());
@@ -3,16 +3,52 @@
 #ifndef Hazard_Script_h
 #define Hazard_Script_h
 
+#include <cstdint>
+#include <map>
+#include <memory>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include <lua.hpp>
 
+#include "Config.h"
+#include "Jobs.h"
+#include "LuaAllocator.h"
+#include "Profiler.h"
+#include "TimerWheel.h"
+
 namespace Hazard {
 	class Scene;
 
+	struct GCStats {
+		std::uint64_t steps = 0;
+		std::uint64_t cycles = 0;
+		// In microseconds
+		std::uint64_t totalTime = 0;
+		std::uint64_t maxPause = 0;
+	};
+
+	struct WatchdogStats {
+		// Ticks in which a callback exceeded Config.tick_budget_ms
+		std::uint64_t overruns = 0;
+		// Callbacks that were aborted because of Config.tick_limit_ms
+		std::uint64_t aborts = 0;
+	};
+
+	enum class LoginResult {
+		Accepted,
+		Rejected,
+		// Game.on_login is waiting, the login is finished by Scene::FinishLogin
+		Pending
+	};
+
 	class Script {
 	public:
-		Script(std::string path, Scene* scene);
+		// Largest argument that bindings can check as a string
+		static constexpr int MaxStringArguments = 8;
+
+		Script(std::string path, Scene* scene, std::size_t memoryLimit = 0);
 		Script(const Script&) = delete;
 		~Script();
 
@@ -20,9 +56,22 @@ namespace Hazard {
 
 		void Reload();
 
+		void SetMemoryLimit(std::size_t memoryLimit);
+		const LuaMemoryStats& GetMemoryStats() const;
+
+		void ConfigureGC(const Config& config);
+		// Runs the garbage collector for at most 'budget' microseconds
+		void CollectGarbage(std::uint64_t budget);
+		const GCStats& GetGCStats() const;
+
+		// Calls all timers and resumes all coroutines that are due
+		void RunTimers();
+		// Resumes all coroutines that are waiting for a finished job
+		void ResumeJobs();
+
 		void OnTick(double dt);
 		
-		bool OnLogin(const std::string& playerName);
+		LoginResult OnLogin(const std::string& playerName);
 		void OnJoin(const std::string& playerName);
 		void OnDisconnect(const std::string& playerName);
 
@@ -30,15 +79,98 @@ namespace Hazard {
 		void OnButtonEvent(const std::string& playerName, const std::string& button, bool pressed);
 		void OnAxisEvent(const std::string& playerName, const std::string& axis, std::int32_t state);
 
+		std::size_t GetTimerCount() const;
+		std::size_t GetWaitingCount() const;
+
+		// Samples the stack every 'instructions' instructions, at most once per
+		// 'interval' microseconds
+		void StartProfiler(std::uint32_t instructions, std::uint32_t interval);
+		bool StopProfiler(const std::string& path);
+		bool IsProfiling() const;
+
+		void ConfigureWatchdog(const Config& config);
+		// Callbacks are only checked by the watchdog between these calls.
+		// 'start' is the time the tick started, in microseconds.
+		void BeginTick(std::uint64_t start);
+		void EndTick();
+		const WatchdogStats& GetWatchdogStats() const;
+		void ClearWatchdogStats();
+
+		// Seeds math.random, so that recordings can be replayed
+		void SetRandomSeed(std::uint64_t seed);
+
+		// Total time spent in callbacks, in microseconds
+		std::uint64_t GetLuaTime() const;
+		// Gauges set with set_gauge
+		const std::map<std::string, double>& GetGauges() const;
+
 	private:
+		struct Timer {
+			// Registry reference of the function, or of the waiting coroutine
+			int ref;
+			std::uint32_t interval;
+			bool coroutine;
+		};
+
+		struct Task {
+			// Name used in error messages
+			std::string callback;
+			bool login = false;
+			std::string playerName;
+			bool suspended = false;
+		};
+
+		struct JobWait {
+			std::shared_ptr<Job> job;
+			int ref;
+		};
+
 		std::string path;
 		Scene* scene;
 
+		LuaAllocator allocator;
 		lua_State* L;
 
+		bool generationalGC = false;
+		std::uint32_t gcGrowth = 100;
+		std::uint64_t gcBase = 0;
+		bool collecting = false;
+		GCStats gcStats;
+
+		TimerWheel timerWheel;
+		std::unordered_map<std::uint32_t, Timer> timers;
+		std::uint32_t nextTimerID = 0;
+		std::vector<TimerWheel::Entry> expiredTimers;
+
+		// Every callback runs in its own coroutine, finished coroutines are
+		// kept in the registry for reuse
+		std::vector<int> coroutines;
+		std::unordered_map<int, Task> tasks;
+		lua_State* running = nullptr;
+		int runningRef = LUA_NOREF;
+		bool waiting = false;
+		bool loginAccepted = false;
+		std::vector<JobWait> jobWaits;
+		// Callback name of the running coroutine
+		const char* runningName = nullptr;
+
+		Profiler profiler;
+		int profilerInstructions = 0;
+
+		// In microseconds, 0 if disabled
+		std::uint64_t tickBudget = 0, tickLimit = 0;
+		std::uint64_t tickStart = 0;
+		bool inTick = false;
+		bool budgetReported = false;
+		WatchdogStats watchdogStats;
+
+		std::uint64_t luaTime = 0;
+		std::map<std::string, double> gauges;
+
 		static int GetPlayers(lua_State* L);
 		static int IsOnline(lua_State* L);
 		static int Kick(lua_State* L);
+		static int IsIdle(lua_State* L);
 
 		static int IsKeyDown(lua_State* L);
 		static int IsButtonDown(lua_State* L);
@@ -54,8 +186,40 @@ namespace Hazard {
 		static int StopAll(lua_State* L);
 
 		static int GetTicks(lua_State* L);
+		static int GetRoom(lua_State* L);
+		static int GetMemoryStats(lua_State* L);
+		static int GetGCStats(lua_State* L);
+		static int SetGauge(lua_State* L);
+
+		static int SetTimeout(lua_State* L);
+		static int SetInterval(lua_State* L);
+		static int CancelTimer(lua_State* L);
+		static int Wait(lua_State* L);
+
+		static int RunJob(lua_State* L);
+		static int IsJobDone(lua_State* L);
+		static int GetJobResult(lua_State* L);
+		static int AwaitJob(lua_State* L);
+		static int ContinueAwaitJob(lua_State* L, int status, lua_KContext context);
+		static int FreeJob(lua_State* L);
+		static int PushJobResult(lua_State* L, const Job& job);
+
+		// Returns argument 'Arg', which stays valid until the binding returns
+		template <int Arg>
+		static const std::string& CheckString(lua_State* L);
 
 		bool GetFunction(const std::string& function);
+
+		static void Hook(lua_State* L, lua_Debug* ar);
+		void CheckWatchdog(lua_State* L);
+		// Every coroutine has its own hook, which is updated before it runs
+		void SetHook(lua_State* thread);
+
+		std::uint32_t AddTimer(int ref, std::uint64_t delay, std::uint32_t interval, bool coroutine);
+		// Runs the function and arguments on top of the stack in a coroutine
+		int Start(Task& task, int nargs);
+		int Resume(lua_State* co, int ref, int nargs);
+		void ClearTimers();
 	};
 }
 
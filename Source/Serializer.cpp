@@ -0,0 +1,226 @@
+// Copyright 2022 Justus Zorn
+
+#include <cstring>
+#include <unordered_set>
+
+#include "Serializer.h"
+
+using namespace Hazard;
+
+namespace {
+	enum Tag : std::uint8_t {
+		Nil,
+		False,
+		True,
+		Integer,
+		Number,
+		String,
+		Table
+	};
+
+	// Limits the recursion of the serializer and the reader
+	constexpr int MaxDepth = 64;
+
+	// Tables that are shared are copied once for every reference, so the
+	// number of copied values is limited as well
+	constexpr std::size_t MaxValues = 1 << 22;
+
+	struct Serialization {
+		std::vector<std::uint8_t>& data;
+		std::string& error;
+		// Tables that contain the value that is serialized
+		std::unordered_set<const void*> path;
+		std::size_t values = 0;
+	};
+
+	template<typename T>
+	void Append(std::vector<std::uint8_t>& data, T value) {
+		std::size_t offset = data.size();
+		data.resize(offset + sizeof(T));
+		std::memcpy(data.data() + offset, &value, sizeof(T));
+	}
+
+	bool SerializeValue(lua_State* L, int index, int depth, Serialization& serialization) {
+		std::vector<std::uint8_t>& data = serialization.data;
+		std::string& error = serialization.error;
+		if (++serialization.values > MaxValues) {
+			error = "too many values";
+			return false;
+		}
+		switch (lua_type(L, index)) {
+		case LUA_TNIL:
+			data.push_back(Nil);
+			return true;
+		case LUA_TBOOLEAN:
+			data.push_back(lua_toboolean(L, index) ? True : False);
+			return true;
+		case LUA_TNUMBER:
+			if (lua_isinteger(L, index)) {
+				data.push_back(Integer);
+				Append<lua_Integer>(data, lua_tointeger(L, index));
+			}
+			else {
+				data.push_back(Number);
+				Append<lua_Number>(data, lua_tonumber(L, index));
+			}
+			return true;
+		case LUA_TSTRING: {
+			std::size_t length;
+			const char* string = lua_tolstring(L, index, &length);
+			data.push_back(String);
+			Append<std::uint32_t>(data, static_cast<std::uint32_t>(length));
+			data.insert(data.end(), string, string + length);
+			return true;
+		}
+		case LUA_TTABLE: {
+			if (depth >= MaxDepth) {
+				error = "table is nested too deeply";
+				return false;
+			}
+			if (!lua_checkstack(L, 2)) {
+				error = "stack overflow";
+				return false;
+			}
+			const void* table = lua_topointer(L, index);
+			if (!serialization.path.insert(table).second) {
+				error = "table contains itself";
+				return false;
+			}
+			index = lua_absindex(L, index);
+			data.push_back(Table);
+			// The number of pairs is only known at the end
+			std::size_t countOffset = data.size();
+			Append<std::uint32_t>(data, 0);
+			std::uint32_t count = 0;
+			lua_pushnil(L);
+			while (lua_next(L, index)) {
+				if (!SerializeValue(L, -2, depth + 1, serialization) || !SerializeValue(L, -1, depth + 1, serialization)) {
+					lua_pop(L, 2);
+					return false;
+				}
+				lua_pop(L, 1);
+				++count;
+			}
+			std::memcpy(data.data() + countOffset, &count, sizeof(count));
+			serialization.path.erase(table);
+			return true;
+		}
+		default:
+			error = std::string("cannot copy a value of type ") + luaL_typename(L, index);
+			return false;
+		}
+	}
+
+	class Reader {
+	public:
+		Reader(const std::uint8_t* data, std::size_t size) : data{ data }, size{ size } {}
+
+		template<typename T>
+		bool Read(T& value) {
+			if (size - position < sizeof(T)) {
+				return false;
+			}
+			std::memcpy(&value, data + position, sizeof(T));
+			position += sizeof(T);
+			return true;
+		}
+
+		bool ReadValue(lua_State* L, int depth) {
+			std::uint8_t tag;
+			if (depth >= MaxDepth || !lua_checkstack(L, 3) || !Read(tag)) {
+				return false;
+			}
+			switch (tag) {
+			case Nil:
+				lua_pushnil(L);
+				return true;
+			case False:
+			case True:
+				lua_pushboolean(L, tag == True);
+				return true;
+			case Integer: {
+				lua_Integer value;
+				if (!Read(value)) {
+					return false;
+				}
+				lua_pushinteger(L, value);
+				return true;
+			}
+			case Number: {
+				lua_Number value;
+				if (!Read(value)) {
+					return false;
+				}
+				lua_pushnumber(L, value);
+				return true;
+			}
+			case String: {
+				std::uint32_t length;
+				if (!Read(length) || size - position < length) {
+					return false;
+				}
+				lua_pushlstring(L, reinterpret_cast<const char*>(data + position), length);
+				position += length;
+				return true;
+			}
+			case Table: {
+				std::uint32_t count;
+				if (!Read(count)) {
+					return false;
+				}
+				lua_createtable(L, 0, static_cast<int>(count < 1024 ? count : 1024));
+				for (std::uint32_t i = 0; i < count; ++i) {
+					if (!ReadValue(L, depth + 1) || !ReadValue(L, depth + 1) || lua_isnil(L, -2)) {
+						return false;
+					}
+					lua_rawset(L, -3);
+				}
+				return true;
+			}
+			default:
+				return false;
+			}
+		}
+
+		std::size_t Remaining() const {
+			return size - position;
+		}
+
+	private:
+		const std::uint8_t* data;
+		std::size_t size;
+		std::size_t position = 0;
+	};
+}
+
+bool Hazard::SerializeValues(lua_State* L, int first, int count, std::vector<std::uint8_t>& data, std::string& error) {
+	first = lua_absindex(L, first);
+	Append<std::uint32_t>(data, static_cast<std::uint32_t>(count));
+	Serialization serialization{ data, error };
+	for (int i = 0; i < count; ++i) {
+		if (!SerializeValue(L, first + i, 0, serialization)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+int Hazard::DeserializeValues(lua_State* L, const std::uint8_t* data, std::size_t size) {
+	int top = lua_gettop(L);
+	Reader reader(data, size);
+	std::uint32_t count;
+	if (!reader.Read(count)) {
+		return -1;
+	}
+	for (std::uint32_t i = 0; i < count; ++i) {
+		if (!reader.ReadValue(L, 0)) {
+			lua_settop(L, top);
+			return -1;
+		}
+	}
+	if (reader.Remaining() > 0) {
+		lua_settop(L, top);
+		return -1;
+	}
+	return static_cast<int>(count);
+}
@@ -0,0 +1,24 @@
+// Copyright 2022 Justus Zorn
+
+#ifndef Hazard_Serializer_h
+#define Hazard_Serializer_h
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <lua.hpp>
+
+namespace Hazard {
+	// Appends 'count' values starting at stack index 'first' to 'data'. Only
+	// nil, booleans, numbers, strings and tables of these can be serialized.
+	// Returns false and sets 'error' if a value is not supported.
+	bool SerializeValues(lua_State* L, int first, int count, std::vector<std::uint8_t>& data, std::string& error);
+
+	// Pushes the values in 'data' and returns their number, or -1 if 'data' is
+	// not valid
+	int DeserializeValues(lua_State* L, const std::uint8_t* data, std::size_t size);
+}
+
+#endif
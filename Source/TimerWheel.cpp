@@ -0,0 +1,71 @@
+// Copyright 2022 Justus Zorn
+
+#include "TimerWheel.h"
+
+using namespace Hazard;
+
+TimerWheel::TimerWheel(std::uint64_t now) : next{ now + 1 } {}
+
+void TimerWheel::Add(std::uint32_t id, std::uint64_t expiry) {
+	Insert({ id, expiry });
+}
+
+void TimerWheel::Advance(std::uint64_t now, std::vector<Entry>& expired) {
+	constexpr std::uint64_t firstMask = (1 << FirstBits) - 1;
+	constexpr std::uint64_t levelMask = (1 << LevelBits) - 1;
+
+	while (next <= now) {
+		// Whenever a level wraps around, the next slot of the level above is
+		// spread over the levels below
+		if ((next & firstMask) == 0) {
+			std::uint64_t index = next >> FirstBits;
+			if ((index & levelMask) == 0) {
+				if (((index >> LevelBits) & levelMask) == 0) {
+					Cascade(2, (index >> (2 * LevelBits)) & levelMask);
+				}
+				Cascade(1, (index >> LevelBits) & levelMask);
+			}
+			Cascade(0, index & levelMask);
+		}
+
+		std::vector<Entry>& slot = firstLevel[next & firstMask];
+		expired.insert(expired.end(), slot.begin(), slot.end());
+		slot.clear();
+		++next;
+	}
+}
+
+void TimerWheel::Insert(const Entry& entry) {
+	Entry timer = entry;
+	if (timer.expiry < next) {
+		timer.expiry = next;
+	}
+
+	std::uint64_t delta = timer.expiry - next;
+	if (delta < (1ull << FirstBits)) {
+		firstLevel[timer.expiry & ((1 << FirstBits) - 1)].push_back(timer);
+		return;
+	}
+
+	int level = 0;
+	int shift = FirstBits;
+	while (level < Levels - 2 && delta >= (1ull << (shift + LevelBits))) {
+		++level;
+		shift += LevelBits;
+	}
+
+	// Timers beyond the last level wait in its furthest slot
+	std::uint64_t slotTime = timer.expiry;
+	if (delta >= (1ull << (shift + LevelBits))) {
+		slotTime = next + (1ull << (shift + LevelBits)) - 1;
+	}
+	levels[level][(slotTime >> shift) & ((1 << LevelBits) - 1)].push_back(timer);
+}
+
+void TimerWheel::Cascade(int level, std::uint64_t index) {
+	cascading.swap(levels[level][index]);
+	for (const Entry& entry : cascading) {
+		Insert(entry);
+	}
+	cascading.clear();
+}
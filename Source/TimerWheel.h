@@ -0,0 +1,47 @@
+// Copyright 2022 Justus Zorn
+
+#ifndef Hazard_TimerWheel_h
+#define Hazard_TimerWheel_h
+
+#include <cstdint>
+#include <vector>
+
+namespace Hazard {
+	// Hierarchical timer wheel with a resolution of one millisecond. The first
+	// level has a slot for each of the next 256 milliseconds, every further
+	// level covers 64 slots of the level below. Timers further away than the
+	// last level can reach are moved down the levels until they expire.
+	class TimerWheel {
+	public:
+		struct Entry {
+			std::uint32_t id;
+			std::uint64_t expiry;
+		};
+
+		TimerWheel(std::uint64_t now);
+
+		void Add(std::uint32_t id, std::uint64_t expiry);
+
+		// Appends all timers that expired up to and including 'now', in order
+		// of expiry
+		void Advance(std::uint64_t now, std::vector<Entry>& expired);
+
+	private:
+		static constexpr int Levels = 4;
+		static constexpr int FirstBits = 8;
+		static constexpr int LevelBits = 6;
+
+		std::vector<Entry> firstLevel[1 << FirstBits];
+		std::vector<Entry> levels[Levels - 1][1 << LevelBits];
+
+		// The first millisecond that was not processed yet
+		std::uint64_t next;
+
+		std::vector<Entry> cascading;
+
+		void Insert(const Entry& entry);
+		void Cascade(int level, std::uint64_t index);
+	};
+}
+
+#endif
@@ -0,0 +1,533 @@
+// Copyright 2022 Justus Zorn
+
+// Micro-benchmarks of the hot paths of the engine. Every benchmark is run
+// several times after a warm-up run, and the time per operation of every run
+// is a sample. The results are printed to the standard output as JSON, so
+// that they can be compared between versions.
+//
+// The scenes run synthetic recordings (see Recording.h) in a temporary
+// project directory, so that they do not need a network.
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Arena.h"
+#include "Clock.h"
+#include "Jobs.h"
+#include "Net.h"
+#include "Recording.h"
+#include "Scene.h"
+
+#ifndef HAZARD_SERVER
+#include "Audio.h"
+#endif
+
+using namespace Hazard;
+
+namespace {
+	struct Options {
+		std::string filter;
+		std::uint32_t samples = 10;
+	};
+
+	struct Result {
+		std::string name;
+		std::string description;
+		std::uint64_t iterations = 0;
+		// Nanoseconds per operation
+		std::vector<double> samples;
+	};
+
+	// Calls of the script benchmarks per tick
+	constexpr std::uint32_t ScriptCalls = 1000;
+	constexpr std::uint32_t ScenePlayers = 32;
+
+	const char* const configFile = R"(
+Config.tick_rate = 60
+Config.snapshot_rate = 60
+Config.adaptive_snapshots = false
+Config.idle_timeout = 0
+Config.max_players = 256
+Config.textures = { "player.png", "tile.png", "coin.png" }
+)";
+
+	// Snapshots are almost never due, so that the script benchmarks only
+	// measure the calls
+	const char* const scriptConfigFile = R"(
+Config.tick_rate = 60
+Config.snapshot_rate = 1
+Config.min_snapshot_rate = 1
+Config.adaptive_snapshots = false
+Config.idle_timeout = 0
+Config.textures = { "player.png" }
+)";
+
+	const char* const gameFile = R"(
+local positions = {}
+
+function Game.on_join(player)
+	positions[player] = { x = math.random(0, 1000), y = math.random(0, 1000) }
+end
+
+function Game.on_disconnect(player)
+	positions[player] = nil
+end
+
+function Game.on_tick(dt)
+	for player, position in pairs(positions) do
+		if is_key_down(player, "W") then position.y = position.y - 200 * dt end
+		if is_key_down(player, "S") then position.y = position.y + 200 * dt end
+		if is_key_down(player, "A") then position.x = position.x - 200 * dt end
+		if is_key_down(player, "D") then position.x = position.x + 200 * dt end
+	end
+	for player, position in pairs(positions) do
+		for y = 0, 4 do
+			for x = 0, 7 do
+				draw_sprite(player, "tile.png", x * 128, y * 128, 128)
+			end
+		end
+		for i = 1, 8 do
+			draw_sprite(player, "coin.png", i * 100, 600, 32, 100)
+		end
+		for other, position in pairs(positions) do
+			draw_sprite(player, "player.png", math.floor(position.x), math.floor(position.y), 64)
+		end
+		draw_text(player, "Score: " .. math.floor(position.x), 10, 10, 255, 255, 255)
+	end
+end
+)";
+
+	const char* const scriptFiles[][2] = {
+		{ "baseline.lua", R"(
+local function noop(player, texture, x, y, size) end
+function Game.on_tick(dt)
+	local player = get_players()[1]
+	for i = 1, 1000 do noop(player, "player.png", i, i, 64) end
+end
+)" },
+		{ "draw_sprite.lua", R"(
+function Game.on_tick(dt)
+	local player = get_players()[1]
+	for i = 1, 1000 do draw_sprite(player, "player.png", i, i, 64) end
+end
+)" },
+		{ "is_key_down.lua", R"(
+function Game.on_tick(dt)
+	local player = get_players()[1]
+	for i = 1, 1000 do is_key_down(player, "W") end
+end
+)" }
+	};
+}
+
+// Keeps the compiler from removing the benchmarked code
+static volatile std::uint64_t sink;
+
+static void PrintUsage() {
+	std::cerr << "Usage: HazardBench [--filter name] [--samples n]\n";
+}
+
+static bool ParseOptions(int argc, char* argv[], Options& options) {
+	for (int i = 1; i < argc; ++i) {
+		std::string option = argv[i];
+		if (i + 1 >= argc) {
+			std::cerr << "ERROR: Missing value for " << option << '\n';
+			return false;
+		}
+		std::string value = argv[++i];
+		if (option == "--filter") {
+			options.filter = value;
+		}
+		else if (option == "--samples") {
+			try {
+				options.samples = std::max(1ul, std::stoul(value));
+			}
+			catch (...) {
+				std::cerr << "ERROR: Invalid value for " << option << '\n';
+				return false;
+			}
+		}
+		else {
+			std::cerr << "ERROR: Unknown command line option '" << option << "'\n";
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool WriteFile(const std::string& path, const char* data, std::size_t size) {
+	std::ofstream file(path, std::ios::binary);
+	file.write(data, size);
+	if (!file) {
+		std::cerr << "ERROR: Could not write " << path << '\n';
+		return false;
+	}
+	return true;
+}
+
+static bool WriteFile(const std::string& path, const char* text) {
+	return WriteFile(path, text, std::strlen(text));
+}
+
+// Writes a recording in which 'players' players log in and press random keys
+// for 'ticks' ticks at 60 ticks per second
+static bool WriteRecording(const std::string& path, std::uint32_t players, std::uint32_t ticks) {
+	static const std::int32_t keys[] = { 'w', 'a', 's', 'd' };
+	std::mt19937 random(1);
+	std::vector<std::vector<std::int32_t>> keysDown(players);
+
+	Recorder recorder;
+	if (!recorder.Open(path, 0, 1, 0)) {
+		return false;
+	}
+	Input input;
+	for (std::uint32_t tick = 0; tick < ticks; ++tick) {
+		recorder.Tick(tick * 1000ull / 60);
+		for (std::uint32_t i = 0; i < players; ++i) {
+			std::string playerName = "player" + std::to_string(i);
+			if (tick == 0) {
+				recorder.Login(playerName);
+				continue;
+			}
+			if (random() % 10 != 0) {
+				continue;
+			}
+			input.Clear();
+			std::int32_t key = keys[random() % 4];
+			auto it = std::find(keysDown[i].begin(), keysDown[i].end(), key);
+			if (it == keysDown[i].end()) {
+				keysDown[i].push_back(key);
+				input.keyboardInputs.push_back({ key, true });
+			}
+			else {
+				keysDown[i].erase(it);
+				input.keyboardInputs.push_back({ key, false });
+			}
+			recorder.Input(playerName, input);
+		}
+	}
+	return true;
+}
+
+// Writes a second of stereo noise in the format supported by Audio
+static bool WriteWave(const std::string& path, std::uint32_t frames) {
+	std::mt19937 random(1);
+	std::vector<char> data;
+	auto write16 = [&data](std::uint16_t value) {
+		data.push_back(static_cast<char>(value & 0xFF));
+		data.push_back(static_cast<char>(value >> 8));
+	};
+	auto write32 = [&write16](std::uint32_t value) {
+		write16(static_cast<std::uint16_t>(value & 0xFFFF));
+		write16(static_cast<std::uint16_t>(value >> 16));
+	};
+	std::uint32_t dataSize = frames * 4;
+	data.insert(data.end(), { 'R', 'I', 'F', 'F' });
+	write32(36 + dataSize);
+	data.insert(data.end(), { 'W', 'A', 'V', 'E', 'f', 'm', 't', ' ' });
+	write32(16);
+	write16(1);
+	write16(2);
+	write32(44100);
+	write32(44100 * 4);
+	write16(4);
+	write16(16);
+	data.insert(data.end(), { 'd', 'a', 't', 'a' });
+	write32(dataSize);
+	for (std::uint32_t i = 0; i < frames * 2; ++i) {
+		write16(static_cast<std::uint16_t>(random()));
+	}
+	return WriteFile(path, data.data(), data.size());
+}
+
+static bool CreateProject() {
+	std::filesystem::path directory = std::filesystem::temp_directory_path() / "hazard-bench";
+	std::error_code error;
+	std::filesystem::create_directories(directory, error);
+	std::filesystem::current_path(directory, error);
+	if (error) {
+		std::cerr << "ERROR: Could not create " << directory.string() << '\n';
+		return false;
+	}
+
+	bool success = WriteFile("game-config.lua", configFile) && WriteFile("script-config.lua", scriptConfigFile) && WriteFile("game.lua", gameFile);
+	for (const auto& script : scriptFiles) {
+		success = success && WriteFile(script[0], script[1]);
+	}
+	return success && WriteWave("bench.wav", 44100);
+}
+
+// Builds a frame of a typical game: a tile map, a few dozen animated objects
+// and some text
+static void CreateSprites(SpriteBuffer& sprites) {
+	std::mt19937 random(1);
+	for (std::uint32_t i = 0; i < 180; ++i) {
+		sprites.AddSprite(random() % 1920, random() % 1080, 32 + random() % 32, random() % 16, random() % 8);
+	}
+	for (std::uint32_t i = 0; i < 20; ++i) {
+		std::string text = i % 2 ? "Player " + std::to_string(i) : "Score: " + std::to_string(random() % 100000);
+		sprites.AddTextSprite(random() % 1920, random() % 1080, 0, 255, 255, 255, text.data(), static_cast<std::uint32_t>(text.size()));
+	}
+}
+
+class Runner {
+public:
+	Runner(const Options& options) : options{ options } {}
+
+	bool IsSelected(const std::string& name) const {
+		return options.filter.empty() || name.find(options.filter) != std::string::npos;
+	}
+
+	// 'run' performs 'iterations' operations
+	template <typename F>
+	Result Measure(const std::string& name, const std::string& description, std::uint64_t iterations, F&& run) {
+		Result result;
+		result.name = name;
+		result.description = description;
+		result.iterations = iterations;
+
+		run(iterations);
+		for (std::uint32_t i = 0; i < options.samples; ++i) {
+			auto start = std::chrono::steady_clock::now();
+			run(iterations);
+			double time = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+			result.samples.push_back(time / iterations);
+		}
+		return result;
+	}
+
+	void Add(Result result) {
+		results.push_back(std::move(result));
+	}
+
+	void Print() const {
+		std::ostringstream json;
+		json << std::fixed << std::setprecision(1);
+		json << "{\n";
+#ifdef NDEBUG
+		json << "  \"build\": \"release\",\n";
+#else
+		json << "  \"build\": \"debug\",\n";
+#endif
+		json << "  \"samples\": " << options.samples << ",\n";
+		json << "  \"benchmarks\": [";
+		for (std::size_t i = 0; i < results.size(); ++i) {
+			const Result& result = results[i];
+			std::vector<double> samples = result.samples;
+			std::sort(samples.begin(), samples.end());
+			double mean = 0.0;
+			for (double sample : samples) {
+				mean += sample;
+			}
+			mean /= samples.size();
+
+			json << (i == 0 ? "\n" : ",\n");
+			json << "    {\n";
+			json << "      \"name\": \"" << result.name << "\",\n";
+			json << "      \"description\": \"" << result.description << "\",\n";
+			json << "      \"unit\": \"ns\",\n";
+			json << "      \"iterations\": " << result.iterations << ",\n";
+			json << "      \"median\": " << samples[samples.size() / 2] << ",\n";
+			json << "      \"mean\": " << mean << ",\n";
+			json << "      \"min\": " << samples.front() << ",\n";
+			json << "      \"max\": " << samples.back() << "\n";
+			json << "    }";
+		}
+		json << "\n  ]\n}\n";
+		std::cout << json.str();
+	}
+
+private:
+	const Options& options;
+	std::vector<Result> results;
+};
+
+static void BenchPackets(Runner& runner) {
+	SpriteBuffer sprites;
+	CreateSprites(sprites);
+	std::string description = std::to_string(sprites.GetSprites().size()) + " sprites";
+
+	// Same as Scene::Update, including the ENet packet
+	Arena arena;
+	if (runner.IsSelected("packet.write_snapshot")) {
+		runner.Add(runner.Measure("packet.write_snapshot", description, 1000, [&](std::uint64_t iterations) {
+			for (std::uint64_t i = 0; i < iterations; ++i) {
+				WritePacket packet(&arena, 4 + sprites.GetSprites().size() * 21);
+				WriteSnapshot(packet, sprites);
+				ENetPacket* enetPacket = packet.GetPacket(false);
+				sink = enetPacket->dataLength;
+				enet_packet_destroy(enetPacket);
+				arena.Reset();
+			}
+		}));
+	}
+
+	if (runner.IsSelected("packet.read_snapshot")) {
+		WritePacket packet;
+		WriteSnapshot(packet, sprites);
+		ENetPacket* enetPacket = packet.GetPacket(false);
+		SpriteBuffer received;
+		runner.Add(runner.Measure("packet.read_snapshot", description, 1000, [&](std::uint64_t iterations) {
+			for (std::uint64_t i = 0; i < iterations; ++i) {
+				ReadPacket packet(enetPacket);
+				ReadSnapshot(packet, received);
+				sink = received.GetSprites().size();
+			}
+		}));
+		enet_packet_destroy(enetPacket);
+	}
+}
+
+// Runs one tick of the scene per operation
+static Result MeasureScene(Runner& runner, const std::string& name, const std::string& description, const std::string& script, const std::string& configPath, std::uint32_t players, std::uint64_t iterations, std::uint32_t samples) {
+	std::string recordingPath = name + ".hzr";
+	Result result;
+	if (!WriteRecording(recordingPath, players, static_cast<std::uint32_t>(iterations * (samples + 2)))) {
+		return result;
+	}
+	Replayer replayer;
+	if (!replayer.Open(recordingPath)) {
+		return result;
+	}
+	Config config(configPath);
+	FreezeClock(0);
+	Scene scene(script, config, replayer);
+	// The first tick logs in all players
+	scene.ReplayTick();
+	return runner.Measure(name, description, iterations, [&scene](std::uint64_t iterations) {
+		for (std::uint64_t i = 0; i < iterations; ++i) {
+			scene.ReplayTick();
+		}
+	});
+}
+
+static void BenchScripts(Runner& runner, std::uint32_t samples) {
+	if (!runner.IsSelected("script.")) {
+		return;
+	}
+	// The calls are measured as the difference to a loop that calls an empty
+	// Lua function
+	Result baseline = MeasureScene(runner, "script.baseline", "", "baseline.lua", "script-config.lua", 1, 20, samples);
+	if (baseline.samples.empty()) {
+		return;
+	}
+	std::vector<double> baselineSamples = baseline.samples;
+	std::sort(baselineSamples.begin(), baselineSamples.end());
+	double baselineTime = baselineSamples[baselineSamples.size() / 2];
+
+	baseline.name = "script.lua_call";
+	baseline.description = "call of an empty Lua function";
+	for (double& sample : baseline.samples) {
+		sample /= ScriptCalls;
+	}
+	baseline.iterations *= ScriptCalls;
+	runner.Add(baseline);
+
+	for (const char* function : { "draw_sprite", "is_key_down" }) {
+		std::string name = std::string("script.") + function;
+		if (!runner.IsSelected(name)) {
+			continue;
+		}
+		Result result = MeasureScene(runner, name, std::string("call of ") + function + " from Lua, minus script.lua_call", std::string(function) + ".lua", "script-config.lua", 1, 20, samples);
+		for (double& sample : result.samples) {
+			sample = (sample - baselineTime) / ScriptCalls;
+		}
+		result.iterations *= ScriptCalls;
+		runner.Add(result);
+	}
+}
+
+static void BenchScene(Runner& runner, std::uint32_t samples) {
+	if (!runner.IsSelected("scene.update")) {
+		return;
+	}
+	Result result = MeasureScene(runner, "scene.update", std::to_string(ScenePlayers) + " players with 81 sprites each", "game.lua", "game-config.lua", ScenePlayers, 50, samples);
+	if (!result.samples.empty()) {
+		runner.Add(result);
+	}
+}
+
+#ifndef HAZARD_SERVER
+static void BenchAudio(Runner& runner) {
+	if (runner.IsSelected("audio.mix")) {
+		Audio::Sound stereo = Audio::LoadWave("bench.wav");
+		// Mono sounds are mixed differently, so half of the channels play one
+		std::vector<std::int16_t> monoSamples(stereo.samples, stereo.samples + stereo.frames);
+		Audio::Sound mono;
+		mono.samples = monoSamples.data();
+		mono.frames = monoSamples.size();
+		mono.channels = 1;
+
+		Audio::Channel channels[HAZARD_AUDIO_CHANNELS];
+		for (std::uint32_t i = 0; i < HAZARD_AUDIO_CHANNELS; ++i) {
+			channels[i].sound = i % 2 ? &mono : &stereo;
+			channels[i].volume = 100;
+			channels[i].pos = i * 1000;
+		}
+
+		constexpr unsigned long Frames = 512;
+		std::vector<std::int16_t> out(Frames * 2);
+		runner.Add(runner.Measure("audio.mix", std::to_string(HAZARD_AUDIO_CHANNELS) + " channels, " + std::to_string(Frames) + " frames", 2000, [&](std::uint64_t iterations) {
+			for (std::uint64_t i = 0; i < iterations; ++i) {
+				for (Audio::Channel& channel : channels) {
+					channel.playing = true;
+					if (channel.pos + Frames > channel.sound->frames) {
+						channel.pos = 0;
+					}
+				}
+				Audio::Mix(channels, out.data(), Frames);
+				sink = out[0];
+			}
+		}));
+		delete[] stereo.samples;
+	}
+
+	if (runner.IsSelected("audio.load_wave")) {
+		runner.Add(runner.Measure("audio.load_wave", "1 s of 16-bit stereo", 50, [](std::uint64_t iterations) {
+			for (std::uint64_t i = 0; i < iterations; ++i) {
+				Audio::Sound sound = Audio::LoadWave("bench.wav");
+				sink = sound.frames;
+				delete[] sound.samples;
+			}
+		}));
+	}
+}
+#endif
+
+int main(int argc, char* argv[]) {
+	Options options;
+	if (!ParseOptions(argc, argv, options)) {
+		PrintUsage();
+		return 1;
+	}
+	if (InitializeENet() < 0) {
+		std::cerr << "ERROR: Could not initialize ENet\n";
+		return 1;
+	}
+	if (!CreateProject()) {
+		return 1;
+	}
+	GetJobPool().Start(1, 0);
+
+	Runner runner(options);
+	BenchPackets(runner);
+	BenchScripts(runner, options.samples);
+	BenchScene(runner, options.samples);
+#ifndef HAZARD_SERVER
+	BenchAudio(runner);
+#endif
+	runner.Print();
+
+	GetJobPool().Stop();
+	enet_deinitialize();
+	return 0;
+}
@@ -0,0 +1,378 @@
+// Copyright 2022 Justus Zorn
+
+// Load test that connects many headless clients to a server from one
+// process. Every bot sends random input and decodes the snapshots it
+// receives. Once per second, the bots report what they received, and the
+// tick times of the server if its metrics are enabled.
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <enet.h>
+
+#include "Client.h"
+#include "Clock.h"
+#include "Keys.h"
+#include "Net.h"
+
+using namespace Hazard;
+
+namespace {
+	struct Options {
+		std::string address = "localhost";
+		std::uint16_t port = 34344;
+		std::uint32_t bots = 10;
+		// Bots connected per second, 0 connects all at once
+		std::uint32_t ramp = 0;
+		std::uint32_t duration = 30;
+		std::uint32_t rate = 60;
+		std::uint32_t rooms = 1;
+		std::uint16_t metricsPort = 0;
+		std::uint32_t seed = 1;
+	};
+
+	struct Bot {
+		std::unique_ptr<Client> client;
+		std::mt19937 random;
+		std::vector<std::int32_t> keysDown;
+		std::vector<std::uint8_t> buttonsDown;
+		ClientStats lastStats;
+		bool disconnected = false;
+	};
+
+	const std::int32_t keys[] = {
+		'w', 'a', 's', 'd', 'e', 'q', ' ',
+		HAZARD_KEY_SCANCODE_MASK | 79, HAZARD_KEY_SCANCODE_MASK | 80,
+		HAZARD_KEY_SCANCODE_MASK | 81, HAZARD_KEY_SCANCODE_MASK | 82
+	};
+	const std::uint8_t buttons[] = { HAZARD_BUTTON_LEFT, HAZARD_BUTTON_MIDDLE, HAZARD_BUTTON_RIGHT };
+	const char* const words[] = { "hello", "gg", "ready", "where?", "lol" };
+}
+
+static void PrintUsage() {
+	std::cerr << "Usage: HazardBots [--address host[:port]] [--bots n] [--ramp bots per second]\n"
+		<< "                  [--duration seconds] [--rate inputs per second] [--rooms n]\n"
+		<< "                  [--metrics port] [--seed n]\n";
+}
+
+static bool ParseOptions(int argc, char* argv[], Options& options) {
+	for (int i = 1; i < argc; ++i) {
+		std::string option = argv[i];
+		if (i + 1 >= argc) {
+			std::cerr << "ERROR: Missing value for " << option << '\n';
+			return false;
+		}
+		std::string value = argv[++i];
+		try {
+			if (option == "--address") {
+				options.address = value;
+			}
+			else if (option == "--bots") {
+				options.bots = std::stoul(value);
+			}
+			else if (option == "--ramp") {
+				options.ramp = std::stoul(value);
+			}
+			else if (option == "--duration") {
+				options.duration = std::stoul(value);
+			}
+			else if (option == "--rate") {
+				options.rate = std::max(1ul, std::stoul(value));
+			}
+			else if (option == "--rooms") {
+				options.rooms = std::max(1ul, std::stoul(value));
+			}
+			else if (option == "--metrics") {
+				options.metricsPort = static_cast<std::uint16_t>(std::stoul(value));
+			}
+			else if (option == "--seed") {
+				options.seed = std::stoul(value);
+			}
+			else {
+				std::cerr << "ERROR: Unknown command line option '" << option << "'\n";
+				return false;
+			}
+		}
+		catch (...) {
+			std::cerr << "ERROR: Invalid value for " << option << '\n';
+			return false;
+		}
+	}
+	return true;
+}
+
+// Presses and releases random keys and buttons, moves the mouse and
+// sometimes types a word
+static void GenerateInput(Bot& bot, Input& input) {
+	std::uniform_real_distribution<double> chance(0.0, 1.0);
+	input.Clear();
+
+	if (chance(bot.random) < 0.05) {
+		std::int32_t key = keys[bot.random() % (sizeof(keys) / sizeof(keys[0]))];
+		auto it = std::find(bot.keysDown.begin(), bot.keysDown.end(), key);
+		bool pressed = it == bot.keysDown.end();
+		if (pressed) {
+			bot.keysDown.push_back(key);
+		}
+		else {
+			bot.keysDown.erase(it);
+		}
+		input.keyboardInputs.push_back({ key, pressed });
+	}
+	if (chance(bot.random) < 0.02) {
+		std::uint8_t button = buttons[bot.random() % (sizeof(buttons) / sizeof(buttons[0]))];
+		auto it = std::find(bot.buttonsDown.begin(), bot.buttonsDown.end(), button);
+		bool pressed = it == bot.buttonsDown.end();
+		if (pressed) {
+			bot.buttonsDown.push_back(button);
+		}
+		else {
+			bot.buttonsDown.erase(it);
+		}
+		input.buttonInputs.push_back({ button, pressed });
+	}
+	if (chance(bot.random) < 0.3) {
+		std::uniform_int_distribution<std::int32_t> motion(-400, 400);
+		input.mouseMotionX = motion(bot.random);
+		input.mouseMotionY = motion(bot.random);
+		input.mouseMotion = true;
+	}
+	if (chance(bot.random) < 0.01) {
+		input.textInput = words[bot.random() % (sizeof(words) / sizeof(words[0]))];
+	}
+}
+
+// Reads the 50th and 99th percentile of the tick times of the slowest room
+// from the metrics of the server, in milliseconds
+static bool FetchTickTimes(std::uint16_t port, double& p50, double& p99) {
+	ENetAddress address = { 0 };
+	enet_address_set_host_ip(&address, "127.0.0.1");
+	address.port = port;
+
+	ENetSocket socket = enet_socket_create(ENET_SOCKET_TYPE_STREAM);
+	if (socket == ENET_SOCKET_NULL) {
+		return false;
+	}
+	enet_socket_set_option(socket, ENET_SOCKOPT_RCVTIMEO, 1000);
+	enet_socket_set_option(socket, ENET_SOCKOPT_SNDTIMEO, 1000);
+
+	std::string response;
+	if (enet_socket_connect(socket, &address) == 0) {
+		static const char request[] = "GET /metrics HTTP/1.0\r\n\r\n";
+		ENetBuffer buffer;
+		buffer.data = const_cast<char*>(request);
+		buffer.dataLength = sizeof(request) - 1;
+		if (enet_socket_send(socket, nullptr, &buffer, 1) > 0) {
+			char data[4096];
+			buffer.data = data;
+			buffer.dataLength = sizeof(data);
+			int length;
+			while ((length = enet_socket_receive(socket, nullptr, &buffer, 1)) > 0) {
+				response.append(data, length);
+			}
+		}
+	}
+	enet_socket_destroy(socket);
+
+	p50 = 0.0;
+	p99 = 0.0;
+	bool found = false;
+	std::istringstream lines(response);
+	std::string line;
+	while (std::getline(lines, line)) {
+		if (line.compare(0, 20, "hazard_tick_seconds{") != 0) {
+			continue;
+		}
+		double value;
+		try {
+			value = std::stod(line.substr(line.rfind(' ') + 1)) * 1000.0;
+		}
+		catch (...) {
+			continue;
+		}
+		if (line.find("quantile=\"0.5\"") != std::string::npos) {
+			p50 = std::max(p50, value);
+			found = true;
+		}
+		else if (line.find("quantile=\"0.99\"") != std::string::npos) {
+			p99 = std::max(p99, value);
+		}
+	}
+	return found;
+}
+
+namespace {
+	// Fetches the tick times of the server once per second on its own thread,
+	// so that a slow server does not stop the bots from being serviced
+	class TickTimePoller {
+	public:
+		TickTimePoller(std::uint16_t port) : thread(&TickTimePoller::Run, this, port) {}
+		TickTimePoller(const TickTimePoller&) = delete;
+
+		~TickTimePoller() {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				running = false;
+			}
+			condition.notify_one();
+			thread.join();
+		}
+
+		TickTimePoller& operator=(const TickTimePoller&) = delete;
+
+		// Returns false if the tick times were never fetched
+		bool Get(double& p50, double& p99) {
+			std::lock_guard<std::mutex> lock(mutex);
+			p50 = this->p50;
+			p99 = this->p99;
+			return found;
+		}
+
+	private:
+		std::mutex mutex;
+		std::condition_variable condition;
+		bool running = true;
+		bool found = false;
+		double p50 = 0.0, p99 = 0.0;
+		std::thread thread;
+
+		void Run(std::uint16_t port) {
+			std::unique_lock<std::mutex> lock(mutex);
+			while (running) {
+				lock.unlock();
+				double fetchedP50, fetchedP99;
+				bool fetched = FetchTickTimes(port, fetchedP50, fetchedP99);
+				lock.lock();
+				if (fetched) {
+					p50 = fetchedP50;
+					p99 = fetchedP99;
+					found = true;
+				}
+				condition.wait_for(lock, std::chrono::seconds(1), [this]() { return !running; });
+			}
+		}
+	};
+}
+
+static void Report(std::vector<Bot>& bots, TickTimePoller* poller, double seconds) {
+	std::uint32_t connected = 0, disconnected = 0;
+	std::uint64_t snapshots = 0, receivedBytes = 0, sentBytes = 0;
+	std::uint64_t totalRoundTripTime = 0;
+	std::uint32_t maxRoundTripTime = 0;
+	double totalLoss = 0.0, maxLoss = 0.0;
+
+	for (Bot& bot : bots) {
+		if (bot.disconnected) {
+			++disconnected;
+			continue;
+		}
+		ClientStats stats = bot.client->GetStats();
+		++connected;
+		snapshots += stats.snapshots - bot.lastStats.snapshots;
+		receivedBytes += stats.receivedBytes - bot.lastStats.receivedBytes;
+		sentBytes += stats.sentBytes - bot.lastStats.sentBytes;
+		totalRoundTripTime += stats.roundTripTime;
+		maxRoundTripTime = std::max(maxRoundTripTime, stats.roundTripTime);
+		double loss = 100.0 * stats.packetLoss / ENET_PEER_PACKET_LOSS_SCALE;
+		totalLoss += loss;
+		maxLoss = std::max(maxLoss, loss);
+		bot.lastStats = stats;
+	}
+
+	std::ostringstream report;
+	report << std::fixed << std::setprecision(1);
+	report << connected << " bots";
+	if (disconnected > 0) {
+		report << " (" << disconnected << " disconnected)";
+	}
+	if (connected > 0) {
+		double perBot = 1.0 / (connected * seconds);
+		report << ": " << snapshots * perBot << " snapshots/s, "
+			<< receivedBytes * perBot / 1024.0 << " KiB/s in, " << sentBytes * perBot / 1024.0 << " KiB/s out per bot, RTT "
+			<< totalRoundTripTime / connected << " ms average " << maxRoundTripTime << " ms max, loss "
+			<< totalLoss / connected << "% average " << maxLoss << "% max";
+	}
+	double p50, p99;
+	if (poller && poller->Get(p50, p99)) {
+		report << std::setprecision(2) << ", server tick " << p50 << " ms p50 " << p99 << " ms p99";
+	}
+	std::cout << report.str() << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+	Options options;
+	if (!ParseOptions(argc, argv, options)) {
+		PrintUsage();
+		return 1;
+	}
+	if (InitializeENet() < 0) {
+		std::cerr << "ERROR: Could not initialize ENet\n";
+		return 1;
+	}
+
+	std::unique_ptr<TickTimePoller> poller;
+	if (options.metricsPort > 0) {
+		poller = std::make_unique<TickTimePoller>(options.metricsPort);
+	}
+
+	std::vector<Bot> bots;
+	bots.reserve(options.bots);
+	Input input;
+
+	std::uint64_t start = GetTicks();
+	std::uint64_t nextReport = start + 1000;
+	std::uint64_t lastReport = start;
+	std::uint64_t frame = 0;
+	while (GetTicks() - start < options.duration * 1000ull) {
+		// Bots are connected in order, so the first bots have been connected for
+		// the longest time
+		std::uint64_t due = options.ramp == 0 ? options.bots : 1 + (GetTicks() - start) * options.ramp / 1000;
+		while (bots.size() < std::min<std::uint64_t>(due, options.bots)) {
+			std::uint32_t i = static_cast<std::uint32_t>(bots.size());
+			bots.emplace_back();
+			Bot& bot = bots.back();
+			bot.random.seed(options.seed * 7919 + i);
+			bot.client = std::make_unique<Client>("bot" + std::to_string(i), options.address, options.port, i % options.rooms);
+			bot.disconnected = !bot.client->IsConnected();
+		}
+
+		for (Bot& bot : bots) {
+			if (bot.disconnected) {
+				continue;
+			}
+			GenerateInput(bot, input);
+			if (!bot.client->Update(input)) {
+				bot.disconnected = true;
+			}
+		}
+
+		std::uint64_t now = GetTicks();
+		if (now >= nextReport) {
+			Report(bots, poller.get(), (now - lastReport) / 1000.0);
+			lastReport = now;
+			nextReport += 1000;
+		}
+
+		++frame;
+		std::uint64_t nextFrame = start + frame * 1000 / options.rate;
+		now = GetTicks();
+		if (nextFrame > now) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(nextFrame - now));
+		}
+	}
+
+	bots.clear();
+	enet_deinitialize();
+	return 0;
+}
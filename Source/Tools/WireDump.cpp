@@ -0,0 +1,432 @@
+// Copyright 2022 Justus Zorn
+
+// Reads a capture written with Config.capture and reports which messages
+// and fields the bytes were spent on. Packets are decoded with ReadPacket in
+// the same way as by the client and the server. For every message type, it
+// also estimates how large the packets would be with other encodings:
+// variable-length integers, snapshots as deltas to the previous snapshot of
+// the same player, and not sending packets that carry no information.
+
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Capture.h"
+#include "Net.h"
+
+using namespace Hazard;
+
+namespace {
+	enum MessageType {
+		LoginMessage,
+		SnapshotMessage,
+		InputMessage,
+		AudioMessage,
+		MessageTypes
+	};
+
+	const char* const messageNames[MessageTypes] = { "Login", "Snapshot", "Input", "Audio" };
+
+	struct FieldStats {
+		std::uint64_t count = 0;
+		std::uint64_t bytes = 0;
+	};
+
+	struct MessageStats {
+		std::uint64_t packets = 0;
+		std::uint64_t bytes = 0;
+		std::uint64_t minSize = UINT64_MAX;
+		std::uint64_t maxSize = 0;
+		// Fields in the order in which they were first seen
+		std::vector<std::pair<std::string, FieldStats>> fields;
+
+		// Estimates of other encodings
+		std::uint64_t varintBytes = 0;
+		std::uint64_t deltaBytes = 0;
+		// Packets that could be left out, because they are empty or equal to the
+		// previous packet
+		std::uint64_t redundantPackets = 0;
+		std::uint64_t redundantBytes = 0;
+	};
+
+	struct DecodedSprite {
+		bool isText;
+		std::int32_t x, y;
+		std::uint32_t scale;
+		std::uint32_t texture, animation;
+		std::uint8_t r, g, b;
+		std::string text;
+	};
+
+	struct Stream {
+		std::uint64_t packets = 0;
+		std::uint64_t bytes = 0;
+		std::vector<DecodedSprite> sprites;
+		std::vector<std::uint8_t> lastSnapshot;
+	};
+
+	struct Options {
+		std::string path;
+		bool allStreams = true;
+		std::uint32_t stream = 0;
+	};
+}
+
+static std::uint64_t VarintSize(std::uint64_t value) {
+	std::uint64_t size = 1;
+	while (value >= 0x80) {
+		value >>= 7;
+		++size;
+	}
+	return size;
+}
+
+static std::uint64_t SignedSize(std::int64_t value) {
+	return VarintSize((static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63));
+}
+
+// Reads a packet with ReadPacket and counts the bytes of every field, both
+// as sent and as variable-length integers
+class Decoder {
+public:
+	Decoder(const std::vector<std::uint8_t>& data, MessageStats& stats) : packet(data.data(), static_cast<std::uint32_t>(data.size())), stats{ stats } {}
+
+	std::uint8_t Read8(const char* field) {
+		Count(field, 1, 1);
+		return packet.Read8();
+	}
+
+	std::uint16_t Read16(const char* field) {
+		std::uint16_t value = packet.Read16();
+		Count(field, 2, VarintSize(value));
+		return value;
+	}
+
+	std::uint32_t Read32(const char* field) {
+		std::uint32_t value = packet.Read32();
+		Count(field, 4, VarintSize(value));
+		return value;
+	}
+
+	std::int32_t ReadSigned32(const char* field) {
+		std::int32_t value = static_cast<std::int32_t>(packet.Read32());
+		Count(field, 4, SignedSize(value));
+		return value;
+	}
+
+	std::string ReadString(const char* field) {
+		std::uint32_t length;
+		const char* value = packet.ReadString(length);
+		Count((std::string(field) + " length").c_str(), 4, VarintSize(length));
+		Count(field, length, length);
+		return std::string(value, length);
+	}
+
+	std::uint32_t Remaining() const {
+		return packet.Remaining();
+	}
+
+	std::uint64_t GetVarintBytes() const {
+		return varintBytes;
+	}
+
+private:
+	ReadPacket packet;
+	MessageStats& stats;
+	std::uint64_t varintBytes = 0;
+
+	void Count(const char* field, std::uint64_t bytes, std::uint64_t encodedBytes) {
+		auto it = std::find_if(stats.fields.begin(), stats.fields.end(), [field](const auto& pair) {
+			return pair.first == field;
+		});
+		if (it == stats.fields.end()) {
+			stats.fields.emplace_back(field, FieldStats());
+			it = stats.fields.end() - 1;
+		}
+		++it->second.count;
+		it->second.bytes += bytes;
+		varintBytes += encodedBytes;
+	}
+};
+
+static std::uint64_t EncodedSpriteSize(const DecodedSprite& sprite) {
+	std::uint64_t size = SignedSize(sprite.x) + SignedSize(sprite.y) + VarintSize(sprite.scale) + 1;
+	if (sprite.isText) {
+		size += 3 + VarintSize(sprite.text.size()) + sprite.text.size();
+	}
+	else {
+		size += VarintSize(sprite.texture) + VarintSize(sprite.animation);
+	}
+	return size;
+}
+
+// Every sprite is compared with the sprite at the same position of the
+// previous snapshot. It starts with a byte that tells which fields changed,
+// followed by the differences of the changed fields.
+static std::uint64_t DeltaSnapshotSize(const std::vector<DecodedSprite>& previous, const std::vector<DecodedSprite>& current) {
+	std::uint64_t size = VarintSize(current.size());
+	for (std::size_t i = 0; i < current.size(); ++i) {
+		const DecodedSprite& sprite = current[i];
+		if (i >= previous.size() || previous[i].isText != sprite.isText) {
+			size += 1 + EncodedSpriteSize(sprite);
+			continue;
+		}
+		const DecodedSprite& last = previous[i];
+		size += 1;
+		if (sprite.x != last.x) {
+			size += SignedSize(static_cast<std::int64_t>(sprite.x) - last.x);
+		}
+		if (sprite.y != last.y) {
+			size += SignedSize(static_cast<std::int64_t>(sprite.y) - last.y);
+		}
+		if (sprite.scale != last.scale) {
+			size += VarintSize(sprite.scale);
+		}
+		if (sprite.isText) {
+			if (sprite.r != last.r || sprite.g != last.g || sprite.b != last.b) {
+				size += 3;
+			}
+			if (sprite.text != last.text) {
+				size += VarintSize(sprite.text.size()) + sprite.text.size();
+			}
+		}
+		else {
+			if (sprite.texture != last.texture) {
+				size += VarintSize(sprite.texture);
+			}
+			if (sprite.animation != last.animation) {
+				size += SignedSize(static_cast<std::int64_t>(sprite.animation) - last.animation);
+			}
+		}
+	}
+	return size;
+}
+
+static void DecodeSnapshot(const CapturedPacket& captured, MessageStats& stats, Stream& stream) {
+	Decoder packet(captured.data, stats);
+	std::vector<DecodedSprite> sprites;
+	std::uint32_t spriteCount = packet.Read32("sprite count");
+	for (std::uint32_t i = 0; i < spriteCount && packet.Remaining() > 0; ++i) {
+		DecodedSprite sprite = {};
+		sprite.x = packet.ReadSigned32("x");
+		sprite.y = packet.ReadSigned32("y");
+		sprite.scale = packet.Read32("scale");
+		sprite.isText = packet.Read8("is text") != 0;
+		if (sprite.isText) {
+			sprite.r = packet.Read8("text color");
+			sprite.g = packet.Read8("text color");
+			sprite.b = packet.Read8("text color");
+			sprite.text = packet.ReadString("text");
+		}
+		else {
+			sprite.texture = packet.Read32("texture");
+			sprite.animation = packet.Read32("animation");
+		}
+		sprites.push_back(std::move(sprite));
+	}
+
+	stats.varintBytes += packet.GetVarintBytes();
+	stats.deltaBytes += DeltaSnapshotSize(stream.sprites, sprites);
+	if (captured.data == stream.lastSnapshot) {
+		++stats.redundantPackets;
+		stats.redundantBytes += captured.data.size();
+	}
+	stream.sprites.swap(sprites);
+	stream.lastSnapshot = captured.data;
+}
+
+static void DecodeInput(const CapturedPacket& captured, MessageStats& stats) {
+	Decoder packet(captured.data, stats);
+	std::uint32_t keyboardInputs = packet.Read32("key count");
+	for (std::uint32_t i = 0; i < keyboardInputs && packet.Remaining() > 0; ++i) {
+		packet.ReadSigned32("key");
+		packet.Read8("key pressed");
+	}
+	std::uint32_t buttonInputs = packet.Read32("button count");
+	for (std::uint32_t i = 0; i < buttonInputs && packet.Remaining() > 0; ++i) {
+		packet.Read8("button");
+		packet.Read8("button pressed");
+	}
+	packet.ReadSigned32("mouse motion");
+	packet.ReadSigned32("mouse motion");
+	bool mouseMotion = packet.Read8("has mouse motion") != 0;
+	std::string text = packet.ReadString("text input");
+
+	stats.varintBytes += packet.GetVarintBytes();
+	stats.deltaBytes += packet.GetVarintBytes();
+	if (keyboardInputs == 0 && buttonInputs == 0 && !mouseMotion && text.empty()) {
+		++stats.redundantPackets;
+		stats.redundantBytes += captured.data.size();
+	}
+}
+
+static void DecodeAudio(const CapturedPacket& captured, MessageStats& stats) {
+	Decoder packet(captured.data, stats);
+	std::uint32_t audioCommandCount = packet.Read32("command count");
+	for (std::uint32_t i = 0; i < audioCommandCount && packet.Remaining() > 0; ++i) {
+		packet.Read8("type");
+		packet.Read8("volume");
+		packet.Read16("channel");
+		packet.Read32("sound");
+	}
+	stats.varintBytes += packet.GetVarintBytes();
+	stats.deltaBytes += packet.GetVarintBytes();
+}
+
+static void DecodeLogin(const CapturedPacket& captured, MessageStats& stats) {
+	Decoder packet(captured.data, stats);
+	packet.ReadString("player name");
+	if (packet.Remaining() >= sizeof(std::uint32_t)) {
+		packet.Read32("room");
+	}
+	stats.varintBytes += packet.GetVarintBytes();
+	stats.deltaBytes += packet.GetVarintBytes();
+}
+
+static void PrintEstimate(const char* name, std::uint64_t bytes, std::uint64_t total) {
+	std::cout << "    " << std::left << std::setw(28) << name << std::right << std::setw(12) << bytes
+		<< std::setw(8) << (total > 0 ? 100.0 * (static_cast<double>(total) - bytes) / total : 0.0) << "% saved\n";
+}
+
+static void PrintReport(const MessageStats (&messages)[MessageTypes], const std::map<std::uint32_t, Stream>& streams, double seconds) {
+	std::uint64_t totalBytes = 0;
+	for (const MessageStats& stats : messages) {
+		totalBytes += stats.bytes;
+	}
+
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << streams.size() << " streams, " << seconds << " s, " << totalBytes << " bytes ("
+		<< (seconds > 0.0 ? totalBytes / seconds / 1024.0 : 0.0) << " KiB/s)\n";
+	for (const auto& pair : streams) {
+		std::cout << "  stream " << pair.first << ": " << pair.second.packets << " packets, " << pair.second.bytes << " bytes\n";
+	}
+
+	for (int type = 0; type < MessageTypes; ++type) {
+		const MessageStats& stats = messages[type];
+		if (stats.packets == 0) {
+			continue;
+		}
+		std::cout << '\n' << messageNames[type] << ": " << stats.packets << " packets, " << stats.bytes << " bytes ("
+			<< (totalBytes > 0 ? 100.0 * stats.bytes / totalBytes : 0.0) << "%), "
+			<< (seconds > 0.0 ? stats.bytes / seconds / 1024.0 : 0.0) << " KiB/s, size "
+			<< stats.minSize << " min " << static_cast<double>(stats.bytes) / stats.packets << " average " << stats.maxSize << " max\n";
+
+		std::vector<std::pair<std::string, FieldStats>> fields = stats.fields;
+		std::stable_sort(fields.begin(), fields.end(), [](const auto& a, const auto& b) {
+			return a.second.bytes > b.second.bytes;
+		});
+		for (const auto& field : fields) {
+			std::cout << "    " << std::left << std::setw(28) << field.first << std::right << std::setw(12) << field.second.bytes
+				<< std::setw(8) << (stats.bytes > 0 ? 100.0 * field.second.bytes / stats.bytes : 0.0) << "%  "
+				<< field.second.count << " values\n";
+		}
+
+		std::cout << "  Other encodings:\n";
+		PrintEstimate("variable-length integers", stats.varintBytes, stats.bytes);
+		if (type == SnapshotMessage) {
+			PrintEstimate("deltas to last snapshot", stats.deltaBytes, stats.bytes);
+			PrintEstimate("skip unchanged snapshots", stats.bytes - stats.redundantBytes, stats.bytes);
+		}
+		else if (type == InputMessage) {
+			PrintEstimate("skip empty inputs", stats.bytes - stats.redundantBytes, stats.bytes);
+		}
+	}
+}
+
+static void PrintUsage() {
+	std::cerr << "Usage: HazardWireDump capture.hzw [--stream id]\n";
+}
+
+static bool ParseOptions(int argc, char* argv[], Options& options) {
+	for (int i = 1; i < argc; ++i) {
+		std::string option = argv[i];
+		if (option == "--stream") {
+			if (i + 1 >= argc) {
+				std::cerr << "ERROR: Missing value for " << option << '\n';
+				return false;
+			}
+			try {
+				options.stream = std::stoul(argv[++i]);
+				options.allStreams = false;
+			}
+			catch (...) {
+				std::cerr << "ERROR: Invalid value for " << option << '\n';
+				return false;
+			}
+		}
+		else if (options.path.empty() && option.compare(0, 2, "--") != 0) {
+			options.path = option;
+		}
+		else {
+			std::cerr << "ERROR: Unknown command line option '" << option << "'\n";
+			return false;
+		}
+	}
+	return !options.path.empty();
+}
+
+int main(int argc, char* argv[]) {
+	Options options;
+	if (!ParseOptions(argc, argv, options)) {
+		PrintUsage();
+		return 1;
+	}
+
+	CaptureReader reader;
+	if (!reader.Open(options.path)) {
+		return 1;
+	}
+
+	MessageStats messages[MessageTypes];
+	std::map<std::uint32_t, Stream> streams;
+	std::uint64_t firstTime = 0, lastTime = 0;
+	bool first = true;
+
+	CapturedPacket packet;
+	while (reader.Read(packet)) {
+		if (!options.allStreams && packet.stream != options.stream) {
+			continue;
+		}
+		if (packet.channel >= MessageTypes) {
+			std::cerr << "ERROR: Packet on unknown channel " << static_cast<int>(packet.channel) << '\n';
+			continue;
+		}
+		if (first) {
+			firstTime = packet.time;
+			first = false;
+		}
+		lastTime = packet.time;
+
+		Stream& stream = streams[packet.stream];
+		++stream.packets;
+		stream.bytes += packet.data.size();
+
+		// The channel is the message type
+		MessageStats& stats = messages[packet.channel];
+		++stats.packets;
+		stats.bytes += packet.data.size();
+		stats.minSize = std::min<std::uint64_t>(stats.minSize, packet.data.size());
+		stats.maxSize = std::max<std::uint64_t>(stats.maxSize, packet.data.size());
+		switch (packet.channel) {
+		case LoginMessage:
+			DecodeLogin(packet, stats);
+			break;
+		case SnapshotMessage:
+			DecodeSnapshot(packet, stats, stream);
+			break;
+		case InputMessage:
+			DecodeInput(packet, stats);
+			break;
+		case AudioMessage:
+			DecodeAudio(packet, stats);
+			break;
+		}
+	}
+
+	PrintReport(messages, streams, (lastTime - firstTime) / 1000000.0);
+	return 0;
+}
@@ -0,0 +1,161 @@
+// Copyright 2022 Justus Zorn
+
+#include <atomic>
+#include <ctime>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Clock.h"
+#include "Log.h"
+#include "Trace.h"
+
+using namespace Hazard;
+
+namespace {
+	struct Event {
+		const char* name;
+		std::uint64_t start;
+		std::uint64_t duration;
+	};
+
+	constexpr std::uint64_t RingSize = 1 << 16;
+
+	// Events that are about to be overwritten are not written to the trace,
+	// because their thread might change them while they are read
+	constexpr std::uint64_t RingSlack = 256;
+
+	// Only the owning thread writes to a ring, 'head' publishes its events
+	struct Ring {
+		Event events[RingSize];
+		std::atomic<std::uint64_t> head = 0;
+		std::uint32_t thread = 0;
+		std::string name;
+	};
+}
+
+static std::atomic<bool> tracing = false;
+static std::atomic<std::uint32_t> traceToggles = 0;
+static std::atomic<std::uint32_t> handledToggles = 0;
+
+// Rings are created on the first event of a thread, and stay alive until the
+// program exits
+static std::mutex ringsMutex;
+static std::vector<std::unique_ptr<Ring>> rings;
+static std::uint64_t traceStart = 0;
+
+static thread_local Ring* threadRing = nullptr;
+static thread_local std::string threadName;
+
+static Ring* GetRing() {
+	if (!threadRing) {
+		std::lock_guard<std::mutex> lock(ringsMutex);
+		rings.push_back(std::make_unique<Ring>());
+		threadRing = rings.back().get();
+		threadRing->thread = static_cast<std::uint32_t>(rings.size());
+		threadRing->name = threadName.empty() ? "Thread " + std::to_string(rings.size()) : threadName;
+	}
+	return threadRing;
+}
+
+static void WriteString(std::ofstream& file, const std::string& string) {
+	file << '"';
+	for (char c : string) {
+		if (c == '"' || c == '\\') {
+			file << '\\';
+		}
+		if (static_cast<unsigned char>(c) >= 0x20) {
+			file << c;
+		}
+	}
+	file << '"';
+}
+
+static bool WriteTrace(const std::string& path) {
+	std::ofstream file(path);
+	file << "{\"traceEvents\":[";
+	bool first = true;
+	for (const auto& ring : rings) {
+		file << (first ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << ring->thread << ",\"args\":{\"name\":";
+		WriteString(file, ring->name);
+		file << "}}";
+		first = false;
+
+		std::uint64_t head = ring->head.load(std::memory_order_acquire);
+		std::uint64_t i = head > RingSize - RingSlack ? head - (RingSize - RingSlack) : 0;
+		for (; i < head; ++i) {
+			const Event& event = ring->events[i % RingSize];
+			if (event.start < traceStart) {
+				continue;
+			}
+			file << ",\n{\"name\":";
+			WriteString(file, event.name);
+			file << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << ring->thread << ",\"ts\":" << event.start << ",\"dur\":" << event.duration << '}';
+		}
+	}
+	file << "\n]}\n";
+	return static_cast<bool>(file);
+}
+
+void Hazard::TraceEvent(const char* name, std::uint64_t start, std::uint64_t end) {
+	if (!tracing.load(std::memory_order_relaxed)) {
+		return;
+	}
+	Ring* ring = GetRing();
+	std::uint64_t head = ring->head.load(std::memory_order_relaxed);
+	ring->events[head % RingSize] = { name, start, end - start };
+	ring->head.store(head + 1, std::memory_order_release);
+}
+
+void Hazard::SetTraceThreadName(const std::string& name) {
+	threadName = name;
+	if (threadRing) {
+		std::lock_guard<std::mutex> lock(ringsMutex);
+		threadRing->name = name;
+	}
+}
+
+bool Hazard::IsTracing() {
+	return tracing.load(std::memory_order_relaxed);
+}
+
+void Hazard::ToggleTrace() {
+	traceToggles.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Hazard::UpdateTrace() {
+	std::uint32_t handled = handledToggles.load(std::memory_order_relaxed);
+	if (handled == traceToggles.load(std::memory_order_relaxed)) {
+		return;
+	}
+	if (!handledToggles.compare_exchange_strong(handled, handled + 1)) {
+		// Another thread handles this toggle
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(ringsMutex);
+	if (!tracing) {
+		traceStart = GetMicroseconds();
+		tracing = true;
+		HAZARD_INFO("Tracing");
+		return;
+	}
+
+	tracing = false;
+	std::string path = "trace-" + std::to_string(std::time(nullptr)) + ".json";
+	if (WriteTrace(path)) {
+		HAZARD_INFO("Trace written to " << path);
+	}
+	else {
+		HAZARD_ERROR("Could not write trace " << path);
+	}
+}
+
+TraceScope::TraceScope(const char* name) : name{ name }, start{ IsTracing() ? GetMicroseconds() : 0 } {}
+
+TraceScope::~TraceScope() {
+	if (start > 0) {
+		TraceEvent(name, start, GetMicroseconds());
+	}
+}
@@ -0,0 +1,49 @@
+// Copyright 2022 Justus Zorn
+
+#ifndef Hazard_Trace_h
+#define Hazard_Trace_h
+
+#include <cstdint>
+#include <string>
+
+namespace Hazard {
+	// Timeline of the server and client threads in the trace event format,
+	// which can be opened in chrome://tracing or Perfetto. Every thread writes
+	// its events into its own ring, which keeps the last RingSize events, so
+	// recording an event never takes a lock. When tracing is stopped, the
+	// events of all threads since the start are written to a file.
+
+	// Records 'name' from 'start' to 'end' (in microseconds) if tracing is
+	// enabled. 'name' must stay valid until the trace was written.
+	void TraceEvent(const char* name, std::uint64_t start, std::uint64_t end);
+
+	// Names the current thread in the trace
+	void SetTraceThreadName(const std::string& name);
+
+	bool IsTracing();
+
+	// Asks the next call to UpdateTrace to start or stop tracing. This only
+	// increments an atomic counter, so it can be called from signal handlers.
+	void ToggleTrace();
+
+	// Starts or stops tracing if it was toggled. When tracing stops, the trace
+	// is written to 'trace-<time>.json'. Can be called from any thread, every
+	// toggle is handled once.
+	void UpdateTrace();
+
+	// Records the lifetime of the scope as an event
+	class TraceScope {
+	public:
+		TraceScope(const char* name);
+		TraceScope(const TraceScope&) = delete;
+		~TraceScope();
+
+		TraceScope& operator=(const TraceScope&) = delete;
+
+	private:
+		const char* name;
+		std::uint64_t start;
+	};
+}
+
+#endif
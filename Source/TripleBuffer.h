@@ -0,0 +1,65 @@
+// Copyright 2022 Justus Zorn
+
+#ifndef Hazard_TripleBuffer_h
+#define Hazard_TripleBuffer_h
+
+#include <atomic>
+#include <cstdint>
+
+namespace Hazard {
+	// Lock-free triple buffer for one producer thread and one consumer thread.
+	// The producer fills Back() and publishes it, the consumer takes the most
+	// recently published buffer with Update() and reads it through Front().
+	template <typename T>
+	class TripleBuffer {
+	public:
+		// Producer
+		T& Back() {
+			return buffers[back];
+		}
+
+		// Publishes the back buffer, replacing a published buffer that was not
+		// consumed yet. The new back buffer still contains old data.
+		void Publish() {
+			std::uint8_t previous = middle.exchange(back | fresh, std::memory_order_acq_rel);
+			back = previous & ~fresh;
+		}
+
+		// Publishes the back buffer only if the previously published buffer was
+		// consumed, so that nothing is lost. Otherwise, the back buffer is kept and
+		// more data can be added to it.
+		bool TryPublish() {
+			std::uint8_t previous = middle.load(std::memory_order_acquire);
+			if (previous & fresh) {
+				return false;
+			}
+			// Only the producer sets the fresh bit, so this cannot fail
+			middle.store(back | fresh, std::memory_order_release);
+			back = previous;
+			return true;
+		}
+
+		// Consumer
+		bool Update() {
+			if (!(middle.load(std::memory_order_acquire) & fresh)) {
+				return false;
+			}
+			std::uint8_t previous = middle.exchange(front, std::memory_order_acq_rel);
+			front = previous & ~fresh;
+			return true;
+		}
+
+		T& Front() {
+			return buffers[front];
+		}
+
+	private:
+		static constexpr std::uint8_t fresh = 0x80;
+
+		T buffers[3];
+		std::atomic<std::uint8_t> middle = 1;
+		std::uint8_t back = 0, front = 2;
+	};
+}
+
+#endif
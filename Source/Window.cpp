@@ -1,38 +1,75 @@
 // Copyright 2022 Justus Zorn
 
-#include <iostream>
-
 #include <stb_image.h>
 
+#include "Allocations.h"
+#include "Clock.h"
+#include "Log.h"
+#include "Trace.h"
 #include "Window.h"
 
 using namespace Hazard;
 
+static SDL_malloc_func sdlMalloc = nullptr;
+static SDL_calloc_func sdlCalloc = nullptr;
+static SDL_realloc_func sdlRealloc = nullptr;
+static SDL_free_func sdlFree = nullptr;
+
+static void* SDLCALL SDLAllocate(size_t size) {
+	CountAllocation(Allocator::SDL, size);
+	return sdlMalloc(size);
+}
+
+static void* SDLCALL SDLAllocateZeroed(size_t count, size_t size) {
+	CountAllocation(Allocator::SDL, count * size);
+	return sdlCalloc(count, size);
+}
+
+static void* SDLCALL SDLReallocate(void* memory, size_t size) {
+	CountAllocation(Allocator::SDL, size);
+	return sdlRealloc(memory, size);
+}
+
+static void SDLCALL SDLFree(void* memory) {
+	if (memory) {
+		CountFree(Allocator::SDL);
+	}
+	sdlFree(memory);
+}
+
 Window::Window(const std::string& title, std::uint32_t width, std::uint32_t height, std::uint32_t fontSize) {
+	// Surfaces and textures of SDL and SDL_ttf are allocated with SDL_malloc.
+	// The previous functions are kept, so that memory SDL allocated before can
+	// still be freed.
+	if (!sdlMalloc) {
+		SDL_GetMemoryFunctions(&sdlMalloc, &sdlCalloc, &sdlRealloc, &sdlFree);
+		SDL_SetMemoryFunctions(SDLAllocate, SDLAllocateZeroed, SDLReallocate, SDLFree);
+	}
+
 	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) {
-		std::cerr << "ERROR: Could not initialize SDL: " << SDL_GetError() << '\n';
+		HAZARD_ERROR("Could not initialize SDL: " << SDL_GetError());
 		return;
 	}
 
 	window = SDL_CreateWindow(title.c_str(), SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, width, height, 0);
 	if (!window) {
-		std::cerr << "ERROR: Could not create window: " << SDL_GetError() << '\n';
+		HAZARD_ERROR("Could not create window: " << SDL_GetError());
 		return;
 	}
 
 	renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
 	if (!renderer) {
-		std::cerr << "ERROR: Could not create renderer: " << SDL_GetError() << '\n';
+		HAZARD_ERROR("Could not create renderer: " << SDL_GetError());
 		return;
 	}
 
 	if (TTF_Init() < 0) {
-		std::cerr << "ERROR: Could not initialize SDL_ttf: " << TTF_GetError() << '\n';
+		HAZARD_ERROR("Could not initialize SDL_ttf: " << TTF_GetError());
 	}
 	else {
 		font = TTF_OpenFont("font.ttf", fontSize);
 		if (!font) {
-			std::cerr << "ERROR: Could not load 'font.ttf': " << TTF_GetError() << '\n';
+			HAZARD_ERROR("Could not load 'font.ttf': " << TTF_GetError());
 		}
 	}
 
@@ -46,6 +83,9 @@ Window::~Window() {
 	SDL_StopTextInput();
 
 	FreeTextures();
+	if (overlayTexture) {
+		SDL_DestroyTexture(overlayTexture);
+	}
 
 	TTF_CloseFont(font);
 	TTF_Quit();
@@ -57,9 +97,14 @@ Window::~Window() {
 }
 
 bool Window::Update() {
+	TraceScope trace("Window::Update");
+	SubsystemScope subsystem(Subsystem::Render);
 	input.Clear();
 
 	bool shouldReload = false;
+	shouldToggleProfiler = false;
+	shouldToggleTrace = false;
+	shouldToggleOverlay = false;
 
 	int windowWidth, windowHeight;
 	SDL_GetWindowSize(window, &windowWidth, &windowHeight);
@@ -74,6 +119,15 @@ bool Window::Update() {
 			if (event.key.keysym.sym == SDLK_F5) {
 				shouldReload = true;
 			}
+			else if (event.key.keysym.sym == SDLK_F6) {
+				shouldToggleProfiler = true;
+			}
+			else if (event.key.keysym.sym == SDLK_F7) {
+				shouldToggleTrace = true;
+			}
+			else if (event.key.keysym.sym == SDLK_F8) {
+				shouldToggleOverlay = true;
+			}
 			input.keyboardInputs.push_back({ event.key.keysym.sym, true });
 			break;
 		case SDL_KEYUP:
@@ -100,14 +154,37 @@ bool Window::Update() {
 }
 
 void Window::Present() {
+	TraceScope trace("Window::Present");
+	SubsystemScope subsystem(Subsystem::Render);
+	std::uint64_t start = GetMicroseconds();
 	SDL_RenderPresent(renderer);
 	SDL_RenderClear(renderer);
+	std::uint64_t end = GetMicroseconds();
+
+	frameStats.presentTime = end - start;
+	frameStats.frameTime = lastPresent > 0 ? end - lastPresent : 0;
+	lastPresent = end;
+	lastFrameStats = frameStats;
+	frameStats = FrameStats();
+	lastTexture = nullptr;
 }
 
 bool Window::ShouldClose() const {
 	return shouldClose;
 }
 
+bool Window::ShouldToggleProfiler() const {
+	return shouldToggleProfiler;
+}
+
+bool Window::ShouldToggleTrace() const {
+	return shouldToggleTrace;
+}
+
+bool Window::ShouldToggleOverlay() const {
+	return shouldToggleOverlay;
+}
+
 void Window::LoadTextures(const std::vector<std::string>& textures) {
 	FreeTextures();
 
@@ -116,43 +193,48 @@ void Window::LoadTextures(const std::vector<std::string>& textures) {
 		int width, height;
 		unsigned char* data = stbi_load(path.c_str(), &width, &height, nullptr, STBI_rgb_alpha);
 		if (!data) {
-			std::cerr << "ERROR: Could not load texture '" << path << "'\n";
+			HAZARD_ERROR("Could not load texture '" << path << "'");
 			loadedTextures.push_back(nullptr);
 			continue;
 		}
 
-		SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC, width, height);
-		if (texture) {
-			if (SDL_UpdateTexture(texture, nullptr, data, width * 4) >= 0) {
-				loadedTextures.push_back(texture);
+		SDL_Texture* loadedTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC, width, height);
+		if (loadedTexture) {
+			if (SDL_UpdateTexture(loadedTexture, nullptr, data, width * 4) >= 0) {
+				loadedTextures.push_back(loadedTexture);
 				stbi_image_free(data);
 				continue;
 			}
-			SDL_DestroyTexture(texture);
+			SDL_DestroyTexture(loadedTexture);
 		}
-		std::cerr << "ERROR: Could not load texture '" << path << "': " << SDL_GetError() << '\n';
+		HAZARD_ERROR("Could not load texture '" << path << "': " << SDL_GetError());
 		loadedTextures.push_back(nullptr);
 		stbi_image_free(data);
 	}
 }
 
-void Window::DrawSprite(const Sprite& sprite) {
+void Window::DrawSprite(const Sprite& sprite, const char* text) {
+	TraceScope trace("Window::DrawSprite");
+	SubsystemScope subsystem(Subsystem::Render);
 	int windowWidth, windowHeight;
 	SDL_GetWindowSize(window, &windowWidth, &windowHeight);
 
 	if (sprite.isText) {
-		if (!font || sprite.text.length() == 0) {
+		++frameStats.textSprites;
+		if (!font || sprite.textLength == 0) {
 			return;
 		}
-		SDL_Surface* surface = TTF_RenderUTF8_Blended_Wrapped(font, sprite.text.c_str(), { sprite.r, sprite.g, sprite.b }, sprite.scale);
+		std::uint64_t textStart = GetMicroseconds();
+		SDL_Surface* surface = TTF_RenderUTF8_Blended_Wrapped(font, text, { sprite.r, sprite.g, sprite.b }, sprite.scale);
 		if (!surface) {
-			std::cerr << "ERROR: Text rendering failed: " << TTF_GetError() << '\n';
+			HAZARD_ERROR("Text rendering failed: " << TTF_GetError());
 			return;
 		}
 		SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
 		SDL_FreeSurface(surface);
+		frameStats.textTime += GetMicroseconds() - textStart;
 		if (!texture) {
-			std::cerr << "ERROR: Text rendering failed: " << SDL_GetError() << '\n';
+			HAZARD_ERROR("Text rendering failed: " << SDL_GetError());
 			return;
 		}
 
@@ -166,10 +248,14 @@ void Window::DrawSprite(const Sprite& sprite) {
 		dst.h = textureHeight;
 
 		SDL_RenderCopy(renderer, texture, nullptr, &dst);
+		CountDrawCall(texture);
 
+		// Every text has its own texture, so the next draw call always switches
 		SDL_DestroyTexture(texture);
+		lastTexture = nullptr;
 	}
 	else {
+		++frameStats.sprites;
 		if (sprite.texture >= loadedTextures.size() || !loadedTextures[sprite.texture]) {
 			return;
 		}
@@ -193,9 +279,56 @@ void Window::DrawSprite(const Sprite& sprite) {
 		dst.h = sprite.scale * 2;
 
 		SDL_RenderCopy(renderer, texture, &src, &dst);
+		CountDrawCall(texture);
 	}
 }
 
+void Window::DrawOverlay(const std::vector<std::string>& lines) {
+	SubsystemScope subsystem(Subsystem::Render);
+	if (!font || lines.empty()) {
+		return;
+	}
+	if (lines != overlayLines || !overlayTexture) {
+		overlayLines = lines;
+		if (overlayTexture) {
+			SDL_DestroyTexture(overlayTexture);
+			overlayTexture = nullptr;
+		}
+		std::string text;
+		for (const std::string& line : lines) {
+			text += line;
+			text += '\n';
+		}
+		SDL_Surface* surface = TTF_RenderUTF8_Blended_Wrapped(font, text.c_str(), { 255, 255, 255 }, 0);
+		if (!surface) {
+			HAZARD_ERROR("Text rendering failed: " << TTF_GetError());
+			return;
+		}
+		overlayTexture = SDL_CreateTextureFromSurface(renderer, surface);
+		SDL_FreeSurface(surface);
+		if (!overlayTexture) {
+			HAZARD_ERROR("Text rendering failed: " << SDL_GetError());
+			return;
+		}
+	}
+
+	int textureWidth, textureHeight;
+	SDL_QueryTexture(overlayTexture, nullptr, nullptr, &textureWidth, &textureHeight);
+	SDL_Rect dst = { 8, 8, textureWidth, textureHeight };
+	SDL_Rect background = { 0, 0, textureWidth + 16, textureHeight + 16 };
+
+	SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 160);
+	SDL_RenderFillRect(renderer, &background);
+	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+	SDL_RenderCopy(renderer, overlayTexture, nullptr, &dst);
+	lastTexture = overlayTexture;
+}
+
+const FrameStats& Window::GetFrameStats() const {
+	return lastFrameStats;
+}
+
 const Input& Window::GetInput() const {
 	return input;
 }
@@ -212,7 +345,15 @@ void Window::ReloadFont(std::uint32_t fontSize) {
 	TTF_CloseFont(font);
 	font = TTF_OpenFont("font.ttf", fontSize);
 	if (!font) {
-		std::cerr << "ERROR: Could not load 'font.ttf': " << TTF_GetError() << '\n';
+		HAZARD_ERROR("Could not load 'font.ttf': " << TTF_GetError());
+	}
+}
+
+void Window::CountDrawCall(SDL_Texture* texture) {
+	++frameStats.drawCalls;
+	if (texture != lastTexture) {
+		++frameStats.textureSwitches;
+		lastTexture = texture;
 	}
 }
 
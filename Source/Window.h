@@ -3,6 +3,7 @@
 #ifndef Hazard_Window_h
 #define Hazard_Window_h
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -12,6 +13,21 @@
 #include "Common.h"
 
 namespace Hazard {
+	// Counted by the Window for every frame, times are in microseconds
+	struct FrameStats {
+		std::uint32_t sprites = 0;
+		std::uint32_t textSprites = 0;
+		std::uint32_t drawCalls = 0;
+		// Draw calls that use a different texture than the previous one
+		std::uint32_t textureSwitches = 0;
+		// Rendering text into textures
+		std::uint64_t textTime = 0;
+		// Waiting for the frame to be presented, including vsync
+		std::uint64_t presentTime = 0;
+		// Time since the previous frame was presented
+		std::uint64_t frameTime = 0;
+	};
+
 	class Window {
 	public:
 		Window(const std::string& title, std::uint32_t width, std::uint32_t height, std::uint32_t fontSize);
@@ -24,9 +40,18 @@ namespace Hazard {
 		void Present();
 
 		bool ShouldClose() const;
+		bool ShouldToggleProfiler() const;
+		bool ShouldToggleTrace() const;
+		bool ShouldToggleOverlay() const;
 
 		void LoadTextures(const std::vector<std::string>& textures);
-		void DrawSprite(const Sprite& sprite);
+		void DrawSprite(const Sprite& sprite, const char* text);
+		// Draws the lines in the top left corner. They are not counted in the
+		// FrameStats.
+		void DrawOverlay(const std::vector<std::string>& lines);
+
+		// Statistics of the last presented frame
+		const FrameStats& GetFrameStats() const;
 
 		const Input& GetInput() const;
 
@@ -40,12 +65,24 @@ namespace Hazard {
 		TTF_Font* font = nullptr;
 
 		bool shouldClose = false;
+		bool shouldToggleProfiler = false;
+		bool shouldToggleTrace = false;
+		bool shouldToggleOverlay = false;
 
 		std::vector<SDL_Texture*> loadedTextures;
 
+		FrameStats frameStats, lastFrameStats;
+		SDL_Texture* lastTexture = nullptr;
+		std::uint64_t lastPresent = 0;
+
+		// The overlay is only rendered again when its text changes
+		std::vector<std::string> overlayLines;
+		SDL_Texture* overlayTexture = nullptr;
+
 		Input input;
 
 		void FreeTextures();
+		void CountDrawCall(SDL_Texture* texture);
 	};
 }
 